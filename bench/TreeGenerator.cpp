@@ -0,0 +1,179 @@
+#include "TreeGenerator.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <random>
+
+namespace
+{
+    constexpr size_t BUFFER_SIZE = 1 << 20;
+    constexpr uint64_t MUTATION_SIZE = 4096;
+
+    /**
+     * @brief splitmix64, fast enough that generating the data never dominates writing it
+     */
+    uint64_t nextRandom(uint64_t &state)
+    {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    void fillRandom(std::vector<char> &buffer, size_t size, uint64_t &state)
+    {
+        for (size_t i = 0; i < size; i += sizeof(uint64_t))
+        {
+            uint64_t value = nextRandom(state);
+            std::copy_n(reinterpret_cast<const char *>(&value), std::min(sizeof(value), size - i), buffer.data() + i);
+        }
+    }
+}
+
+/**
+ * @brief Check the name of a size distribution
+ *
+ * @param name
+ * @return true
+ * @return false
+ */
+bool TreeGenerator::validDistribution(const std::string &name)
+{
+    return name == "fixed" || name == "uniform" || name == "lognormal";
+}
+
+/**
+ * @brief Write the tree
+ * @details The lognormal distribution (sigma 1.5, scaled to the requested mean) gives the long
+ *          tail of real trees: mostly small files and a few large ones that hold much of the data.
+ *
+ * @param root
+ * @return true
+ * @return false
+ */
+bool TreeGenerator::generate(const std::filesystem::path &root)
+{
+    std::mt19937_64 random(spec.seed);
+    constexpr double SIGMA = 1.5;
+    double mean = static_cast<double>(spec.meanSize);
+    std::lognormal_distribution<double> lognormal(std::log(std::max(mean, 1.0)) - SIGMA * SIGMA / 2, SIGMA);
+    std::uniform_int_distribution<uint64_t> uniform(0, 2 * spec.meanSize);
+
+    directories = 1;
+    for (unsigned level = 0; level < spec.depth && directories < std::max<size_t>(spec.files, 1); ++level)
+    {
+        directories *= std::max(spec.fanout, 1u);
+    }
+    directories = std::min(directories, std::max<size_t>(spec.files, 1));
+
+    paths.clear();
+    sizes.clear();
+    totalBytes = 0;
+    std::vector<char> buffer(BUFFER_SIZE);
+    auto oldTime = std::filesystem::file_time_type::clock::now() - std::chrono::hours(1);
+
+    for (size_t index = 0; index < spec.files; ++index)
+    {
+        uint64_t size = spec.meanSize;
+        if (spec.distribution == "uniform")
+        {
+            size = uniform(random);
+        }
+        else if (spec.distribution == "lognormal")
+        {
+            size = static_cast<uint64_t>(std::min(lognormal(random), 64.0 * mean));
+        }
+
+        std::string relativePath = pathOf(index);
+        std::filesystem::path path = root / relativePath;
+        std::error_code error;
+        std::filesystem::create_directories(path.parent_path(), error);
+
+        std::ofstream output(path, std::ios::binary | std::ios::trunc);
+        uint64_t state = spec.seed * 0x100000001b3ULL + index;
+        for (uint64_t written = 0; written < size && output;)
+        {
+            size_t chunk = static_cast<size_t>(std::min<uint64_t>(BUFFER_SIZE, size - written));
+            fillRandom(buffer, chunk, state);
+            output.write(buffer.data(), static_cast<std::streamsize>(chunk));
+            written += chunk;
+        }
+        output.close();
+        if (!output)
+        {
+            std::cerr << "Cannot write " << path << "\n";
+            return false;
+        }
+        std::filesystem::last_write_time(path, oldTime, error);
+
+        paths.push_back(std::move(relativePath));
+        sizes.push_back(size);
+        totalBytes += size;
+    }
+    return true;
+}
+
+/**
+ * @brief Overwrite a 4 KB range in changeRatio of the files
+ * @details The files are picked with their own generator, so the same seed always modifies the
+ *          same files at the same offsets.
+ *
+ * @param root
+ * @return size_t
+ */
+size_t TreeGenerator::mutate(const std::filesystem::path &root)
+{
+    std::mt19937_64 random(spec.seed ^ 0x6d75746174650000ULL);
+    std::vector<size_t> order(paths.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), random);
+
+    size_t count = static_cast<size_t>(std::llround(std::clamp(spec.changeRatio, 0.0, 1.0) * static_cast<double>(paths.size())));
+    std::vector<char> buffer(MUTATION_SIZE);
+    changedBytes = 0;
+    size_t changed = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t index = order[i];
+        uint64_t offset = sizes[index] > MUTATION_SIZE ? random() % (sizes[index] - MUTATION_SIZE) : 0;
+        // Empty files grow by one block so that they change too
+        uint64_t length = std::max<uint64_t>(std::min(MUTATION_SIZE, sizes[index]), sizes[index] == 0 ? MUTATION_SIZE : 0);
+
+        std::fstream file(root / paths[index], std::ios::binary | std::ios::in | std::ios::out);
+        uint64_t state = random();
+        fillRandom(buffer, static_cast<size_t>(length), state);
+        file.seekp(static_cast<std::streamoff>(offset));
+        file.write(buffer.data(), static_cast<std::streamsize>(length));
+        if (file)
+        {
+            sizes[index] = std::max(sizes[index], offset + length);
+            changedBytes += length;
+            changed++;
+        }
+    }
+    return changed;
+}
+
+/**
+ * @brief Relative path of a file: the leaf directory is chosen round-robin, one level per digit in base fanout
+ *
+ * @param index
+ * @return std::string e.g. "d3/d0/d5/f0000123.dat"
+ */
+std::string TreeGenerator::pathOf(size_t index) const
+{
+    std::string path;
+    size_t leaf = index % directories;
+    unsigned fanout = std::max(spec.fanout, 1u);
+    for (unsigned level = 0; level < spec.depth && directories > 1; ++level)
+    {
+        path += "d" + std::to_string(leaf % fanout) + "/";
+        leaf /= fanout;
+    }
+    char name[32];
+    std::snprintf(name, sizeof(name), "f%07zu.dat", index);
+    return path + name;
+}
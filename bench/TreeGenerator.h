@@ -0,0 +1,75 @@
+#ifndef TREEGENERATOR_H
+#define TREEGENERATOR_H
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Shape of a synthetic source tree
+ */
+struct TreeSpec
+{
+    size_t files = 10000;                    // Number of files
+    uint64_t meanSize = 16 * 1024;           // Mean file size in bytes
+    std::string distribution = "lognormal";  // File size distribution: fixed, uniform or lognormal
+    unsigned depth = 3;                      // Directory levels below the root
+    unsigned fanout = 8;                     // Subdirectories per directory
+    double changeRatio = 0.1;                // Share of the files that mutate() modifies
+    uint64_t seed = 1;                       // Same seed, same tree (for a given build)
+};
+
+/**
+ * @brief Generates reproducible synthetic source trees for the benchmark
+ * @details Files are spread round-robin over the fanout^depth leaf directories. Their content
+ *          is pseudo-random (incompressible, nothing deduplicates) and derived from the seed and
+ *          the file number, and their modification time is set an hour back so that a backup
+ *          right after generation does not treat them as racily clean.
+ */
+class TreeGenerator
+{
+public:
+    explicit TreeGenerator(const TreeSpec &spec) : spec(spec) {}
+
+    /**
+     * @brief Check the name of a size distribution
+     *
+     * @param name
+     * @return true if name is fixed, uniform or lognormal
+     */
+    static bool validDistribution(const std::string &name);
+
+    /**
+     * @brief Write the tree
+     *
+     * @param root Created when missing
+     * @return true on success, false on a write error (reported on std::cerr)
+     */
+    bool generate(const std::filesystem::path &root);
+
+    /**
+     * @brief Overwrite a 4 KB range in changeRatio of the files, as an application editing them would
+     *
+     * @param root Tree written by generate()
+     * @return size_t Number of files modified
+     */
+    size_t mutate(const std::filesystem::path &root);
+
+    size_t getFiles() const { return paths.size(); }            // Get the number of generated files
+    size_t getDirectories() const { return directories; }       // Get the number of leaf directories
+    uint64_t getTotalBytes() const { return totalBytes; }       // Get the size of all generated files
+    uint64_t getChangedBytes() const { return changedBytes; }   // Get the number of bytes mutate() rewrote
+
+private:
+    TreeSpec spec;
+    std::vector<std::string> paths;  // Relative paths of the generated files
+    std::vector<uint64_t> sizes;
+    size_t directories = 0;
+    uint64_t totalBytes = 0;
+    uint64_t changedBytes = 0;
+
+    std::string pathOf(size_t index) const;
+};
+
+#endif // TREEGENERATOR_H
@@ -0,0 +1,400 @@
+#include "BackupManager.h"
+#include "CopyEngine.h"
+#include "DirectoryWalker.h"
+#include "Hasher.h"
+#include "Manifest.h"
+#include "ManifestIndex.h"
+#include "TreeGenerator.h"
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "../include/nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+namespace
+{
+    /**
+     * @brief Benchmark options (see displayHelp)
+     */
+    struct BenchOptions
+    {
+        TreeSpec tree;
+        unsigned jobs = WorkerPool::defaultJobs();
+        std::filesystem::path directory;  // Work directory; a temporary one (removed afterwards) when empty
+        std::filesystem::path output;     // JSON report; stdout when empty
+        bool keep = false;
+    };
+
+    void displayHelp()
+    {
+        std::cout << "Help:\n"
+                  << "  backup_bench [options]\n"
+                  << "  \n"
+                  << "  Generates a synthetic source tree, then times scanning, hashing, copying, the metafile and\n"
+                  << "  a full and an incremental backup of it. The report (JSON) goes to stdout.\n"
+                  << "  \n"
+                  << "  --files N            Number of files (default 10000)\n"
+                  << "  --size BYTES         Mean file size (default 16384)\n"
+                  << "  --distribution D     File size distribution: fixed, uniform or lognormal (default)\n"
+                  << "  --depth N            Directory levels (default 3)\n"
+                  << "  --fanout N           Subdirectories per directory (default 8)\n"
+                  << "  --change-ratio R     Share of the files modified before the incremental backup (default 0.1)\n"
+                  << "  --seed N             Seed of the tree generator (default 1)\n"
+                  << "  --jobs N, -j N       Worker threads, 1 to 1024 (default: number of CPU cores)\n"
+                  << "  --dir PATH           Work directory (must not exist or be empty; kept afterwards)\n"
+                  << "  --output FILE        Write the report to FILE instead of stdout\n"
+                  << "  --keep               Keep the temporary work directory\n"
+                  << "  --selftest           Check every compiled SHA-256 and BLAKE3 kernel against known digests\n"
+                  << "                       and exit (status 1 if one is wrong)\n";
+    }
+
+    /**
+     * @brief Check the hash kernels against known digests
+     *
+     * @return int The exit code
+     */
+    int runSelfTest()
+    {
+        std::vector<std::string> report;
+        bool passed = Sha256Batch::selfTest(report);
+        passed = Blake3::selfTest(report) && passed;
+        for (const std::string &line : report)
+        {
+            std::cout << line << "\n";
+        }
+        return passed ? 0 : 1;
+    }
+
+    /**
+     * @brief Parse the command line
+     *
+     * @return int -1 to continue, otherwise the exit code
+     */
+    int parseOptions(int argc, char *argv[], BenchOptions &options)
+    {
+        try
+        {
+            for (int i = 1; i < argc; ++i)
+            {
+                std::string arg = argv[i];
+                bool hasValue = i + 1 < argc;
+                if (arg == "-h" || arg == "--help")
+                {
+                    displayHelp();
+                    return 0;
+                }
+                else if (arg == "--selftest")
+                {
+                    return runSelfTest();
+                }
+                else if (arg == "--files" && hasValue)
+                {
+                    options.tree.files = std::stoull(argv[++i]);
+                }
+                else if (arg == "--size" && hasValue)
+                {
+                    options.tree.meanSize = std::stoull(argv[++i]);
+                }
+                else if (arg == "--distribution" && hasValue)
+                {
+                    options.tree.distribution = argv[++i];
+                }
+                else if (arg == "--depth" && hasValue)
+                {
+                    options.tree.depth = static_cast<unsigned>(std::stoul(argv[++i]));
+                }
+                else if (arg == "--fanout" && hasValue)
+                {
+                    options.tree.fanout = static_cast<unsigned>(std::stoul(argv[++i]));
+                }
+                else if (arg == "--change-ratio" && hasValue)
+                {
+                    options.tree.changeRatio = std::stod(argv[++i]);
+                }
+                else if (arg == "--seed" && hasValue)
+                {
+                    options.tree.seed = std::stoull(argv[++i]);
+                }
+                else if ((arg == "-j" || arg == "--jobs") && hasValue)
+                {
+                    if (!WorkerPool::parseJobs(argv[++i], options.jobs))
+                    {
+                        std::cerr << "Invalid value for --jobs: " << argv[i] << " (1 to " << WorkerPool::MAX_JOBS << ")\n";
+                        return 1;
+                    }
+                }
+                else if (arg == "--dir" && hasValue)
+                {
+                    options.directory = argv[++i];
+                }
+                else if (arg == "--output" && hasValue)
+                {
+                    options.output = argv[++i];
+                }
+                else if (arg == "--keep")
+                {
+                    options.keep = true;
+                }
+                else
+                {
+                    std::cerr << "Unknown or incomplete option: " << arg << " (see --help)\n";
+                    return 1;
+                }
+            }
+        }
+        catch (const std::exception &)
+        {
+            std::cerr << "Invalid numeric option value (see --help)\n";
+            return 1;
+        }
+
+        if (!TreeGenerator::validDistribution(options.tree.distribution))
+        {
+            std::cerr << "Invalid value for --distribution: " << options.tree.distribution << "\n";
+            return 1;
+        }
+        return -1;
+    }
+
+    /**
+     * @brief Peak resident set size of the process so far
+     */
+    uint64_t peakRssKB()
+    {
+        struct rusage usage;
+        ::getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+        return static_cast<uint64_t>(usage.ru_maxrss) / 1024; // Bytes on macOS
+#else
+        return static_cast<uint64_t>(usage.ru_maxrss);        // Kilobytes on Linux
+#endif
+    }
+
+    /**
+     * @brief Discards std::cout while alive (the backup prints every file and its progress)
+     */
+    class QuietOutput
+    {
+    public:
+        QuietOutput() : saved(std::cout.rdbuf(nullptr)) {}
+        ~QuietOutput() { std::cout.rdbuf(saved); }
+
+    private:
+        std::streambuf *saved;
+    };
+
+    /**
+     * @brief Times the phases and collects their results
+     */
+    class Report
+    {
+    public:
+        /**
+         * @brief Run and time one phase
+         *
+         * @param name
+         * @param phase Returns false on failure
+         * @param files Files the phase processes
+         * @param bytes Bytes the phase processes
+         * @return true if the phase succeeded
+         */
+        bool measure(const std::string &name, const std::function<bool()> &phase, size_t files, uint64_t bytes)
+        {
+            auto start = std::chrono::steady_clock::now();
+            bool ok = phase();
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            json result;
+            result["name"] = name;
+            result["ok"] = ok;
+            result["seconds"] = seconds;
+            result["peakRssKB"] = peakRssKB();
+            phases.push_back(result);
+            setCounts(files, bytes);
+
+            std::cerr << name << ": " << seconds << " s" << (ok ? "" : " (FAILED)") << std::endl;
+            failed = failed || !ok;
+            return ok;
+        }
+
+        /**
+         * @brief Set the amount of work of the last phase, for phases that only know it afterwards
+         *
+         * @param files
+         * @param bytes
+         */
+        void setCounts(size_t files, uint64_t bytes)
+        {
+            json &result = phases.back();
+            double seconds = result["seconds"].get<double>();
+            double divisor = seconds > 0 ? seconds : 1e-9;
+            result["files"] = files;
+            result["bytes"] = bytes;
+            result["filesPerSecond"] = static_cast<double>(files) / divisor;
+            result["mbPerSecond"] = static_cast<double>(bytes) / (1024.0 * 1024.0) / divisor;
+        }
+
+        json phases = json::array();
+        bool failed = false;
+    };
+
+    /**
+     * @brief Run the backup program as `backup <source> <destination> --mode <mode> --yes --jobs <jobs>`
+     */
+    bool runBackup(const std::filesystem::path &source, const std::filesystem::path &destination,
+                   const std::string &mode, unsigned jobs)
+    {
+        std::vector<std::string> args = {"backup", source.string(), destination.string(), "--mode", mode,
+                                         "--yes", "--jobs", std::to_string(jobs)};
+        std::vector<char *> argv;
+        for (auto &arg : args)
+        {
+            argv.push_back(arg.data());
+        }
+        argv.push_back(nullptr);
+
+        QuietOutput quiet;
+        BackupManager backupManager;
+        return backupManager.run(static_cast<int>(args.size()), argv.data()) == 0;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    BenchOptions options;
+    int exitCode = parseOptions(argc, argv, options);
+    if (exitCode >= 0)
+    {
+        return exitCode;
+    }
+
+    std::filesystem::path work = options.directory;
+    std::error_code error;
+    if (work.empty())
+    {
+        work = std::filesystem::temp_directory_path() / ("backup_bench-" + std::to_string(::getpid()));
+    }
+    else if (std::filesystem::exists(work) && !std::filesystem::is_empty(work, error))
+    {
+        std::cerr << "The work directory " << work << " is not empty\n";
+        return 1;
+    }
+    std::filesystem::path source = work / "source";
+    std::filesystem::path copy = work / "copy";
+    std::filesystem::path backup = work / "backup";
+    std::filesystem::create_directories(work, error);
+    std::cerr << "Work directory: " << work << std::endl;
+
+    Report report;
+    TreeGenerator generator(options.tree);
+    if (!report.measure("generate", [&] { return generator.generate(source); }, options.tree.files, 0))
+    {
+        return 1;
+    }
+    size_t files = generator.getFiles();
+    uint64_t bytes = generator.getTotalBytes();
+    report.setCounts(files, bytes);
+
+    // The same walk the backup does
+    PathArena arena;
+    std::vector<FileRecord> records;
+    report.measure("scan", [&]
+                   {
+                       records = DirectoryWalker(source, {"backup_timestamp.btd"}, options.jobs).scan(arena);
+                       return records.size() == files; },
+                   files, 0);
+
+    std::vector<std::filesystem::path> paths;
+    for (const auto &record : records)
+    {
+        paths.push_back(source / record.relativePath);
+    }
+    std::vector<std::string> digests;
+    report.measure("hash", [&]
+                   {
+                       digests = HashPool(options.jobs).hashFiles(paths);
+                       return std::none_of(digests.begin(), digests.end(), [](const std::string &digest)
+                                           { return digest.empty(); }); },
+                   files, bytes);
+    report.measure("hash_serial", [&]
+                   {
+                       Tool tool;
+                       for (size_t i = 0; i < paths.size(); ++i)
+                       {
+                           if (tool.calculate_sha256(paths[i].string()) != digests[i])
+                           {
+                               return false;
+                           }
+                       }
+                       return true; },
+                   files, bytes);
+    report.measure("copy", [&]
+                   {
+                       QuietOutput quiet;
+                       CopyEngine engine(options.jobs);
+                       engine.copyFiles(records, source, copy, bytes);
+                       return engine.getErrors().empty(); },
+                   files, bytes);
+    std::filesystem::remove_all(copy, error);
+
+    report.measure("backup_full", [&] { return runBackup(source, backup, "full", options.jobs); }, files, bytes);
+
+    std::filesystem::path manifestPath = source / "backup_timestamp.btd";
+    uint64_t manifestBytes = std::filesystem::file_size(manifestPath, error);
+    json manifest;
+    ManifestFormat format = ManifestFormat::Json;
+    report.measure("manifest_load", [&] { return Manifest::load(manifestPath, manifest, &format); }, files, manifestBytes);
+    report.measure("manifest_index_load", [&]
+                   {
+                       ManifestIndex index;
+                       return index.load(manifestPath, source.string()) && index.size() == files; },
+                   files, manifestBytes);
+    report.measure("manifest_save", [&] { return Manifest::save(work / "manifest.btd", manifest, format); },
+                   files, manifestBytes);
+
+    size_t changed = 0;
+    report.measure("mutate", [&]
+                   {
+                       changed = generator.mutate(source);
+                       return true; },
+                   0, 0);
+    report.setCounts(changed, generator.getChangedBytes());
+
+    report.measure("backup_incremental", [&] { return runBackup(source, backup, "incremental", options.jobs); },
+                   files, bytes);
+
+    json result;
+    result["tree"] = {{"files", files},
+                      {"bytes", bytes},
+                      {"directories", generator.getDirectories()},
+                      {"meanSize", options.tree.meanSize},
+                      {"distribution", options.tree.distribution},
+                      {"depth", options.tree.depth},
+                      {"fanout", options.tree.fanout},
+                      {"changeRatio", options.tree.changeRatio},
+                      {"seed", options.tree.seed}};
+    result["jobs"] = options.jobs;
+    result["phases"] = report.phases;
+    result["peakRssKB"] = peakRssKB();
+
+    if (options.output.empty())
+    {
+        std::cout << result.dump(4) << std::endl;
+    }
+    else
+    {
+        std::ofstream output(options.output);
+        output << result.dump(4) << std::endl;
+    }
+
+    if (options.directory.empty() && !options.keep)
+    {
+        std::filesystem::remove_all(work, error);
+    }
+    return report.failed ? 1 : 0;
+}
@@ -1,13 +1,36 @@
 #include "FileUtils.h"
 #include "BackupManager.h"
+#include "BackupVerifier.h"
+#include "RestoreEngine.h"
+#include "ChunkStore.h"
+#include "CopyEngine.h"
+#include "DirectoryWalker.h"
+#include "IoUring.h"
+#include "Hasher.h"
+#include "JournalWatcher.h"
 #include "ParameterManagement.h"
+#include "Trace.h"
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <sys/stat.h>
+#include <unordered_set>
 #include "../include/nlohmann/json.hpp"
 
 using json = nlohmann::json;
 
+/**
+ * @brief Files of the backup itself in the root of the source directory, never backed up
+ *
+ * @return std::vector<std::string>
+ */
+static std::vector<std::string> bookkeepingNames()
+{
+    std::string lookupFile = ManifestIndex::lookupPath("backup_timestamp.btd").string();
+    return {"backup_timestamp.btd", lookupFile, lookupFile + ".tmp", ChangeJournal::FILE_NAME, ChangeJournal::COOKIE_NAME};
+}
+
 /**
  * @brief Run the backup program
  * @details The whole process of running the main program.
@@ -15,7 +38,24 @@ using json = nlohmann::json;
 int BackupManager::run(int argc, char *argv[])
 {
     auto args = Parameter::parseArgs(argc, argv);
-    if (argc != 3 || argc < 2)
+    if (args.count("command") && args["command"] == "watch")
+    {
+        if (!args.count("source") || !std::filesystem::is_directory(args["source"]))
+        {
+            std::cerr << "backup usage: " << argv[0] << " watch <source_directory>\n";
+            return 1;
+        }
+        return JournalWatcher(std::filesystem::absolute(args["source"]), bookkeepingNames()).run();
+    }
+
+    if (args.count("command") && args["command"] == "verify" && args.count("source") && !args.count("destination"))
+    {
+        // `backup verify <destination_directory>` checks against the metafile kept in the backup
+        args["destination"] = args["source"];
+        args["source"] = "";
+    }
+
+    if (!args.count("source") || !args.count("destination"))
     {
         if (args.count("version"))
         {
@@ -29,18 +69,103 @@ int BackupManager::run(int argc, char *argv[])
         }
         std::cerr << "backup usage: backup\n"
                   << "                        " << argv[0] << " <source_directory> <destination_directory>\n"
-                  << "                        [--version | -v | --help | -h]\n";
+                  << "                        [--jobs N | -j N] [--paranoid] [--io-uring] [--repository] [--delta] [--generations]\n"
+                  << "                        [--mode full|incremental] [--yes | -y] [--hash blake3|sha256] [--stats-json FILE] [--trace FILE] [--version | -v | --help | -h]\n"
+                  << "                        " << argv[0] << " watch <source_directory>\n"
+                  << "                        " << argv[0] << " verify [<source_directory | metafile>] <destination_directory> [--sample P%]\n"
+                  << "                        " << argv[0] << " restore <destination_directory> <target_directory> [--path SUB] [--manifest FILE]\n";
+        return 1;
+    }
+
+    sourceDir = args["source"].empty() ? std::filesystem::path() : std::filesystem::absolute(args["source"]);
+    backupDir = std::filesystem::absolute(args["destination"]);
+
+    paranoid = args.count("paranoid") != 0;
+    repository = args.count("repository") != 0 || ChunkStore::isRepository(backupDir);
+    generational = !repository && (args.count("generations") != 0 || Generations::isGenerational(backupDir));
+    // Delta updates rewrite files in place, which would change the linked files of older generations
+    delta = args.count("delta") != 0 && !repository && !generational;
+    assumeYes = args.count("yes") != 0;
+    if (args.count("mode"))
+    {
+        mode = args["mode"];
+        if (mode != "full" && mode != "incremental")
+        {
+            std::cerr << "Invalid value for --mode: " << mode << " (full or incremental)\n";
+            return 1;
+        }
+    }
+    ioUring = args.count("io-uring") != 0;
+    if (ioUring && !IoUring::available())
+    {
+        std::cerr << "io_uring is not available on this system, using the thread pool instead.\n";
+        ioUring = false;
+    }
+
+    if (args.count("manifest-format"))
+    {
+        ManifestFormat format;
+        if (!Manifest::parseFormat(args["manifest-format"], format))
+        {
+            std::cerr << "Invalid value for --manifest-format: " << args["manifest-format"] << " (json or cbor)\n";
+            return 1;
+        }
+        manifestFormat = format;
+    }
+
+    if (args.count("hash"))
+    {
+        ChangeHash hash;
+        if (!Hasher::parseChangeHash(args["hash"], hash))
+        {
+            std::cerr << "Invalid value for --hash: " << args["hash"] << " (blake3 or sha256)\n";
+            return 1;
+        }
+        changeHash = hash;
+    }
+
+    if (args.count("convert"))
+    {
+        return convertManifest();
+    }
+
+    if (args.count("jobs") && !WorkerPool::parseJobs(args["jobs"], jobs))
+    {
+        std::cerr << "Invalid value for --jobs: " << args["jobs"] << " (1 to " << WorkerPool::MAX_JOBS << ")\n";
         return 1;
     }
 
-    sourceDir = std::filesystem::absolute(argv[1]);
-    backupDir = std::filesystem::absolute(argv[2]);
+    if (args.count("trace"))
+    {
+        Trace::start(args["trace"]); // Written when the program exits
+    }
+
+    if (args.count("command") && args["command"] == "verify")
+    {
+        return verifyBackup(args.count("sample") ? args["sample"] : "", args.count("stats-json") ? args["stats-json"] : "");
+    }
+    if (args.count("command") && args["command"] == "restore")
+    {
+        return restoreBackup(args.count("path") ? args["path"] : "", args.count("manifest") ? args["manifest"] : "",
+                             args.count("stats-json") ? args["stats-json"] : "");
+    }
 
     if (!validateDirectories())
     {
         return 1;
     }
 
+    targetDir = backupDir;
+    previousDir = backupDir;
+    if (generational)
+    {
+        generations.open(backupDir, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                        std::chrono::system_clock::now().time_since_epoch())
+                                        .count());
+        targetDir = generations.getDirectory();
+        previousDir = generations.getPreviousDirectory();
+    }
+
     if (!getBackupTypeFromUser())
     {
         return 0;
@@ -59,10 +184,198 @@ int BackupManager::run(int argc, char *argv[])
     performBackup();
     generateBackupMetadata();
 
+    if (args.count("stats-json"))
+    {
+        nlohmann::json info;
+        info["mode"] = isIncremental ? "incremental" : "full";
+        info["source"] = sourceDir.string();
+        info["destination"] = backupDir.string();
+        info["jobs"] = jobs;
+        info["repository"] = repository;
+        if (generational)
+        {
+            info["generation"] = generations.getName();
+        }
+        info["changeHash"] = Hasher::changeHashName(changeHash.value_or(ChangeHash::Blake3));
+        if (!stats.write(args["stats-json"], info))
+        {
+            std::cerr << "Failed to write the run statistics: " << args["stats-json"] << "\n";
+        }
+    }
+
     std::cout << "\nBackup completed successfully.\n";
     return 0;
 }
 
+/**
+ * @brief Convert a metafile between JSON and CBOR (--convert)
+ * @details sourceDir is the metafile to read and backupDir the file to write.
+ */
+int BackupManager::convertManifest()
+{
+    ManifestFormat from = Manifest::detectFormat(sourceDir);
+    ManifestFormat to = manifestFormat.value_or(from == ManifestFormat::Json ? ManifestFormat::Cbor : ManifestFormat::Json);
+
+    if (!Manifest::convert(sourceDir, backupDir, to))
+    {
+        std::cerr << "Failed to convert " << sourceDir << " to " << backupDir << "\n";
+        return 1;
+    }
+    std::cout << "Converted " << sourceDir << " (" << Manifest::formatName(from) << ") to "
+              << backupDir << " (" << Manifest::formatName(to) << ")\n";
+    return 0;
+}
+
+/**
+ * @brief Find the metafile copy a backup keeps (in "latest" for generations)
+ *
+ * @param backupDir
+ * @return std::filesystem::path
+ */
+static std::filesystem::path backupMetafile(const std::filesystem::path &backupDir)
+{
+    std::filesystem::path filesDir = Generations::isGenerational(backupDir) ? backupDir / Generations::LATEST_NAME : backupDir;
+    return filesDir / "backup_timestamp.btd";
+}
+
+/**
+ * @brief Check a backup against the metafile of its source (`backup verify`)
+ * @details sourceDir is the source directory or its metafile, backupDir the backup to check.
+ *          Without sourceDir the metafile copy kept in the backup is used.
+ *
+ * @param sample Value of --sample (empty to check every file)
+ * @param statsFile Value of --stats-json (empty for none)
+ * @return int 0 when the backup matches, 2 when a problem was found, 1 on errors
+ */
+int BackupManager::verifyBackup(const std::string &sample, const std::string &statsFile)
+{
+    double fraction = 1.0;
+    if (!sample.empty() && !BackupVerifier::parseSample(sample, fraction))
+    {
+        std::cerr << "Invalid value for --sample: " << sample << " (a percentage above 0 and up to 100)\n";
+        return 1;
+    }
+    if (!std::filesystem::is_directory(backupDir))
+    {
+        std::cerr << "Destination directory does not exist or is not a directory\n";
+        return 1;
+    }
+
+    std::filesystem::path metadataFile = sourceDir;
+    std::string directory = sourceDir.parent_path().string();
+    if (sourceDir.empty())
+    {
+        metadataFile = backupMetafile(backupDir);
+        directory.clear(); // The first location of the metafile
+        if (!std::filesystem::is_regular_file(metadataFile))
+        {
+            std::cerr << "No metafile in the backup directory, pass the source directory or its metafile\n";
+            return 1;
+        }
+    }
+    else if (std::filesystem::is_directory(sourceDir))
+    {
+        metadataFile = sourceDir / "backup_timestamp.btd";
+        directory = sourceDir.string();
+    }
+
+    BackupVerifier verifier(jobs, ioUring, changeHash, stats);
+    if (!verifier.verify(metadataFile, directory, backupDir, fraction))
+    {
+        return 1;
+    }
+
+    if (!statsFile.empty())
+    {
+        nlohmann::json info;
+        info["mode"] = "verify";
+        info["source"] = sourceDir.empty() ? metadataFile.string() : sourceDir.string();
+        info["destination"] = backupDir.string();
+        info["jobs"] = jobs;
+        info["sample"] = fraction;
+        if (!stats.write(statsFile, info))
+        {
+            std::cerr << "Failed to write the run statistics: " << statsFile << "\n";
+        }
+    }
+    return verifier.isClean() ? 0 : 2;
+}
+
+/**
+ * @brief Restore a backup into a directory (`backup restore`)
+ * @details sourceDir is the backup to restore from, backupDir the directory to restore into. The
+ *          metafile copy a backup keeps is used unless another metafile is given.
+ *
+ * @param subPath Value of --path (empty to restore everything)
+ * @param manifestFile Value of --manifest (empty to look for the metafile)
+ * @param statsFile Value of --stats-json (empty for none)
+ * @return int 0 when every file was restored, 2 when some file failed or is missing, 1 on errors
+ */
+int BackupManager::restoreBackup(const std::string &subPath, const std::string &manifestFile, const std::string &statsFile)
+{
+    if (!std::filesystem::is_directory(sourceDir))
+    {
+        std::cerr << "Backup directory does not exist or is not a directory\n";
+        return 1;
+    }
+
+    std::filesystem::path metadataFile = manifestFile;
+    if (metadataFile.empty())
+    {
+        for (const auto &candidate : {backupMetafile(sourceDir), backupDir / "backup_timestamp.btd"})
+        {
+            if (std::filesystem::is_regular_file(candidate))
+            {
+                metadataFile = candidate;
+                break;
+            }
+        }
+    }
+    if (metadataFile.empty())
+    {
+        std::cerr << "No metafile in the backup or the target directory, pass one with --manifest\n";
+        return 1;
+    }
+
+    RestoreEngine engine(jobs, ioUring, stats);
+    if (!engine.plan(metadataFile, sourceDir, backupDir, subPath))
+    {
+        return 1;
+    }
+    std::cout << "Restore plan: " << engine.getPlannedCount() << " files, " << engine.getIdenticalCount()
+              << " already identical (" << engine.getTouchCount() << " of them get their modification time back), "
+              << engine.getRestoreCount() << " to restore, " << engine.getMissingCount() << " missing from the backup"
+              << std::endl;
+
+    if (!assumeYes && (engine.getRestoreCount() != 0 || engine.getTouchCount() != 0))
+    {
+        std::cout << "Files in " << backupDir << " will be overwritten. Proceed with the restore? (y/n): ";
+        char confirm;
+        std::cin >> confirm;
+        if (confirm != 'y' && confirm != 'Y')
+        {
+            std::cout << "Restore cancelled.\n";
+            return 0;
+        }
+    }
+
+    bool complete = engine.run();
+    if (!statsFile.empty())
+    {
+        nlohmann::json info;
+        info["mode"] = "restore";
+        info["source"] = sourceDir.string();
+        info["destination"] = backupDir.string();
+        info["jobs"] = jobs;
+        info["path"] = subPath;
+        if (!stats.write(statsFile, info))
+        {
+            std::cerr << "Failed to write the run statistics: " << statsFile << "\n";
+        }
+    }
+    return complete ? 0 : 2;
+}
+
 /**
  * @brief Verify catalog validity
  */
@@ -82,10 +395,16 @@ bool BackupManager::validateDirectories()
 }
 
 /**
- * @brief Obtain the backup type from the user operation
+ * @brief Obtain the backup type from the user operation (or from --mode)
  */
 bool BackupManager::getBackupTypeFromUser()
 {
+    if (!mode.empty())
+    {
+        isIncremental = (mode == "incremental");
+        return true;
+    }
+
     std::cout << "Select backup type:\n";
     std::cout << "1. Full backup\n";
     std::cout << "2. Incremental backup\n";
@@ -118,6 +437,9 @@ bool BackupManager::prepareBackupFiles()
         }
     }
 
+    // With `backup watch` running, everything changed before this point is in the journal
+    journalSynced = journal.open(sourceDir) && journal.sync();
+
     if (isIncremental && !latestMetadata.empty())
     {
         filesToBackup = getFilesToBackup(latestMetadata);
@@ -125,13 +447,7 @@ bool BackupManager::prepareBackupFiles()
     else
     {
         // Full Backup - Recursively back up all your files
-        for (const auto &entry : std::filesystem::recursive_directory_iterator(sourceDir))
-        {
-            if (entry.is_regular_file() && entry.path().filename() != "backup_timestamp.btd")
-            {
-                filesToBackup.push_back(entry.path());
-            }
-        }
+        filesToBackup = scanSourceFiles();
     }
 
     // Statistics on the number of files and modifications
@@ -142,7 +458,7 @@ bool BackupManager::prepareBackupFiles()
 
     for (const auto &file : filesToBackup)
     {
-        std::cout << " + " << std::filesystem::relative(file, sourceDir) << "\n";
+        std::cout << " + " << std::filesystem::path(file.relativePath) << "\n";
     }
 
     if (FilesCount != 0 || ChangeCount != 0)
@@ -156,73 +472,308 @@ bool BackupManager::prepareBackupFiles()
 }
 
 /**
- * @brief Gets a list of files that need to be backed up (incremental backups), including some operations
- * @details Try to calculate the file modification time first, and then calculate SHA256 if it is inconsistent.
+ * @brief Walk the source directory once and record every regular file
+ * @details This is the only walk of a backup run; the records are reused by the diff, copy
+ *          and metadata stages. Their relative paths live in pathArena.
  *
- * @param metadataFile
- * @return std::vector<std::filesystem::path>
+ * @return std::vector<FileRecord>
  */
-std::vector<std::filesystem::path> BackupManager::getFilesToBackup(const std::filesystem::path &metadataFile)
+std::vector<FileRecord> BackupManager::scanSourceFiles()
 {
-    std::vector<std::filesystem::path> files;
+    scanTimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::system_clock::now().time_since_epoch())
+                     .count();
 
-    int FilesCount = 0, ChangeCount = 0;
-    try
+    auto timer = stats.time(RunPhase::Scan);
+    std::vector<FileRecord> records = DirectoryWalker(sourceDir, bookkeepingNames(), jobs).scan(pathArena);
+    stats.set("files.scanned", records.size());
+    if (generational)
     {
-        // Read the metadata file
-        std::ifstream input(metadataFile);
-        json backupData;
-        input >> backupData;
+        sourcePaths.clear();
+        for (const auto &record : records)
+        {
+            sourcePaths.push_back(record.relativePath);
+        }
+    }
+    return records;
+}
 
-        for (const auto &entry : std::filesystem::recursive_directory_iterator(sourceDir))
+/**
+ * @brief Find the files that may have changed since the last backup
+ * @details When `backup watch` has been running since the last backup, only the paths in its
+ *          journal are looked at: changed files are stat'ed and new directories walked. Anything
+ *          else (no watcher, a restarted journal, lost events, or a last backup that did not
+ *          finish cleanly) falls back to walking the whole source directory.
+ *
+ *          In generations mode the files the source still has are listed as well: the entries of
+ *          the last backup that were not deleted since, and the new files.
+ *
+ * @param index Metafile of the last backup
+ * @return std::vector<FileRecord> Sorted by relative path
+ */
+std::vector<FileRecord> BackupManager::scanChangedFiles(const ManifestIndex &index)
+{
+    std::vector<std::string> changedFiles;
+    std::vector<std::string> changedDirectories;
+    std::vector<std::string> deletedPaths;
+    bool covered;
+    {
+        auto timer = stats.time(RunPhase::Scan);
+        covered = journalSynced && index.getJournalId() == journal.getId() &&
+                  journal.readChanges(index.getJournalOffset(), changedFiles, changedDirectories, deletedPaths);
+    }
+    if (!covered)
+    {
+        if (journalSynced)
         {
+            std::cout << "The change journal does not cover the last backup, scanning " << sourceDir << std::endl;
+        }
+        return scanSourceFiles();
+    }
 
-            if (entry.is_regular_file() && entry.path().filename() != "backup_timestamp.btd")
-            {
-                std::filesystem::path relativePath = std::filesystem::relative(entry.path(), sourceDir);
-                std::filesystem::path destFile = backupDir / relativePath;
+    auto timer = stats.time(RunPhase::Scan);
+    scanTimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::system_clock::now().time_since_epoch())
+                     .count();
+
+    std::vector<FileRecord> records;
+    for (const std::string &path : changedFiles)
+    {
+        FileRecord record;
+        if (Tool::statFile(sourceDir / path, record) && S_ISREG(record.mode))
+        {
+            record.relativePath = pathArena.store(path);
+            records.push_back(std::move(record));
+        }
+    }
+    for (const std::string &directory : changedDirectories)
+    {
+        for (auto &record : DirectoryWalker(sourceDir / directory, bookkeepingNames(), jobs).scan(pathArena))
+        {
+            record.relativePath = pathArena.join(directory, record.relativePath);
+            records.push_back(std::move(record));
+        }
+    }
+
+    // A file can be both modified and inside a new directory
+    std::sort(records.begin(), records.end(), [](const FileRecord &a, const FileRecord &b)
+              { return a.relativePath < b.relativePath; });
+    records.erase(std::unique(records.begin(), records.end(), [](const FileRecord &a, const FileRecord &b)
+                              { return a.relativePath == b.relativePath; }),
+                  records.end());
 
-                // Files that do not have a target directory or metafile (new additions are also performed through this)
-                if (!std::filesystem::exists(destFile) || !backupData["location"][0]["listFiles"].contains(relativePath.string()))
+    if (generational)
+    {
+        // A path counts as deleted when it or one of its directories was, unless it is back as a regular file
+        std::unordered_set<std::string_view> deleted(deletedPaths.begin(), deletedPaths.end());
+        auto isDeleted = [&](std::string_view path)
+        {
+            for (std::string_view prefix = path;;)
+            {
+                if (deleted.count(prefix) != 0)
                 {
-                    FilesCount++;
-                    files.push_back(entry.path());
+                    FileRecord probe;
+                    return !(Tool::statFile(sourceDir / path, probe) && S_ISREG(probe.mode));
                 }
-
-                // Both the source directory and the target directory (i.e., the meta file also contains)
-                if (std::filesystem::exists(sourceDir) && backupData["location"][0]["listFiles"].contains(relativePath.string()))
+                size_t slash = prefix.rfind('/');
+                if (slash == std::string_view::npos)
                 {
-                    // The time when the source directory file was modified and SHA-256
-                    auto sourceTime = tool.stringToTimeT(tool.getFileModificationTime(entry.path()));
-                    std::string currentSHA256 = tool.calculate_sha256(entry.path());
-
-                    // The time when the object was modified and SHA-256
-                    auto destTime = tool.stringToTimeT(backupData["location"][0]["listFiles"][relativePath.string()]["modified"]);
-                    std::string metadataSHA256 = backupData["location"][0]["listFiles"][relativePath.string()]["sha256"];
-
-                    if (sourceTime > destTime || metadataSHA256 != currentSHA256)
-                    {
-                        ChangeCount++;
-                        files.push_back(entry.path());
-                    }
+                    return false;
                 }
+                prefix = prefix.substr(0, slash);
             }
+        };
+        sourcePaths.clear();
+        index.forEach([&](std::string_view path, const ManifestRecord &)
+        {
+            if (!isDeleted(path))
+            {
+                sourcePaths.push_back(pathArena.store(path));
+            }
+        });
+        for (const auto &record : records)
+        {
+            if (index.find(record.relativePath) == nullptr)
+            {
+                sourcePaths.push_back(record.relativePath);
+            }
+        }
+    }
+
+    stats.set("files.scanned", records.size());
+    stats.set("journal.changedFiles", changedFiles.size());
+    stats.set("journal.newDirectories", changedDirectories.size());
+    std::cout << "Change journal: " << changedFiles.size() << " changed files and " << changedDirectories.size()
+              << " new directories since the last backup" << std::endl;
+    return records;
+}
+
+/**
+ * @brief Check whether a file still matches its metafile entry without reading it
+ * @details Like the git index: size, mtime, ctime, inode and device must all match the values
+ *          recorded by the previous backup. An entry whose mtime falls within RACY_WINDOW_NS of that
+ *          backup's scan is "racily clean" (it may have been written again within the same
+ *          timestamp tick after it was recorded) and never passes.
+ *
+ * @param record
+ * @param entry
+ * @param lastScanTimeNs Scan time recorded in the metafile
+ * @return true if the file can be treated as unchanged
+ */
+static bool isStatClean(const FileRecord &record, const ManifestRecord &entry, int64_t lastScanTimeNs)
+{
+    constexpr int64_t RACY_WINDOW_NS = 1000000000;
+
+    if (!(entry.flags & ManifestRecord::HAS_STAT) || !(entry.flags & ManifestRecord::HAS_SIZE))
+    {
+        return false; // Written by an older version
+    }
+    if (entry.mtimeNs + RACY_WINDOW_NS > lastScanTimeNs)
+    {
+        return false;
+    }
+    return entry.size == record.size &&
+           entry.mtimeNs == record.mtimeNs &&
+           entry.ctimeNs == record.ctimeNs &&
+           entry.inode == record.inode &&
+           entry.device == record.device;
+}
+
+/**
+ * @brief Gets a list of files that need to be backed up (incremental backups), including some operations
+ * @details Files whose stat data still matches the metafile are skipped without being read (unless
+ *          --paranoid is given). The rest are hashed in parallel; a file with unchanged content only
+ *          gets its metafile entry refreshed so it takes the fast path next time.
+ *
+ *          Entries that carry a digest of the change hash (BLAKE3) are compared on it alone; their
+ *          SHA-256 is kept, since the content is the same. Entries written before the change hash
+ *          existed are compared on SHA-256 and get the change hash from the same read.
+ *
+ * @param metadataFile
+ * @return std::vector<FileRecord>
+ */
+std::vector<FileRecord> BackupManager::getFilesToBackup(const std::filesystem::path &metadataFile)
+{
+    std::vector<FileRecord> files;
+
+    int FilesCount = 0, ChangeCount = 0;
+
+    // Stream the metadata file into a flat path index (no json DOM)
+    ManifestIndex index;
+    {
+        auto timer = stats.time(RunPhase::Diff);
+        if (!index.load(metadataFile, sourceDir.string()))
+        {
+            return files;
+        }
+        stats.set("manifest.mapped", index.isMapped());
+    }
+    ChangeHash recorded;
+    if (!changeHash)
+    {
+        changeHash = Hasher::parseChangeHash(index.getChangeHash(), recorded) ? recorded : ChangeHash::Blake3;
+    }
+    bool useBlake3 = *changeHash == ChangeHash::Blake3;
+
+    // Files already in the metafile are hashed afterwards in parallel
+    std::vector<FileRecord> knownFiles;
+    std::vector<const ManifestRecord *> knownEntries;
+    std::vector<std::filesystem::path> fastPaths; // Compared on the change hash alone
+    std::vector<std::filesystem::path> fullPaths; // Compared on SHA-256
+    std::vector<bool> knownFast;
+    uint64_t knownSize = 0;
+
+    std::vector<FileRecord> scanned = scanChangedFiles(index);
+    auto diffTimer = std::make_optional<RunStats::Timer>(stats, RunPhase::Diff);
+    for (auto &record : scanned)
+    {
+        std::filesystem::path destFile = previousDir / record.relativePath;
+        const ManifestRecord *entry = index.find(record.relativePath);
+
+        // Files that do not have a target directory or metafile (new additions are also performed through this);
+        // a repository keeps no per-file copies, its chunk lists live in the metafile
+        if (entry == nullptr || (!repository && (previousDir.empty() || !std::filesystem::exists(destFile))))
+        {
+            FilesCount++;
+            files.push_back(std::move(record));
+        }
+        // Both the source directory and the target directory (i.e., the meta file also contains)
+        else if (paranoid || !isStatClean(record, *entry, index.getScanTimeNs()))
+        {
+            bool fast = useBlake3 && (entry->flags & ManifestRecord::HAS_BLAKE3);
+            (fast ? fastPaths : fullPaths).push_back(sourceDir / record.relativePath);
+            knownFast.push_back(fast);
+            knownSize += record.size;
+            knownEntries.push_back(entry);
+            knownFiles.push_back(std::move(record));
         }
     }
-    catch (const json::exception &e)
+
+    diffTimer.reset();
+
+    std::vector<FileDigest> fastDigests;
+    std::vector<FileDigest> fullDigests;
     {
-        std::cerr << "JSON processing error: " << e.what() << std::endl;
+        auto timer = stats.time(RunPhase::Hash);
+        HashPool hashPool(jobs, ioUring);
+        fastDigests = hashPool.digestFiles(fastPaths, Hasher::BLAKE3);
+        stats.addLatency("hash", hashPool.getLatency());
+        fullDigests = hashPool.digestFiles(fullPaths, Hasher::copyHashes(*changeHash));
+        stats.addLatency("hash", hashPool.getLatency());
+        stats.set("files.hashed", fastPaths.size() + fullPaths.size());
+        stats.set("files.hashedSha256", fullPaths.size());
+        stats.set("bytes.hashed", knownSize);
+    }
+
+    diffTimer.emplace(stats, RunPhase::Diff);
+    for (size_t i = 0, fastIndex = 0, fullIndex = 0; i < knownFiles.size(); ++i)
+    {
+        const ManifestRecord &entry = *knownEntries[i];
+        const FileDigest &digest = knownFast[i] ? fastDigests[fastIndex++] : fullDigests[fullIndex++];
+        bool sameContent = digest.hashes != 0 && entry.size == knownFiles[i].size &&
+                           (knownFast[i] ? entry.blake3 == digest.blake3
+                                         : (entry.flags & ManifestRecord::HAS_SHA256) && entry.sha256 == digest.sha256);
+
+        if (!sameContent)
+        {
+            ChangeCount++;
+            files.push_back(std::move(knownFiles[i]));
+        }
+        else
+        {
+            // Same content, only the stat data moved (touch, chmod, restore from backup, ...)
+            knownFiles[i].sha256 = Hasher::toHex(entry.sha256);
+            if (digest.hashes & Hasher::BLAKE3)
+            {
+                knownFiles[i].blake3 = Hasher::toHex(digest.blake3);
+            }
+            else if (entry.flags & ManifestRecord::HAS_BLAKE3)
+            {
+                knownFiles[i].blake3 = Hasher::toHex(entry.blake3);
+            }
+            refreshedFiles.push_back(std::move(knownFiles[i]));
+        }
     }
+
     setNewFilesCount(FilesCount);
     setNewChangeCount(ChangeCount);
+    stats.set("files.new", FilesCount);
+    stats.set("files.changed", ChangeCount);
+    stats.set("files.refreshed", refreshedFiles.size());
+    stats.set("files.unchanged", scanned.size() - files.size());
     return files;
 }
 
 /**
- * @brief Confirm the backup operation
+ * @brief Confirm the backup operation (skipped with --yes)
  */
 bool BackupManager::confirmBackup()
 {
+    if (assumeYes)
+    {
+        return true;
+    }
+
     std::cout << "\nProceed with backup? (y/n): ";
     char confirm;
     std::string arr = "";
@@ -249,179 +800,319 @@ bool BackupManager::confirmBackup()
 
 /**
  * @brief Perform a backup operation
+ * @details Files are copied concurrently by the copy engine; a file that fails is reported
+ *          at the end and does not abort the rest of the backup.
  */
 void BackupManager::performBackup()
 {
-    uintmax_t totalSize = tool.calculateFileListSize(filesToBackup);
-    uintmax_t copiedSize = 0;
+    uintmax_t totalSize = tool.calculateFileListSize(filesToBackup, !repository);
 
-    std::cout << "Start the backup with a total size of: " << totalSize / 1024 << " KB" << std::endl;
+    CopyEngine engine(jobs, ioUring, delta, Hasher::copyHashes(changeHash.value_or(ChangeHash::Blake3)));
+    ChunkStore store;
+    if (repository && !store.open(backupDir))
+    {
+        return;
+    }
+    std::cout << "Start the backup with a total size of: " << totalSize / 1024 << " KB ("
+              << engine.getJobs() << " jobs)" << std::endl;
     auto startTime = std::chrono::steady_clock::now();
 
-    for (const auto &file : filesToBackup)
+    uintmax_t copiedSize;
     {
-        std::filesystem::path relativePath = std::filesystem::relative(file, sourceDir);
-        std::filesystem::path destFile = backupDir / relativePath;
-
-        std::filesystem::create_directories(destFile.parent_path());
-
-        try
+        auto timer = stats.time(RunPhase::Copy);
+        if (repository)
         {
-            if (std::filesystem::is_regular_file(file))
-            {
-                uintmax_t fileSize = std::filesystem::file_size(file);
-                std::filesystem::copy_file(file, destFile, std::filesystem::copy_options::overwrite_existing);
-                copiedSize += fileSize;
-            }
-            else if (std::filesystem::is_directory(file))
+            copiedSize = engine.storeFiles(filesToBackup, sourceDir, store, totalSize);
+            if (!store.close())
             {
-                for (const auto &entry : std::filesystem::recursive_directory_iterator(file))
+                // Chunks missing from the index cannot be referenced by the metafile
+                for (auto &file : filesToBackup)
                 {
-                    if (entry.is_regular_file())
-                    {
-                        std::filesystem::path relEntryPath = std::filesystem::relative(entry.path(), sourceDir);
-                        std::filesystem::path destEntryPath = backupDir / relEntryPath;
-                        std::filesystem::create_directories(destEntryPath.parent_path());
-                        std::filesystem::copy_file(entry.path(), destEntryPath, std::filesystem::copy_options::overwrite_existing);
-                        copiedSize += entry.file_size();
-                    }
+                    file.copied = false;
                 }
             }
         }
-        catch (const std::filesystem::filesystem_error &e)
+        else
         {
-            std::cerr << "Insufficient permissions to complete the copy: Try using administrator privileges." << "\n";
-            std::cerr << "[Replication failed]: " << e.what() << "\n";
-            std::cerr << "Source path: " << e.path1() << "\n";
-            std::cerr << "Destination path: " << e.path2() << "\n";
+            copiedSize = engine.copyFiles(filesToBackup, sourceDir, targetDir, totalSize);
+        }
+        if (generational)
+        {
+            // After the copies, so no changed file is written through a link to an older generation
+            generationComplete = generations.linkUnchanged(sourcePaths, jobs) && generations.publish();
+            if (!generationComplete)
+            {
+                // The next run compares against "latest", so these files have to be backed up again
+                for (auto &file : filesToBackup)
+                {
+                    file.copied = false;
+                }
+            }
         }
-
-        tool.showCopyProgress(copiedSize, totalSize);
     }
+    stats.set("files.toCopy", filesToBackup.size());
+    stats.set("files.copied", engine.getCopiedCount());
+    stats.set("files.failed", engine.getErrors().size());
+    stats.set("bytes.toCopy", totalSize);
+    stats.set("bytes.copied", copiedSize);
+    stats.addLatency(repository ? "store" : "copy", engine.getLatency());
 
     auto endTime = std::chrono::steady_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
+
+    const auto &errors = engine.getErrors();
+    if (!errors.empty())
+    {
+        std::cerr << "\n";
+        for (const auto &error : errors)
+        {
+            std::cerr << "[Replication failed]: " << error.message << "\n";
+            std::cerr << "Source path: " << error.source << "\n";
+            if (!error.destination.empty())
+            {
+                std::cerr << "Destination path: " << error.destination << "\n";
+            }
+        }
+        std::cerr << errors.size() << " of " << filesToBackup.size()
+                  << " files could not be copied: Try using administrator privileges." << "\n";
+    }
+
     std::cout << std::endl
               << "Backup complete! It takes: " << duration.count() / 1000.0 << " Seconds." << std::endl;
+
+    if (repository)
+    {
+        stats.set("repository.newChunks", store.getNewChunks());
+        stats.set("repository.newBytes", store.getNewBytes());
+        stats.set("repository.reusedChunks", store.getReusedChunks());
+        stats.set("repository.reusedBytes", store.getReusedBytes());
+        std::cout << "Repository: " << store.getNewChunks() << " new chunks (" << store.getNewBytes() / 1024
+                  << " KB written), " << store.getReusedChunks() << " chunks already stored ("
+                  << store.getReusedBytes() / 1024 << " KB deduplicated)" << std::endl;
+        return;
+    }
+
+    if (generational)
+    {
+        stats.set("generations.linkedFiles", generations.getLinkedCount());
+        stats.set("generations.copiedFiles", generations.getCopiedCount());
+        std::cout << "Generation " << generations.getName() << ": " << engine.getCopiedCount() << " files copied, "
+                  << generations.getLinkedCount() << " unchanged files linked";
+        if (!generations.getPreviousName().empty())
+        {
+            std::cout << " from " << generations.getPreviousName();
+        }
+        if (generations.getCopiedCount() != 0)
+        {
+            std::cout << " (" << generations.getCopiedCount() << " copied because they could not be linked)";
+        }
+        std::cout << std::endl;
+        if (!generationComplete)
+        {
+            std::cerr << "The generation " << generations.getName() << " is incomplete, \"" << Generations::LATEST_NAME
+                      << "\" still names the previous one" << std::endl;
+        }
+    }
+
+    if (engine.getDeltaSize() != 0)
+    {
+        stats.set("delta.bytes", engine.getDeltaSize());
+        stats.set("delta.bytesFromSource", engine.getDeltaWritten());
+        std::cout << "Delta: " << engine.getDeltaWritten() / 1024 << " KB of "
+                  << engine.getDeltaSize() / 1024 << " KB taken from the source" << std::endl;
+    }
+
+    // Report which data path actually moved the bytes in this run
+    const auto &strategyCounts = engine.getStrategyCounts();
+    std::cout << "Copy strategy:";
+    for (size_t i = 0; i < strategyCounts.size(); ++i)
+    {
+        if (strategyCounts[i] != 0)
+        {
+            stats.set(std::string("copy.strategy.") + copyStrategyName(static_cast<CopyStrategy>(i)), strategyCounts[i]);
+            std::cout << " " << copyStrategyName(static_cast<CopyStrategy>(i)) << " " << strategyCounts[i];
+        }
+    }
+    std::cout << std::endl;
 }
 
 /**
  * @brief Generate a backup metadata file
+ * @details Built from the records of the copy stage (size, times and the SHA256 calculated while
+ *          copying), so the source directory is neither walked nor read again. Files that failed
+ *          to copy keep their previous entry, so the next incremental backup retries them.
  */
 void BackupManager::generateBackupMetadata()
 {
+    auto timer = stats.time(RunPhase::Metadata);
     json backupData;
     backupData["location"] = json::array();
 
-    // Check if the file exists, and if so, load the existing data
-    std::ifstream inputFile(sourceDir / "backup_timestamp.btd");
-    if (inputFile.good())
+    // Check if the file exists, and if so, load the existing data (in the format it was written in)
+    std::filesystem::path metadataPath = sourceDir / "backup_timestamp.btd";
+    ManifestFormat format = ManifestFormat::Json;
+    if (std::filesystem::exists(metadataPath))
     {
-        try
-        {
-            backupData = json::parse(inputFile);
-        }
-        catch (...)
+        if (!Manifest::load(metadataPath, backupData, &format))
         {
             std::cerr << "The file failed to open or was in an abnormal state!" << std::endl;
+            backupData = json::object();
+            backupData["location"] = json::array();
         }
-        inputFile.close();
     }
 
     // Check if there are already entries for the same directory
-    bool locationExists = false;
-    for (auto &location : backupData["location"])
+    json *location = nullptr;
+    for (auto &existing : backupData["location"])
+    {
+        if (existing["directory"] == sourceDir.string())
+        {
+            location = &existing;
+            break;
+        }
+    }
+
+    if (location == nullptr)
+    {
+        json locationData;
+        locationData["directory"] = sourceDir.string();
+        locationData["listFiles"] = json::object();
+        backupData["location"].push_back(locationData);
+        location = &backupData["location"].back();
+    }
+
+    (*location)["fullReserves"] = isIncremental ? 0 : 1;
+    (*location)["incrementalReserves"] = isIncremental ? 1 : 0;
+    (*location)["lastBakTime"] = Tool::formatTime(scanTimeNs);
+    (*location)["scanTimeNs"] = scanTimeNs;
+    (*location)["changeHash"] = Hasher::changeHashName(changeHash.value_or(ChangeHash::Blake3));
+    if (generationComplete)
     {
-        if (location["directory"] == sourceDir.string())
+        // Oldest first; each generation names the one its unchanged files were linked from
+        json &chain = (*location)["generations"];
+        if (!chain.is_array())
         {
-            // Update an existing entry
-            location["fullReserves"] = isIncremental ? 0 : 1;
-            location["incrementalReserves"] = isIncremental ? 1 : 0;
-            location["lastBakTime"] = tool.getFileModificationTime(std::filesystem::current_path());
+            chain = json::array();
+        }
+        chain.push_back({{"name", generations.getName()},
+                         {"previous", generations.getPreviousName()},
+                         {"scanTimeNs", scanTimeNs},
+                         {"linkedFiles", generations.getLinkedCount() + generations.getCopiedCount()}});
+    }
 
-            // Get a list of existing files
-            json existingFiles = location["listFiles"];
-            int existingCount = location["fileCount"];
+    // The next run may read the journal from here on, unless some file still has to be retried
+    bool complete = std::all_of(filesToBackup.begin(), filesToBackup.end(), [](const FileRecord &file)
+                                { return file.copied; });
+    if (journalSynced && complete)
+    {
+        (*location)["journalId"] = journal.getId();
+        (*location)["journalOffset"] = journal.getSyncOffset();
+    }
+    else
+    {
+        location->erase("journalId");
+        location->erase("journalOffset");
+    }
 
-            // Traverse the directory to find new files
-            for (const auto &entry : std::filesystem::recursive_directory_iterator(sourceDir))
+    json &listFiles = (*location)["listFiles"];
+    auto writeEntry = [&listFiles, this](const FileRecord &file)
+    {
+        json &fileData = listFiles[std::string(file.relativePath)];
+        fileData["fileName"] = std::string(file.relativePath.substr(file.relativePath.rfind('/') + 1));
+        fileData["fileSize(Byte)"] = file.size;
+        fileData["allocatedSize(Byte)"] = file.allocatedSize;
+        fileData["creation"] = file.creationNs;
+        fileData["modified"] = file.mtimeNs;
+        fileData["sha256"] = file.sha256;
+        if (file.blake3.empty())
+        {
+            fileData.erase("blake3");
+        }
+        else
+        {
+            fileData["blake3"] = file.blake3;
+        }
+        fileData["ctimeNs"] = file.ctimeNs;
+        fileData["inode"] = file.inode;
+        fileData["device"] = file.device;
+        fileData.erase("mtimeNs"); // Superseded by the integer "modified"
+        if (file.copied)
+        {
+            // Unchanged files keep the chunk list of the run that stored them
+            if (repository)
             {
-                if (entry.is_regular_file() && entry.path().filename() != "backup_timestamp.btd")
+                json &chunks = fileData["chunks"] = json::array();
+                for (const Sha256Digest &chunk : file.chunks)
                 {
-                    std::string relPath = std::filesystem::relative(entry.path(), sourceDir).string();
-
-                    // Add the file if it doesn't exist in the existing list
-                    if (existingFiles.find(relPath) == existingFiles.end())
-                    {
-                        json fileData;
-
-                        fileData["fileName"] = std::filesystem::relative(entry.path(), sourceDir).filename().string();
-                        fileData["fileSize(Byte)"] = entry.file_size();
-                        fileData["creation"] = tool.getFileCreationTime(entry.path());
-                        fileData["modified"] = tool.getFileModificationTime(entry.path());
-                        fileData["sha256"] = tool.calculate_sha256(entry.path());
-
-                        existingFiles[relPath] = fileData;
-                        existingCount++;
-                    }
-                    else
-                    {
-                        auto &fileData = existingFiles[relPath];
-
-                        auto currentModifiedTime = tool.stringToTimeT(tool.getFileModificationTime(entry.path()));
-                        auto lastModifiedTime = tool.stringToTimeT(backupData["location"][0]["listFiles"][relPath]["modified"]);
-
-                        if (currentModifiedTime != lastModifiedTime)
-                        {
-                            // Update time and SHA-256
-                            fileData["modified"] = tool.getFileModificationTime(entry.path());
-                            ;
-                            fileData["sha256"] = tool.calculate_sha256(entry.path());
-                        }
-                    }
+                    chunks.push_back(Hasher::toHex(chunk));
                 }
             }
+            else
+            {
+                fileData.erase("chunks");
+            }
+        }
+    };
 
-            location["fileCount"] = existingCount;
-            location["listFiles"] = existingFiles;
-            locationExists = true;
-            break;
+    for (const auto &file : filesToBackup)
+    {
+        if (file.copied)
+        {
+            writeEntry(file);
         }
     }
-
-    if (!locationExists)
+    for (const auto &file : refreshedFiles)
     {
-        json locationData;
-        locationData["directory"] = sourceDir.string();
-        locationData["fullReserves"] = isIncremental ? 0 : 1;
-        locationData["incrementalReserves"] = isIncremental ? 1 : 0;
-        locationData["lastBakTime"] = tool.getFileModificationTime(std::filesystem::current_path());
-
-        int fileCount = 0;
-        json listFiles;
-
-        for (const auto &entry : std::filesystem::recursive_directory_iterator(sourceDir))
+        writeEntry(file);
+    }
+    if (generationComplete)
+    {
+        // The metafile describes the new generation, which only holds the files the source still has
+        std::unordered_set<std::string_view> present(sourcePaths.begin(), sourcePaths.end());
+        std::vector<std::string> vanished;
+        for (auto entry = listFiles.begin(); entry != listFiles.end(); ++entry)
         {
-            if (entry.is_regular_file() && entry.path().filename() != "backup_timestamp.btd")
+            if (present.count(entry.key()) == 0)
             {
-                fileCount++;
-                json fileData;
-                fileData["fileName"] = std::filesystem::relative(entry.path(), sourceDir).filename().string();
-                fileData["fileSize(Byte)"] = entry.file_size();
-                fileData["creation"] = tool.getFileCreationTime(entry.path());
-                fileData["modified"] = tool.getFileModificationTime(entry.path());
-                fileData["sha256"] = tool.calculate_sha256(entry.path());
-
-                listFiles[std::filesystem::relative(entry.path(), sourceDir).string()] = fileData;
+                vanished.push_back(entry.key());
             }
         }
+        for (const std::string &path : vanished)
+        {
+            listFiles.erase(path);
+        }
+        stats.set("generations.removedFiles", vanished.size());
+    }
+    (*location)["fileCount"] = listFiles.size();
 
-        locationData["fileCount"] = fileCount;
-        locationData["listFiles"] = listFiles;
-        backupData["location"].push_back(locationData);
+    // Taken before the document is handed over, written once the metafile it describes exists
+    ManifestIndex lookup;
+    lookup.loadLocation(*location);
+    if (!Manifest::save(metadataPath, std::move(backupData), manifestFormat.value_or(format)))
+    {
+        std::cerr << "Failed to write the metafile: " << metadataPath << std::endl;
     }
+    else
+    {
+        if (!lookup.save(metadataPath, sourceDir.string()))
+        {
+            std::cerr << "Failed to write the metafile lookup: " << ManifestIndex::lookupPath(metadataPath) << std::endl;
+        }
 
-    std::ofstream metadataFile(sourceDir / "backup_timestamp.btd");
-    metadataFile << backupData.dump(4);
-    metadataFile.close();
-}
\ No newline at end of file
+        // A copy travels with the backup, so it can be restored without the source directory.
+        // Renamed into place: in a generation the old copy may be a link into the previous one
+        std::filesystem::path backupCopy = targetDir / "backup_timestamp.btd";
+        std::filesystem::path temporary = backupCopy;
+        temporary += ".tmp";
+        std::error_code error;
+        std::filesystem::copy_file(metadataPath, temporary, std::filesystem::copy_options::overwrite_existing, error);
+        if (!error)
+        {
+            std::filesystem::rename(temporary, backupCopy, error);
+        }
+        if (error)
+        {
+            std::cerr << "Failed to copy the metafile into the backup: " << backupCopy << std::endl;
+        }
+    }
+}
@@ -1,10 +1,18 @@
 #ifndef BACKUPMANAGER_H
 #define BACKUPMANAGER_H
 
+#include "ChangeJournal.h"
 #include "FileUtils.h"
+#include "Generations.h"
+#include "Manifest.h"
+#include "ManifestIndex.h"
+#include "PathArena.h"
+#include "RunStats.h"
+#include "WorkerPool.h"
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <optional>
 #include <unordered_map>
 
 class BackupManager
@@ -35,18 +43,44 @@ private:
     std::filesystem::path sourceDir;
     std::filesystem::path backupDir;
     bool isIncremental = false;
-    std::vector<std::filesystem::path> filesToBackup;
+    unsigned jobs = WorkerPool::defaultJobs();  // Number of concurrent copy workers (--jobs)
+    bool paranoid = false;                      // Always hash known files (--paranoid)
+    bool ioUring = false;                       // Batch small-file I/O through io_uring (--io-uring)
+    bool repository = false;                    // Store deduplicated chunks instead of file copies (--repository)
+    bool delta = false;                         // Write only the changed blocks of large files (--delta)
+    bool generational = false;                  // Keep every run as a hard-linked snapshot (--generations)
+    Generations generations;                    // Previous and new generation of a generational run
+    bool generationComplete = false;            // The new generation holds every file and is "latest"
+    std::filesystem::path targetDir;            // Where this run writes: backupDir or the new generation
+    std::filesystem::path previousDir;          // Where the files of the last backup are (empty if nowhere)
+    std::string mode;                           // Backup type given on the command line (--mode), asked for when empty
+    bool assumeYes = false;                     // Skip the confirmation prompts (--yes)
+    std::optional<ManifestFormat> manifestFormat; // Requested metafile encoding (--manifest-format)
+    std::optional<ChangeHash> changeHash;       // Hash that detects content changes (--hash); else the metafile's, else BLAKE3
+    int64_t scanTimeNs = 0;                     // When the source directory walk started
+    PathArena pathArena;                        // Owns the relative paths of all FileRecords
+    std::vector<FileRecord> filesToBackup;
+    std::vector<FileRecord> refreshedFiles;     // Unchanged files whose metafile entry gets fresh stat data
+    std::vector<std::string_view> sourcePaths;  // Every file the source has in this run, in pathArena (generations only)
+    RunStats stats;                             // Per-phase timings and counters (--stats-json)
+    ChangeJournal journal;                      // Journal of a running `backup watch`, if any
+    bool journalSynced = false;                 // journal covers every change made before this run's scan
 
+    int convertManifest();
+    int verifyBackup(const std::string &sample, const std::string &statsFile);
+    int restoreBackup(const std::string &subPath, const std::string &manifestFile, const std::string &statsFile);
     bool validateDirectories();
     bool getBackupTypeFromUser();
     bool prepareBackupFiles();
+    std::vector<FileRecord> scanSourceFiles();
+    std::vector<FileRecord> scanChangedFiles(const ManifestIndex &index);
     /**
      * @brief Get the Files To Backup object
      * 
      * @param metadataFile 
-     * @return std::vector<std::filesystem::path> 
+     * @return std::vector<FileRecord> 
      */
-    std::vector<std::filesystem::path> getFilesToBackup(const std::filesystem::path &metadataFile);
+    std::vector<FileRecord> getFilesToBackup(const std::filesystem::path &metadataFile);
     bool confirmBackup();
     void performBackup();
     void generateBackupMetadata();
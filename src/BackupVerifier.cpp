@@ -0,0 +1,403 @@
+#include "BackupVerifier.h"
+#include "ChunkStore.h"
+#include "DirectoryWalker.h"
+#include "Generations.h"
+#include "Manifest.h"
+#include "ManifestIndex.h"
+#include "WorkerPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <random>
+
+using json = nlohmann::json;
+
+/**
+ * @brief Check a backup directory and print every problem and a summary
+ *
+ * @param metadataFile
+ * @param directory
+ * @param backupDir
+ * @param fraction
+ * @return true
+ * @return false
+ */
+bool BackupVerifier::verify(const std::filesystem::path &metadataFile, const std::string &directory,
+                            const std::filesystem::path &backupDir, double fraction)
+{
+    auto startTime = std::chrono::steady_clock::now();
+    bool repository = ChunkStore::isRepository(backupDir);
+
+    std::vector<Expected> expected;
+    {
+        auto timer = stats.time(RunPhase::Diff);
+        if (!loadExpected(metadataFile, directory, repository, expected))
+        {
+            std::cerr << "Failed to read the metafile: " << metadataFile << std::endl;
+            return false;
+        }
+    }
+
+    // A random sample for spot checks, in path order so the backup directory is read in order
+    std::vector<size_t> chosen(expected.size());
+    std::iota(chosen.begin(), chosen.end(), 0);
+    if (fraction < 1.0 && !expected.empty())
+    {
+        size_t count = std::max<size_t>(1, static_cast<size_t>(std::ceil(fraction * expected.size())));
+        std::vector<size_t> sample;
+        sample.reserve(count);
+        std::sample(chosen.begin(), chosen.end(), std::back_inserter(sample), count, std::mt19937_64(std::random_device{}()));
+        chosen = std::move(sample);
+    }
+
+    std::filesystem::path checkedDir = backupDir;
+    if (repository)
+    {
+        verifyRepository(expected, chosen, backupDir);
+    }
+    else
+    {
+        if (Generations::isGenerational(backupDir))
+        {
+            checkedDir = backupDir / Generations::LATEST_NAME;
+        }
+        verifyFiles(expected, chosen, checkedDir);
+    }
+
+    for (const auto &path : missing)
+    {
+        std::cout << "[Missing]: " << path << "\n";
+    }
+    for (const auto &path : corrupt)
+    {
+        std::cout << "[Corrupt]: " << path << "\n";
+    }
+    for (const auto &path : extra)
+    {
+        std::cout << "[Extra]: " << path << "\n";
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    stats.set("verify.files", expected.size());
+    stats.set("verify.checkedFiles", checkedFiles);
+    stats.set("verify.checkedBytes", checkedBytes);
+    stats.set("verify.missing", missing.size());
+    stats.set("verify.corrupt", corrupt.size());
+    stats.set("verify.extra", extra.size());
+
+    std::cout << "\nChecked " << checkedFiles << " of " << expected.size() << " files (" << checkedBytes / 1024
+              << " KB) in " << (repository ? "the repository " : "") << checkedDir << " in " << seconds << " Seconds";
+    if (seconds > 0)
+    {
+        std::cout << ": " << checkedBytes / seconds / (1024 * 1024) << " MB/s, " << checkedFiles / seconds << " files/s";
+    }
+    std::cout << std::endl
+              << missing.size() << " missing, " << corrupt.size() << " corrupt, " << extra.size() << " extra" << std::endl;
+    return true;
+}
+
+/**
+ * @brief Parse the value of --sample ("5%" or "5")
+ *
+ * @param text
+ * @param fraction
+ * @return true
+ * @return false
+ */
+bool BackupVerifier::parseSample(const std::string &text, double &fraction)
+{
+    std::string number = text;
+    if (!number.empty() && number.back() == '%')
+    {
+        number.pop_back();
+    }
+    try
+    {
+        size_t used = 0;
+        double percent = std::stod(number, &used);
+        if (used != number.size() || !(percent > 0 && percent <= 100))
+        {
+            return false;
+        }
+        fraction = percent / 100;
+        return true;
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+}
+
+/**
+ * @brief Read the files of one location of the metafile, sorted by relative path
+ * @details The chunk lists are only in the json document; without them the entries are read
+ *          through ManifestIndex, which maps the lookup file when it is current.
+ *
+ * @param metadataFile
+ * @param directory
+ * @param withChunks
+ * @param expected
+ * @return true
+ * @return false
+ */
+bool BackupVerifier::loadExpected(const std::filesystem::path &metadataFile, const std::string &directory,
+                                  bool withChunks, std::vector<Expected> &expected) const
+{
+    if (!withChunks)
+    {
+        ManifestIndex index;
+        if (!index.load(metadataFile, directory))
+        {
+            return false;
+        }
+        expected.reserve(index.size());
+        index.forEach([&expected](std::string_view relativePath, const ManifestRecord &record)
+        {
+            Expected file;
+            file.relativePath = relativePath;
+            file.size = record.size;
+            file.hasSize = record.flags & ManifestRecord::HAS_SIZE;
+            file.sha256 = record.sha256;
+            file.hasSha256 = record.flags & ManifestRecord::HAS_SHA256;
+            file.blake3 = record.blake3;
+            file.hasBlake3 = record.flags & ManifestRecord::HAS_BLAKE3;
+            expected.push_back(std::move(file));
+        });
+    }
+    else
+    {
+        json data;
+        if (!Manifest::load(metadataFile, data) || !data.contains("location") || !data["location"].is_array())
+        {
+            return false;
+        }
+        const json *location = nullptr;
+        for (const auto &candidate : data["location"])
+        {
+            if (location == nullptr || candidate.value("directory", "") == directory)
+            {
+                location = &candidate;
+            }
+            if (candidate.value("directory", "") == directory)
+            {
+                break;
+            }
+        }
+        if (location == nullptr || !location->contains("listFiles"))
+        {
+            return true;
+        }
+        for (const auto &[path, entry] : (*location)["listFiles"].items())
+        {
+            Expected file;
+            file.relativePath = path;
+            file.hasSize = entry.contains("fileSize(Byte)") && entry["fileSize(Byte)"].is_number_integer();
+            file.size = file.hasSize ? entry["fileSize(Byte)"].get<uint64_t>() : 0;
+            file.hasSha256 = entry.contains("sha256") && entry["sha256"].is_string() &&
+                             Hasher::fromHex(entry["sha256"].get<std::string>(), file.sha256);
+            if (entry.contains("chunks") && entry["chunks"].is_array())
+            {
+                for (const auto &chunk : entry["chunks"])
+                {
+                    Sha256Digest digest;
+                    if (chunk.is_string() && Hasher::fromHex(chunk.get<std::string>(), digest))
+                    {
+                        file.chunks.push_back(digest);
+                    }
+                }
+            }
+            expected.push_back(std::move(file));
+        }
+    }
+
+    std::sort(expected.begin(), expected.end(), [](const Expected &a, const Expected &b)
+              { return a.relativePath < b.relativePath; });
+    return true;
+}
+
+/**
+ * @brief Compare the copies in a directory with the metafile
+ * @details Sizes are compared first, so a truncated file is reported without being read.
+ *
+ * @param expected Every file of the metafile
+ * @param chosen Files to hash
+ * @param filesDir
+ */
+void BackupVerifier::verifyFiles(const std::vector<Expected> &expected, const std::vector<size_t> &chosen,
+                                 const std::filesystem::path &filesDir)
+{
+    PathArena arena;
+    std::vector<FileRecord> files;
+    {
+        auto timer = stats.time(RunPhase::Scan);
+        // The metafile copy the backup keeps is not a backed up file
+        files = DirectoryWalker(filesDir, {"backup_timestamp.btd"}, jobs).scan(arena);
+    }
+
+    auto timer = std::make_optional<RunStats::Timer>(stats, RunPhase::Diff);
+    auto expectedLess = [](const Expected &file, std::string_view path) { return file.relativePath < path; };
+    for (const FileRecord &file : files)
+    {
+        // Block signatures of --delta are kept next to the copies
+        if (file.relativePath.starts_with(".signatures/"))
+        {
+            continue;
+        }
+        auto it = std::lower_bound(expected.begin(), expected.end(), file.relativePath, expectedLess);
+        if (it == expected.end() || it->relativePath != file.relativePath)
+        {
+            extra.emplace_back(file.relativePath);
+        }
+    }
+
+    bool preferBlake3 = changeHash.value_or(ChangeHash::Blake3) == ChangeHash::Blake3;
+    std::vector<size_t> fastFiles, fullFiles;
+    std::vector<std::filesystem::path> fastPaths, fullPaths;
+    auto fileLess = [](const FileRecord &file, std::string_view path) { return file.relativePath < path; };
+    for (size_t index : chosen)
+    {
+        const Expected &file = expected[index];
+        auto it = std::lower_bound(files.begin(), files.end(), file.relativePath, fileLess);
+        if (it == files.end() || it->relativePath != file.relativePath)
+        {
+            missing.push_back(file.relativePath);
+            continue;
+        }
+        checkedFiles++;
+        checkedBytes += it->size;
+        if (file.hasSize && it->size != file.size)
+        {
+            corrupt.push_back(file.relativePath + " (size " + std::to_string(it->size) + ", expected " +
+                              std::to_string(file.size) + ")");
+        }
+        else if (preferBlake3 && file.hasBlake3)
+        {
+            fastFiles.push_back(index);
+            fastPaths.push_back(filesDir / file.relativePath);
+        }
+        else if (file.hasSha256)
+        {
+            fullFiles.push_back(index);
+            fullPaths.push_back(filesDir / file.relativePath);
+        }
+    }
+    timer.reset();
+
+    std::vector<FileDigest> fastDigests, fullDigests;
+    {
+        auto timer = stats.time(RunPhase::Hash);
+        HashPool hashPool(jobs, useIoUring);
+        fastDigests = hashPool.digestFiles(fastPaths, Hasher::BLAKE3);
+        stats.addLatency("hash", hashPool.getLatency());
+        fullDigests = hashPool.digestFiles(fullPaths, Hasher::SHA256);
+        stats.addLatency("hash", hashPool.getLatency());
+        stats.set("files.hashed", fastPaths.size() + fullPaths.size());
+        stats.set("files.hashedSha256", fullPaths.size());
+    }
+
+    for (size_t i = 0; i < fastFiles.size(); ++i)
+    {
+        const Expected &file = expected[fastFiles[i]];
+        if (fastDigests[i].hashes == 0)
+        {
+            corrupt.push_back(file.relativePath + " (unreadable)");
+        }
+        else if (fastDigests[i].blake3 != file.blake3)
+        {
+            corrupt.push_back(file.relativePath + " (BLAKE3 differs)");
+        }
+    }
+    for (size_t i = 0; i < fullFiles.size(); ++i)
+    {
+        const Expected &file = expected[fullFiles[i]];
+        if (fullDigests[i].hashes == 0)
+        {
+            corrupt.push_back(file.relativePath + " (unreadable)");
+        }
+        else if (fullDigests[i].sha256 != file.sha256)
+        {
+            corrupt.push_back(file.relativePath + " (SHA-256 differs)");
+        }
+    }
+    std::sort(corrupt.begin(), corrupt.end());
+}
+
+/**
+ * @brief Rebuild files from the chunk repository and compare them with the metafile
+ *
+ * @param expected Every file of the metafile
+ * @param chosen Files to rebuild
+ * @param backupDir
+ */
+void BackupVerifier::verifyRepository(const std::vector<Expected> &expected, const std::vector<size_t> &chosen,
+                                      const std::filesystem::path &backupDir)
+{
+    ChunkStore store;
+    if (!store.open(backupDir))
+    {
+        for (size_t index : chosen)
+        {
+            missing.push_back(expected[index].relativePath);
+        }
+        return;
+    }
+
+    // Problem of every chosen file (empty when it matches), collected in order afterwards
+    std::vector<std::string> problems(chosen.size());
+    std::vector<char> absent(chosen.size(), 0);
+    std::vector<uint64_t> workerBytes; // Bytes rebuilt by every worker
+    {
+        auto timer = stats.time(RunPhase::Hash);
+        WorkerPool pool(jobs);
+        workerBytes.assign(pool.size(), 0);
+        pool.forEach(chosen.size(), [&](size_t i, unsigned worker)
+        {
+            const Expected &file = expected[chosen[i]];
+            if (file.chunks.empty() && file.size != 0)
+            {
+                absent[i] = 1;
+                return;
+            }
+            Sha256 hasher;
+            std::vector<unsigned char> data;
+            uint64_t size = 0;
+            for (const Sha256Digest &chunk : file.chunks)
+            {
+                if (!store.read(chunk, data))
+                {
+                    problems[i] = "chunk " + Hasher::toHex(chunk) + " cannot be read";
+                    return;
+                }
+                hasher.update(data.data(), data.size());
+                size += data.size();
+            }
+            workerBytes[worker] += size;
+            if (file.hasSize && size != file.size)
+            {
+                problems[i] = "size " + std::to_string(size) + ", expected " + std::to_string(file.size);
+            }
+            else if (file.hasSha256 && hasher.finish() != file.sha256)
+            {
+                problems[i] = "SHA-256 differs";
+            }
+        });
+    }
+
+    for (size_t i = 0; i < chosen.size(); ++i)
+    {
+        const Expected &file = expected[chosen[i]];
+        if (absent[i])
+        {
+            missing.push_back(file.relativePath);
+            continue;
+        }
+        checkedFiles++;
+        if (!problems[i].empty())
+        {
+            corrupt.push_back(file.relativePath + " (" + problems[i] + ")");
+        }
+    }
+    checkedBytes = std::accumulate(workerBytes.begin(), workerBytes.end(), uint64_t{0});
+}
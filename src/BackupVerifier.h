@@ -0,0 +1,94 @@
+#ifndef BACKUPVERIFIER_H
+#define BACKUPVERIFIER_H
+
+#include "Hasher.h"
+#include "RunStats.h"
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Checks a backup directory against the metafile it was written with (`backup verify`)
+ * @details Every file of the metafile, or a random sample of them, is read back from the backup
+ *          directory in parallel and compared with its recorded size and digest: BLAKE3 when the
+ *          metafile has it (unless SHA-256 is asked for), otherwise SHA-256. Files in the backup
+ *          directory that the metafile does not list are reported as extra. In generations mode
+ *          the "latest" generation is checked; in a chunk repository every checked file is
+ *          rebuilt from its chunks and compared with its SHA-256.
+ */
+class BackupVerifier
+{
+public:
+    /**
+     * @brief Construct a new Backup Verifier object
+     *
+     * @param jobs Number of files read concurrently (0 means hardware concurrency)
+     * @param useIoUring Read small files in batches through io_uring
+     * @param changeHash Digest to compare; by default BLAKE3 where the metafile has it
+     * @param stats Receives the timings and counters of the check
+     */
+    BackupVerifier(unsigned jobs, bool useIoUring, std::optional<ChangeHash> changeHash, RunStats &stats)
+        : jobs(jobs), useIoUring(useIoUring), changeHash(changeHash), stats(stats) {}
+
+    /**
+     * @brief Check a backup directory and print every problem and a summary
+     *
+     * @param metadataFile Metafile of the source directory
+     * @param directory Source directory whose location is checked; the first location is used when none matches
+     * @param backupDir
+     * @param fraction Share of the files to check, in (0, 1]; extra files are always looked for
+     * @return true when the check ran, false when the metafile cannot be read
+     */
+    bool verify(const std::filesystem::path &metadataFile, const std::string &directory,
+                const std::filesystem::path &backupDir, double fraction);
+
+    /**
+     * @brief Parse the value of --sample ("5%" or "5")
+     *
+     * @param text
+     * @param fraction Receives the share of the files, in (0, 1]
+     * @return true
+     * @return false when text is not a percentage in (0, 100]
+     */
+    static bool parseSample(const std::string &text, double &fraction);
+
+    bool isClean() const { return missing.empty() && corrupt.empty() && extra.empty(); } // Whether no problem was found
+
+private:
+    /**
+     * @brief A file to check, taken from the metafile
+     */
+    struct Expected
+    {
+        std::string relativePath;
+        uint64_t size = 0;
+        bool hasSize = false;
+        Sha256Digest sha256{};
+        bool hasSha256 = false;
+        Blake3Digest blake3{};
+        bool hasBlake3 = false;
+        std::vector<Sha256Digest> chunks; // Repository mode only
+    };
+
+    unsigned jobs;
+    bool useIoUring;
+    std::optional<ChangeHash> changeHash;
+    RunStats &stats;
+
+    std::vector<std::string> missing; // Relative paths
+    std::vector<std::string> corrupt; // Relative path and reason
+    std::vector<std::string> extra;   // Relative paths
+    uint64_t checkedFiles = 0;
+    uint64_t checkedBytes = 0;
+
+    bool loadExpected(const std::filesystem::path &metadataFile, const std::string &directory, bool withChunks,
+                      std::vector<Expected> &expected) const;
+    void verifyFiles(const std::vector<Expected> &expected, const std::vector<size_t> &chosen,
+                     const std::filesystem::path &filesDir);
+    void verifyRepository(const std::vector<Expected> &expected, const std::vector<size_t> &chosen,
+                          const std::filesystem::path &backupDir);
+};
+
+#endif // BACKUPVERIFIER_H
@@ -0,0 +1,620 @@
+#include "Blake3.h"
+#include "Hasher.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLAKE3_X86 1
+#endif
+
+namespace
+{
+    constexpr uint32_t IV[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+                                0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+
+    constexpr uint32_t CHUNK_START = 1 << 0;
+    constexpr uint32_t CHUNK_END = 1 << 1;
+    constexpr uint32_t PARENT = 1 << 2;
+    constexpr uint32_t ROOT = 1 << 3;
+
+    constexpr size_t ROUNDS = 7;
+
+    /**
+     * @brief Message word order of every round: each round permutes the previous one
+     */
+    constexpr std::array<std::array<uint8_t, 16>, ROUNDS> makeSchedule()
+    {
+        constexpr uint8_t PERMUTATION[16] = {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8};
+        std::array<std::array<uint8_t, 16>, ROUNDS> schedule{};
+        for (uint8_t i = 0; i < 16; ++i)
+        {
+            schedule[0][i] = i;
+        }
+        for (size_t round = 1; round < ROUNDS; ++round)
+        {
+            for (size_t i = 0; i < 16; ++i)
+            {
+                schedule[round][i] = schedule[round - 1][PERMUTATION[i]];
+            }
+        }
+        return schedule;
+    }
+
+    constexpr std::array<std::array<uint8_t, 16>, ROUNDS> SCHEDULE = makeSchedule();
+
+    inline uint32_t load32(const unsigned char *bytes)
+    {
+        return static_cast<uint32_t>(bytes[0]) | static_cast<uint32_t>(bytes[1]) << 8 |
+               static_cast<uint32_t>(bytes[2]) << 16 | static_cast<uint32_t>(bytes[3]) << 24;
+    }
+
+    inline void store32(unsigned char *bytes, uint32_t value)
+    {
+        for (size_t i = 0; i < 4; ++i)
+        {
+            bytes[i] = static_cast<unsigned char>(value >> (8 * i));
+        }
+    }
+
+    inline uint32_t rotr(uint32_t value, int count)
+    {
+        return (value >> count) | (value << (32 - count));
+    }
+
+    inline void mix(uint32_t *v, size_t a, size_t b, size_t c, size_t d, uint32_t x, uint32_t y)
+    {
+        v[a] = v[a] + v[b] + x;
+        v[d] = rotr(v[d] ^ v[a], 16);
+        v[c] = v[c] + v[d];
+        v[b] = rotr(v[b] ^ v[c], 12);
+        v[a] = v[a] + v[b] + y;
+        v[d] = rotr(v[d] ^ v[a], 8);
+        v[c] = v[c] + v[d];
+        v[b] = rotr(v[b] ^ v[c], 7);
+    }
+
+    /**
+     * @brief One round; the schedule index is a template argument so every message word index is a constant
+     */
+    template <size_t R>
+    inline void round(uint32_t *v, const uint32_t *m)
+    {
+        constexpr const std::array<uint8_t, 16> &s = SCHEDULE[R];
+        mix(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+        mix(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+        mix(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+        mix(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+        mix(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+        mix(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+        mix(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+        mix(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+    }
+
+    /**
+     * @brief The compression function; state receives the 16 output words (the first 8 are the chaining value)
+     */
+    void compress(const uint32_t cv[8], const unsigned char block[Blake3::BLOCK_SIZE], uint32_t blockLength,
+                  uint64_t counter, uint32_t flags, uint32_t state[16])
+    {
+        uint32_t m[16];
+        for (size_t i = 0; i < 16; ++i)
+        {
+            m[i] = load32(block + 4 * i);
+        }
+        uint32_t v[16] = {cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+                          IV[0], IV[1], IV[2], IV[3],
+                          static_cast<uint32_t>(counter), static_cast<uint32_t>(counter >> 32), blockLength, flags};
+        round<0>(v, m);
+        round<1>(v, m);
+        round<2>(v, m);
+        round<3>(v, m);
+        round<4>(v, m);
+        round<5>(v, m);
+        round<6>(v, m);
+        for (size_t i = 0; i < 8; ++i)
+        {
+            state[i] = v[i] ^ v[i + 8];
+            state[i + 8] = v[i + 8] ^ cv[i];
+        }
+    }
+
+    void compressInPlace(uint32_t cv[8], const unsigned char block[Blake3::BLOCK_SIZE], uint32_t blockLength,
+                         uint64_t counter, uint32_t flags)
+    {
+        uint32_t state[16];
+        compress(cv, block, blockLength, counter, flags, state);
+        std::copy_n(state, 8, cv);
+    }
+
+    /**
+     * @brief Compress Blake3::LANES independent inputs of blocks blocks each, stride bytes apart, one after the other
+     * @details Input i uses counter + i * counterStep; its first block gets flagsStart and its last
+     *          flagsEnd on top of flags. out receives the eight chaining values as bytes (little
+     *          endian), so the chaining values of sibling nodes are directly the next level's input.
+     */
+    void hashManyPortable(const unsigned char *input, size_t stride, size_t blocks, uint64_t counter, uint64_t counterStep,
+                          uint32_t flags, uint32_t flagsStart, uint32_t flagsEnd, unsigned char *out)
+    {
+        for (size_t lane = 0; lane < Blake3::LANES; ++lane)
+        {
+            uint32_t cv[8];
+            std::copy_n(IV, 8, cv);
+            for (size_t block = 0; block < blocks; ++block)
+            {
+                uint32_t blockFlags = flags | (block == 0 ? flagsStart : 0) | (block == blocks - 1 ? flagsEnd : 0);
+                compressInPlace(cv, input + lane * stride + block * Blake3::BLOCK_SIZE, Blake3::BLOCK_SIZE,
+                                counter + lane * counterStep, blockFlags);
+            }
+            for (size_t i = 0; i < 8; ++i)
+            {
+                store32(out + lane * 32 + 4 * i, cv[i]);
+            }
+        }
+    }
+
+#if defined(BLAKE3_X86)
+    __attribute__((target("avx2"), always_inline)) inline __m256i rotr12(__m256i x)
+    {
+        return _mm256_or_si256(_mm256_srli_epi32(x, 12), _mm256_slli_epi32(x, 20));
+    }
+
+    __attribute__((target("avx2"), always_inline)) inline __m256i rotr7(__m256i x)
+    {
+        return _mm256_or_si256(_mm256_srli_epi32(x, 7), _mm256_slli_epi32(x, 25));
+    }
+
+    /**
+     * @brief mix() on eight states at once; the 16- and 8-bit rotations are byte shuffles
+     */
+    __attribute__((target("avx2"), always_inline)) inline void mix8(__m256i *v, size_t a, size_t b, size_t c, size_t d, __m256i x, __m256i y)
+    {
+        const __m256i rotate16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                                  2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+        const __m256i rotate8 = _mm256_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12,
+                                                 1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+        v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), x);
+        v[d] = _mm256_shuffle_epi8(_mm256_xor_si256(v[d], v[a]), rotate16);
+        v[c] = _mm256_add_epi32(v[c], v[d]);
+        v[b] = rotr12(_mm256_xor_si256(v[b], v[c]));
+        v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), y);
+        v[d] = _mm256_shuffle_epi8(_mm256_xor_si256(v[d], v[a]), rotate8);
+        v[c] = _mm256_add_epi32(v[c], v[d]);
+        v[b] = rotr7(_mm256_xor_si256(v[b], v[c]));
+    }
+
+    template <size_t R>
+    __attribute__((target("avx2"), always_inline)) inline void round8(__m256i *v, const __m256i *m)
+    {
+        constexpr const std::array<uint8_t, 16> &s = SCHEDULE[R];
+        mix8(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+        mix8(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+        mix8(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+        mix8(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+        mix8(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+        mix8(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+        mix8(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+        mix8(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+    }
+
+    /**
+     * @brief Transpose an 8x8 matrix of 32-bit words held in eight registers
+     */
+    __attribute__((target("avx2"), always_inline)) inline void transpose8(__m256i *rows)
+    {
+        __m256i ab0145 = _mm256_unpacklo_epi32(rows[0], rows[1]);
+        __m256i ab2367 = _mm256_unpackhi_epi32(rows[0], rows[1]);
+        __m256i cd0145 = _mm256_unpacklo_epi32(rows[2], rows[3]);
+        __m256i cd2367 = _mm256_unpackhi_epi32(rows[2], rows[3]);
+        __m256i ef0145 = _mm256_unpacklo_epi32(rows[4], rows[5]);
+        __m256i ef2367 = _mm256_unpackhi_epi32(rows[4], rows[5]);
+        __m256i gh0145 = _mm256_unpacklo_epi32(rows[6], rows[7]);
+        __m256i gh2367 = _mm256_unpackhi_epi32(rows[6], rows[7]);
+
+        __m256i abcd04 = _mm256_unpacklo_epi64(ab0145, cd0145);
+        __m256i abcd15 = _mm256_unpackhi_epi64(ab0145, cd0145);
+        __m256i abcd26 = _mm256_unpacklo_epi64(ab2367, cd2367);
+        __m256i abcd37 = _mm256_unpackhi_epi64(ab2367, cd2367);
+        __m256i efgh04 = _mm256_unpacklo_epi64(ef0145, gh0145);
+        __m256i efgh15 = _mm256_unpackhi_epi64(ef0145, gh0145);
+        __m256i efgh26 = _mm256_unpacklo_epi64(ef2367, gh2367);
+        __m256i efgh37 = _mm256_unpackhi_epi64(ef2367, gh2367);
+
+        rows[0] = _mm256_permute2x128_si256(abcd04, efgh04, 0x20);
+        rows[1] = _mm256_permute2x128_si256(abcd15, efgh15, 0x20);
+        rows[2] = _mm256_permute2x128_si256(abcd26, efgh26, 0x20);
+        rows[3] = _mm256_permute2x128_si256(abcd37, efgh37, 0x20);
+        rows[4] = _mm256_permute2x128_si256(abcd04, efgh04, 0x31);
+        rows[5] = _mm256_permute2x128_si256(abcd15, efgh15, 0x31);
+        rows[6] = _mm256_permute2x128_si256(abcd26, efgh26, 0x31);
+        rows[7] = _mm256_permute2x128_si256(abcd37, efgh37, 0x31);
+    }
+
+    /**
+     * @brief hashManyPortable with the eight inputs in the 32-bit lanes of the AVX2 registers
+     * @details Word i of every state lives in v[i], so the eight inputs go through the rounds
+     *          together; each block of the eight inputs is loaded and transposed so that m[i] holds
+     *          message word i of every input. Assumes a little-endian CPU, as x86 is.
+     */
+    __attribute__((target("avx2"))) void hashManyAvx2(const unsigned char *input, size_t stride, size_t blocks, uint64_t counter,
+                                                    uint64_t counterStep, uint32_t flags, uint32_t flagsStart, uint32_t flagsEnd,
+                                                    unsigned char *out)
+    {
+        __m256i cv[8];
+        for (size_t i = 0; i < 8; ++i)
+        {
+            cv[i] = _mm256_set1_epi32(static_cast<int>(IV[i]));
+        }
+        alignas(32) uint32_t counterLow[Blake3::LANES];
+        alignas(32) uint32_t counterHigh[Blake3::LANES];
+        for (size_t lane = 0; lane < Blake3::LANES; ++lane)
+        {
+            counterLow[lane] = static_cast<uint32_t>(counter + lane * counterStep);
+            counterHigh[lane] = static_cast<uint32_t>((counter + lane * counterStep) >> 32);
+        }
+        const __m256i low = _mm256_load_si256(reinterpret_cast<const __m256i *>(counterLow));
+        const __m256i high = _mm256_load_si256(reinterpret_cast<const __m256i *>(counterHigh));
+
+        for (size_t block = 0; block < blocks; ++block)
+        {
+            __m256i m[16];
+            for (size_t lane = 0; lane < Blake3::LANES; ++lane)
+            {
+                const unsigned char *data = input + lane * stride + block * Blake3::BLOCK_SIZE;
+                m[lane] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+                m[lane + 8] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + 32));
+            }
+            transpose8(m);
+            transpose8(m + 8);
+            uint32_t blockFlags = flags | (block == 0 ? flagsStart : 0) | (block == blocks - 1 ? flagsEnd : 0);
+            __m256i v[16] = {cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+                             _mm256_set1_epi32(static_cast<int>(IV[0])), _mm256_set1_epi32(static_cast<int>(IV[1])),
+                             _mm256_set1_epi32(static_cast<int>(IV[2])), _mm256_set1_epi32(static_cast<int>(IV[3])),
+                             low, high, _mm256_set1_epi32(static_cast<int>(Blake3::BLOCK_SIZE)),
+                             _mm256_set1_epi32(static_cast<int>(blockFlags))};
+            round8<0>(v, m);
+            round8<1>(v, m);
+            round8<2>(v, m);
+            round8<3>(v, m);
+            round8<4>(v, m);
+            round8<5>(v, m);
+            round8<6>(v, m);
+            for (size_t i = 0; i < 8; ++i)
+            {
+                cv[i] = _mm256_xor_si256(v[i], v[i + 8]);
+            }
+        }
+
+        // Transposed back, register i holds the chaining value of input i
+        transpose8(cv);
+        for (size_t lane = 0; lane < Blake3::LANES; ++lane)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + lane * 32), cv[lane]);
+        }
+    }
+#endif
+
+    using HashMany = void (*)(const unsigned char *, size_t, size_t, uint64_t, uint64_t, uint32_t, uint32_t, uint32_t, unsigned char *);
+
+    struct Kernel
+    {
+        HashMany hashMany;
+        const char *name;
+        bool (*supported)();
+    };
+
+    bool alwaysSupported()
+    {
+        return true;
+    }
+
+#if defined(BLAKE3_X86)
+    bool avx2Supported()
+    {
+        __builtin_cpu_init(); // May run before the library's own initialisation
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+
+    // Every compiled compression routine, preferred first; the last one runs anywhere
+    const Kernel KERNELS[] = {
+#if defined(BLAKE3_X86)
+        {hashManyAvx2, "avx2", avx2Supported},
+#endif
+        {hashManyPortable, "portable", alwaysSupported}};
+
+    size_t selectKernel()
+    {
+        size_t index = 0;
+        while (!KERNELS[index].supported())
+        {
+            ++index;
+        }
+        return index;
+    }
+
+    const size_t selectedKernel = selectKernel();
+
+    /**
+     * @brief BLAKE3 of the first size bytes of the pattern i % 251 (the input of the official
+     *        test vectors), across the block and chunk boundaries and through both subtree sizes
+     */
+    struct KnownAnswer
+    {
+        size_t size;
+        const char *digest;
+    };
+
+    constexpr KnownAnswer KNOWN_ANSWERS[] = {
+        {0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262"},
+        {55, "d04ec5f6f5e7daf5ced7a1671fbe912580a56576c8bf6a2ed4b80e35548f9c13"},
+        {56, "60f238116f2936698a88cda03d8df79d7431249373b048ee7a063849fe6e9742"},
+        {64, "4eed7141ea4a5cd4b788606bd23f46e212af9cacebacdc7d1f4c6dc7f2511b98"},
+        {1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7"},
+        {1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444"},
+        {2048, "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a"},
+        {8193, "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b"},
+        {131073, "f837d4254d24ba3d50fe3743d46e4af6db5f5d6ab0469197d94e7ba1e906c4d8"}};
+}
+
+Blake3::Blake3() : kernel(selectedKernel)
+{
+    reset();
+}
+
+/**
+ * @brief Get the name of the compression routine in use
+ *
+ * @return const char*
+ */
+const char *Blake3::implementation()
+{
+    return KERNELS[selectedKernel].name;
+}
+
+/**
+ * @brief Check every compiled compression routine against known digests
+ *
+ * @param report
+ * @return true
+ * @return false
+ */
+bool Blake3::selfTest(std::vector<std::string> &report)
+{
+    std::vector<unsigned char> pattern(KNOWN_ANSWERS[std::size(KNOWN_ANSWERS) - 1].size);
+    for (size_t i = 0; i < pattern.size(); ++i)
+    {
+        pattern[i] = static_cast<unsigned char>(i % 251);
+    }
+
+    bool passed = true;
+    for (size_t index = 0; index < std::size(KERNELS); ++index)
+    {
+        std::string line = std::string("blake3 ") + KERNELS[index].name + ":";
+        if (!KERNELS[index].supported())
+        {
+            report.push_back(line + " not supported by this CPU, skipped");
+            continue;
+        }
+        Blake3 hasher;
+        hasher.kernel = index;
+        std::string failed;
+        for (const KnownAnswer &answer : KNOWN_ANSWERS)
+        {
+            hasher.update(pattern.data(), answer.size);
+            Blake3Digest digest = hasher.finish();
+            if (Hasher::toHex(digest.data(), digest.size()) != answer.digest)
+            {
+                failed += " " + std::to_string(answer.size);
+            }
+        }
+        report.push_back(line + (failed.empty() ? " ok" : " FAILED at sizes" + failed));
+        passed = passed && failed.empty();
+    }
+    return passed;
+}
+
+/**
+ * @brief Discard any bytes fed so far
+ *
+ */
+void Blake3::reset()
+{
+    cvStackSize = 0;
+    startChunk(0);
+}
+
+void Blake3::startChunk(uint64_t counter)
+{
+    std::copy_n(IV, 8, chunkCv.begin());
+    chunkCounter = counter;
+    blockLength = 0;
+    blocksCompressed = 0;
+}
+
+/**
+ * @brief Add bytes to the current chunk; the last block is kept until more input shows it is not the chunk's end
+ */
+void Blake3::updateChunk(const unsigned char *data, size_t size)
+{
+    while (size > 0)
+    {
+        if (blockLength == BLOCK_SIZE)
+        {
+            compressInPlace(chunkCv.data(), block.data(), BLOCK_SIZE, chunkCounter,
+                            blocksCompressed == 0 ? CHUNK_START : 0);
+            blocksCompressed++;
+            blockLength = 0;
+        }
+        size_t take = std::min(BLOCK_SIZE - blockLength, size);
+        std::memcpy(block.data() + blockLength, data, take);
+        blockLength += take;
+        data += take;
+        size -= take;
+    }
+}
+
+/**
+ * @brief Add the chaining value of a completed subtree, merging every larger subtree it completes
+ * @details The stack holds one chaining value per set bit of the number of completed chunks, so
+ *          a new subtree merges with one stack entry per trailing zero bit of the new total
+ *          (counted in subtrees of its own size, which works because subtrees are aligned).
+ *
+ * @param cv
+ * @param totalSubtrees Subtrees of the size of cv completed so far, including this one
+ */
+void Blake3::pushSubtree(const ChainingValue &cv, uint64_t totalSubtrees)
+{
+    ChainingValue merged = cv;
+    while ((totalSubtrees & 1) == 0)
+    {
+        unsigned char parentBlock[BLOCK_SIZE];
+        for (size_t i = 0; i < 8; ++i)
+        {
+            store32(parentBlock + 4 * i, cvStack[cvStackSize - 1][i]);
+            store32(parentBlock + 32 + 4 * i, merged[i]);
+        }
+        cvStackSize--;
+        std::copy_n(IV, 8, merged.begin());
+        compressInPlace(merged.data(), parentBlock, BLOCK_SIZE, 0, PARENT);
+        totalSubtrees >>= 1;
+    }
+    cvStack[cvStackSize++] = merged;
+}
+
+/**
+ * @brief Chaining value of a complete subtree of whole chunks (a power of two, at least LANES)
+ * @details The chunks and then each level of parents are compressed LANES at a time; only the
+ *          last few levels, with fewer than LANES nodes, go one node at a time.
+ */
+Blake3::ChainingValue Blake3::hashSubtree(const unsigned char *input, size_t chunks, uint64_t counter) const
+{
+    const HashMany hashMany = KERNELS[kernel].hashMany;
+    unsigned char cvs[SUBTREE_CHUNKS * 32];
+    for (size_t chunk = 0; chunk < chunks; chunk += LANES)
+    {
+        hashMany(input + chunk * CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE / BLOCK_SIZE, counter + chunk, 1,
+                 0, CHUNK_START, CHUNK_END, cvs + chunk * 32);
+    }
+    // Sibling chaining values are adjacent, so each pair is the 64-byte block of their parent;
+    // parents are written over the front of the same buffer, behind the pairs still to be read
+    for (size_t nodes = chunks; nodes > 1; nodes /= 2)
+    {
+        size_t parents = nodes / 2;
+        size_t parent = 0;
+        for (; parent + LANES <= parents; parent += LANES)
+        {
+            hashMany(cvs + parent * BLOCK_SIZE, BLOCK_SIZE, 1, 0, 0, PARENT, 0, 0, cvs + parent * 32);
+        }
+        for (; parent < parents; ++parent)
+        {
+            uint32_t cv[8];
+            std::copy_n(IV, 8, cv);
+            compressInPlace(cv, cvs + parent * BLOCK_SIZE, BLOCK_SIZE, 0, PARENT);
+            for (size_t i = 0; i < 8; ++i)
+            {
+                store32(cvs + parent * 32 + 4 * i, cv[i]);
+            }
+        }
+    }
+    ChainingValue cv;
+    for (size_t i = 0; i < 8; ++i)
+    {
+        cv[i] = load32(cvs + 4 * i);
+    }
+    return cv;
+}
+
+/**
+ * @brief Feed more bytes into the digest
+ * @details A full chunk is only closed once more input arrives, because the last chunk of the
+ *          message is finished differently (it may be the root). Whole aligned subtrees of
+ *          SUBTREE_CHUNKS or LANES chunks that are followed by more input go through hashSubtree().
+ *
+ * @param data
+ * @param size
+ */
+void Blake3::update(const void *data, size_t size)
+{
+    const unsigned char *input = static_cast<const unsigned char *>(data);
+    while (size > 0)
+    {
+        if (chunkLength() == CHUNK_SIZE)
+        {
+            ChainingValue cv = chunkCv;
+            compressInPlace(cv.data(), block.data(), static_cast<uint32_t>(blockLength), chunkCounter,
+                            (blocksCompressed == 0 ? CHUNK_START : 0) | CHUNK_END);
+            pushSubtree(cv, chunkCounter + 1);
+            startChunk(chunkCounter + 1);
+        }
+
+        if (chunkLength() == 0)
+        {
+            size_t chunks = 0;
+            for (size_t candidate : {SUBTREE_CHUNKS, LANES})
+            {
+                if (chunks == 0 && chunkCounter % candidate == 0 && size > candidate * CHUNK_SIZE)
+                {
+                    chunks = candidate;
+                }
+            }
+            if (chunks != 0)
+            {
+                pushSubtree(hashSubtree(input, chunks, chunkCounter), (chunkCounter + chunks) / chunks);
+                startChunk(chunkCounter + chunks);
+                input += chunks * CHUNK_SIZE;
+                size -= chunks * CHUNK_SIZE;
+                continue;
+            }
+        }
+
+        size_t take = std::min(CHUNK_SIZE - chunkLength(), size);
+        updateChunk(input, take);
+        input += take;
+        size -= take;
+    }
+}
+
+/**
+ * @brief Finish the digest and reset the state for the next message
+ * @details The last chunk (or, above one chunk, the topmost parent) is compressed with the ROOT flag.
+ *
+ * @return Blake3Digest
+ */
+Blake3Digest Blake3::finish()
+{
+    // Output node: the input of the last compression, which gets the ROOT flag
+    ChainingValue cv = chunkCv;
+    std::array<unsigned char, BLOCK_SIZE> outputBlock{};
+    std::copy_n(block.begin(), blockLength, outputBlock.begin());
+    uint32_t outputLength = static_cast<uint32_t>(blockLength);
+    uint64_t outputCounter = chunkCounter;
+    uint32_t outputFlags = (blocksCompressed == 0 ? CHUNK_START : 0) | CHUNK_END;
+
+    for (size_t i = cvStackSize; i > 0; --i)
+    {
+        // Close the node so far and make it the right child of the next stacked subtree
+        uint32_t state[16];
+        compress(cv.data(), outputBlock.data(), outputLength, outputCounter, outputFlags, state);
+        for (size_t word = 0; word < 8; ++word)
+        {
+            store32(outputBlock.data() + 4 * word, cvStack[i - 1][word]);
+            store32(outputBlock.data() + 32 + 4 * word, state[word]);
+        }
+        std::copy_n(IV, 8, cv.begin());
+        outputLength = BLOCK_SIZE;
+        outputCounter = 0;
+        outputFlags = PARENT;
+    }
+
+    uint32_t state[16];
+    compress(cv.data(), outputBlock.data(), outputLength, outputCounter, outputFlags | ROOT, state);
+    Blake3Digest digest;
+    for (size_t word = 0; word < 8; ++word)
+    {
+        store32(digest.data() + 4 * word, state[word]);
+    }
+    reset();
+    return digest;
+}
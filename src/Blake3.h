@@ -0,0 +1,88 @@
+#ifndef BLAKE3_H
+#define BLAKE3_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using Blake3Digest = std::array<unsigned char, 32>;
+
+/**
+ * @brief Incremental BLAKE3 (unkeyed, 32-byte output)
+ * @details Used to detect content changes: several times faster than SHA-256 because the 1 KiB
+ *          chunks of a file are independent and are compressed eight at a time with AVX2 when the
+ *          CPU has it (checked at run time), with fewer rounds per byte even without it.
+ */
+class Blake3
+{
+public:
+    static constexpr size_t BLOCK_SIZE = 64;
+    static constexpr size_t CHUNK_SIZE = 1024;
+    static constexpr size_t LANES = 8;           // Chunks (or parent nodes) compressed together
+    static constexpr size_t SUBTREE_CHUNKS = 64; // Largest subtree hashed in one piece
+
+    Blake3();
+
+    /**
+     * @brief Feed more bytes into the digest
+     *
+     * @param data
+     * @param size
+     */
+    void update(const void *data, size_t size);
+
+    /**
+     * @brief Finish the digest and reset the state for the next message
+     *
+     * @return Blake3Digest
+     */
+    Blake3Digest finish();
+
+    /**
+     * @brief Discard any bytes fed so far
+     *
+     */
+    void reset();
+
+    /**
+     * @brief Get the name of the compression routine in use
+     *
+     * @return const char* "avx2" or "portable"
+     */
+    static const char *implementation();
+
+    /**
+     * @brief Check every compiled compression routine the CPU supports against known digests,
+     *        across the block and chunk boundaries and through the batched subtrees
+     *
+     * @param report Receives one line per routine
+     * @return true if no routine gave a wrong digest
+     */
+    static bool selfTest(std::vector<std::string> &report);
+
+private:
+    using ChainingValue = std::array<uint32_t, 8>;
+
+    // Current chunk
+    ChainingValue chunkCv;
+    uint64_t chunkCounter;
+    std::array<unsigned char, BLOCK_SIZE> block;
+    size_t blockLength;
+    size_t blocksCompressed;
+
+    // Chaining values of completed subtrees, one per set bit of the number of completed chunks
+    std::array<ChainingValue, 54> cvStack;
+    size_t cvStackSize;
+
+    size_t kernel; // Compression routine used by hashSubtree(), the one chosen for this CPU outside selfTest()
+
+    size_t chunkLength() const { return blocksCompressed * BLOCK_SIZE + blockLength; }
+    void startChunk(uint64_t counter);
+    void updateChunk(const unsigned char *data, size_t size);
+    void pushSubtree(const ChainingValue &cv, uint64_t totalSubtrees);
+    ChainingValue hashSubtree(const unsigned char *input, size_t chunks, uint64_t counter) const;
+};
+
+#endif // BLAKE3_H
@@ -0,0 +1,191 @@
+#include "ChangeJournal.h"
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+/**
+ * @brief Open the journal of a source directory
+ *
+ * @param sourceDir
+ * @return true
+ * @return false
+ */
+bool ChangeJournal::open(const std::filesystem::path &sourceDir)
+{
+    directory = sourceDir;
+    fd.reset(::open((sourceDir / FILE_NAME).c_str(), O_RDONLY | O_CLOEXEC));
+    if (!fd.valid())
+    {
+        return false;
+    }
+
+    // A journal whose lock nobody holds was left behind by a watcher that is no longer running
+    if (::flock(fd.get(), LOCK_SH | LOCK_NB) == 0 || errno != EWOULDBLOCK)
+    {
+        fd.reset();
+        return false;
+    }
+    return readHeader(id);
+}
+
+/**
+ * @brief Wait until the watcher has written every event that happened before this call
+ *
+ * @param timeoutMs
+ * @return true
+ * @return false
+ */
+bool ChangeJournal::sync(int timeoutMs)
+{
+    struct stat status;
+    if (!fd.valid() || ::fstat(fd.get(), &status) != 0)
+    {
+        return false;
+    }
+    uint64_t start = static_cast<uint64_t>(status.st_size);
+
+    std::string token = std::to_string(::getpid()) + "-" +
+                        std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+    std::filesystem::path cookie = directory / COOKIE_NAME;
+    {
+        FileDescriptor cookieFd(::open(cookie.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600));
+        if (!cookieFd.valid() || ::write(cookieFd.get(), token.data(), token.size()) != static_cast<ssize_t>(token.size()))
+        {
+            if (cookieFd.valid())
+            {
+                ::unlink(cookie.c_str());
+            }
+            return false;
+        }
+    }
+
+    // The watcher answers the cookie with "S<token>"; the preceding NUL anchors it to a record start
+    std::string record = std::string(1, '\0') + "S" + token + std::string(1, '\0');
+    uint64_t from = start > 0 ? start - 1 : 0;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    bool synced = false;
+    std::string data;
+    while (!synced && std::chrono::steady_clock::now() < deadline)
+    {
+        if (::fstat(fd.get(), &status) == 0 && readRange(from, static_cast<uint64_t>(status.st_size), data))
+        {
+            size_t found = data.find(record);
+            if (found != std::string::npos)
+            {
+                syncOffset = from + found + record.size();
+                synced = true;
+                break;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ::unlink(cookie.c_str());
+
+    // The journal may have been restarted while we waited; the offset belongs to the current one
+    return synced && readHeader(id);
+}
+
+/**
+ * @brief Read the changes recorded between an earlier sync and the last sync()
+ *
+ * @param since
+ * @param files
+ * @param directories
+ * @param deleted
+ * @return true
+ * @return false
+ */
+bool ChangeJournal::readChanges(uint64_t since, std::vector<std::string> &files, std::vector<std::string> &directories,
+                                std::vector<std::string> &deleted) const
+{
+    std::string data;
+    int64_t currentId = 0;
+    if (since == 0 || since > syncOffset || !readRange(since, syncOffset, data) ||
+        !readHeader(currentId) || currentId != id)
+    {
+        return false;
+    }
+
+    size_t position = 0;
+    while (position < data.size())
+    {
+        size_t end = data.find('\0', position + 1);
+        if (end == std::string::npos)
+        {
+            return false;
+        }
+        std::string value = data.substr(position + 1, end - position - 1);
+        switch (data[position])
+        {
+        case 'M':
+            files.push_back(std::move(value));
+            break;
+        case 'R':
+            directories.push_back(std::move(value));
+            break;
+        case 'D':
+            deleted.push_back(std::move(value));
+            break;
+        case 'S':
+            break;
+        default: // 'O' (events were lost) or a record this version does not know
+            return false;
+        }
+        position = end + 1;
+    }
+    return true;
+}
+
+/**
+ * @brief Read the id from the header record
+ *
+ * @param headerId
+ * @return true
+ * @return false
+ */
+bool ChangeJournal::readHeader(int64_t &headerId) const
+{
+    char header[32];
+    ssize_t size = ::pread(fd.get(), header, sizeof(header), 0);
+    if (size < 2 || header[0] != 'H')
+    {
+        return false;
+    }
+    const char *end = static_cast<const char *>(std::memchr(header, '\0', static_cast<size_t>(size)));
+    return end != nullptr && std::from_chars(header + 1, end, headerId).ec == std::errc();
+}
+
+/**
+ * @brief Read the bytes [begin, end) of the journal
+ *
+ * @param begin
+ * @param end
+ * @param data
+ * @return true
+ * @return false
+ */
+bool ChangeJournal::readRange(uint64_t begin, uint64_t end, std::string &data) const
+{
+    data.resize(end > begin ? end - begin : 0);
+    size_t done = 0;
+    while (done < data.size())
+    {
+        ssize_t result = ::pread(fd.get(), data.data() + done, data.size() - done, static_cast<off_t>(begin + done));
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result <= 0)
+        {
+            return false;
+        }
+        done += static_cast<size_t>(result);
+    }
+    return true;
+}
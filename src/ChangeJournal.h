@@ -0,0 +1,76 @@
+#ifndef CHANGEJOURNAL_H
+#define CHANGEJOURNAL_H
+
+#include "FileDescriptor.h"
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Change journal of a source directory, written by `backup watch` (see JournalWatcher)
+ * @details The journal is <source>/backup_journal.btj, a sequence of records of one type byte
+ *          followed by a NUL-terminated relative path or value:
+ *          H<id>     header, the first record; id changes whenever the journal is restarted
+ *          M<path>   a file was created, modified, had its attributes changed or was moved in
+ *          D<path>   a file or directory was deleted or moved out
+ *          R<path>   a directory was created or moved in; its whole subtree has to be scanned
+ *          S<token>  a sync cookie was seen (every earlier event has been written)
+ *          O         events were lost (the kernel queue overflowed)
+ *          The watcher holds an exclusive lock on the journal for as long as it runs, so a journal
+ *          nobody holds the lock on is stale.
+ */
+class ChangeJournal
+{
+public:
+    static constexpr const char *FILE_NAME = "backup_journal.btj";      // Journal, in the root of the source directory
+    static constexpr const char *COOKIE_NAME = "backup_journal.cookie"; // Sync cookie, in the root of the source directory
+
+    /**
+     * @brief Open the journal of a source directory
+     *
+     * @param sourceDir
+     * @return true if a watcher is running and the journal can be read, false otherwise
+     */
+    bool open(const std::filesystem::path &sourceDir);
+
+    /**
+     * @brief Wait until the watcher has written every event that happened before this call
+     * @details A cookie file is created in the watched directory and the journal is polled until
+     *          the watcher has recorded it; inotify reports the events of one directory tree in
+     *          order, so everything before the cookie is in the journal by then.
+     *
+     * @param timeoutMs
+     * @return true on success, false if the watcher did not answer in time
+     */
+    bool sync(int timeoutMs = 5000);
+
+    /**
+     * @brief Read the changes recorded between an earlier sync and the last sync()
+     *
+     * @param since Sync offset of the earlier run (getSyncOffset() then)
+     * @param files Receives the relative paths of files that may have changed
+     * @param directories Receives the relative paths of directories whose subtree has to be scanned
+     * @param deleted Receives the relative paths of deleted or moved away files and directories
+     *                (they may have been created again since)
+     * @return true on success, false when the range is not covered (events were lost, or the
+     *         journal was restarted in between)
+     */
+    bool readChanges(uint64_t since, std::vector<std::string> &files, std::vector<std::string> &directories,
+                     std::vector<std::string> &deleted) const;
+
+    int64_t getId() const { return id; }                   // Get the id of the open journal
+    uint64_t getSyncOffset() const { return syncOffset; }  // Get the journal offset right after the last sync record
+
+private:
+    std::filesystem::path directory;
+    FileDescriptor fd;
+    int64_t id = 0;
+    uint64_t syncOffset = 0;
+
+    bool readHeader(int64_t &headerId) const;
+    bool readRange(uint64_t begin, uint64_t end, std::string &data) const;
+};
+
+#endif // CHANGEJOURNAL_H
@@ -0,0 +1,392 @@
+#include "ChunkStore.h"
+#include "FileDescriptor.h"
+#include "Trace.h"
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    constexpr char INDEX_MAGIC[8] = {'B', 'K', 'C', 'H', 'N', 'K', '0', '1'};
+
+    /**
+     * @brief On-disk index record (host byte order)
+     */
+    struct IndexRecord
+    {
+        unsigned char digest[32];
+        uint32_t pack;
+        uint32_t size;
+        uint64_t offset;
+    };
+    static_assert(sizeof(IndexRecord) == 48);
+
+    /**
+     * @brief Write a whole buffer at an offset
+     */
+    bool writeAll(int fd, const unsigned char *data, size_t size, uint64_t offset)
+    {
+        while (size > 0)
+        {
+            ssize_t written = ::pwrite(fd, data, size, static_cast<off_t>(offset));
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+            offset += static_cast<uint64_t>(written);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Flush a directory, so the entries of the files created in it survive a crash
+     */
+    bool syncDirectory(const std::filesystem::path &path)
+    {
+        FileDescriptor fd(::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+        return fd.valid() && ::fsync(fd.get()) == 0;
+    }
+}
+
+ChunkStore::~ChunkStore()
+{
+    for (int fd : packFds)
+    {
+        ::close(fd);
+    }
+    for (const auto &[pack, fd] : readFds)
+    {
+        ::close(fd);
+    }
+}
+
+/**
+ * @brief Whether a backup directory holds a chunk repository
+ *
+ * @param backupDir
+ * @return true
+ * @return false
+ */
+bool ChunkStore::isRepository(const std::filesystem::path &backupDir)
+{
+    std::error_code error;
+    return std::filesystem::is_regular_file(backupDir / "chunks" / "index", error);
+}
+
+/**
+ * @brief Open (and create if needed) the repository of a backup directory
+ * @details New chunks always go to pack files numbered after every existing one, so the packs
+ *          of earlier runs are never modified. A partial record at the end of the index (a run
+ *          that crashed while appending) is truncated away, since the next close() appends
+ *          behind it.
+ *
+ * @param backupDir
+ * @return true
+ * @return false
+ */
+bool ChunkStore::open(const std::filesystem::path &backupDir)
+{
+    directory = backupDir / "chunks";
+    std::error_code error;
+    directoryCreated = std::filesystem::create_directories(directory, error);
+    if (error)
+    {
+        std::cerr << "Cannot create the chunk repository " << directory << ": " << error.message() << "\n";
+        return false;
+    }
+
+    chunks.clear();
+    added.clear();
+    uint32_t lastPack = 0;
+
+    std::filesystem::path indexPath = directory / "index";
+    std::ifstream index(indexPath, std::ios::binary);
+    if (index)
+    {
+        char magic[sizeof(INDEX_MAGIC)] = {};
+        index.read(magic, sizeof(magic));
+        size_t magicSize = static_cast<size_t>(index.gcount());
+        if (!std::equal(magic, magic + magicSize, std::begin(INDEX_MAGIC)))
+        {
+            std::cerr << "Not a chunk index: " << indexPath << "\n";
+            return false;
+        }
+        uint64_t validSize = 0; // A magic torn by a crash leaves an index without any record
+        if (magicSize == sizeof(magic))
+        {
+            validSize = sizeof(magic);
+            IndexRecord record;
+            while (index.read(reinterpret_cast<char *>(&record), sizeof(record)))
+            {
+                Sha256Digest digest;
+                std::copy(std::begin(record.digest), std::end(record.digest), digest.begin());
+                chunks[digest] = {record.pack, record.size, record.offset};
+                lastPack = std::max(lastPack, record.pack);
+                validSize += sizeof(record);
+            }
+        }
+        index.close();
+
+        if (std::filesystem::file_size(indexPath, error) > validSize && !error)
+        {
+            std::cerr << "Cutting a partial record off the chunk index " << indexPath << "\n";
+            std::filesystem::resize_file(indexPath, validSize, error);
+        }
+        if (error)
+        {
+            std::cerr << "Cannot repair the chunk index " << indexPath << ": " << error.message() << "\n";
+            return false;
+        }
+    }
+
+    // Packs left behind by an interrupted run are not in the index but must not be reused either
+    for (const auto &entry : std::filesystem::directory_iterator(directory, error))
+    {
+        std::string name = entry.path().filename().string();
+        uint32_t pack = 0;
+        if (name.rfind("pack-", 0) == 0 &&
+            std::from_chars(name.data() + 5, name.data() + name.size(), pack).ec == std::errc())
+        {
+            lastPack = std::max(lastPack, pack);
+        }
+    }
+    firstPack = lastPack + 1;
+    return true;
+}
+
+/**
+ * @brief Store a chunk unless a chunk with the same digest is already stored
+ * @details Writing under the lock keeps each pack strictly sequential and guarantees that a
+ *          chunk another file deduplicates against is already on disk; the expensive part
+ *          (chunking and hashing) happens in the callers, outside the lock.
+ *
+ * @param digest
+ * @param data
+ * @param size
+ * @return true
+ * @return false
+ */
+bool ChunkStore::put(const Sha256Digest &digest, const unsigned char *data, size_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (chunks.count(digest))
+    {
+        reusedChunks.fetch_add(1, std::memory_order_relaxed);
+        reusedBytes.fetch_add(size, std::memory_order_relaxed);
+        return true;
+    }
+
+    if (packFds.empty() || (packSize > 0 && packSize + size > PACK_SIZE_LIMIT))
+    {
+        if (!startPack())
+        {
+            return false;
+        }
+    }
+    if (!writeAll(packFds.back(), data, size, packSize))
+    {
+        return false;
+    }
+
+    uint32_t pack = firstPack + static_cast<uint32_t>(packFds.size() - 1);
+    chunks[digest] = {pack, static_cast<uint32_t>(size), packSize};
+    added.push_back(digest);
+    packSize += size;
+    newChunks.fetch_add(1, std::memory_order_relaxed);
+    newBytes.fetch_add(size, std::memory_order_relaxed);
+    return true;
+}
+
+/**
+ * @brief Look up a chunk
+ *
+ * @param digest
+ * @return const ChunkLocation*
+ */
+const ChunkLocation *ChunkStore::find(const Sha256Digest &digest) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = chunks.find(digest);
+    return it == chunks.end() ? nullptr : &it->second;
+}
+
+/**
+ * @brief Read a chunk back
+ *
+ * @param digest
+ * @param data
+ * @return true
+ * @return false
+ */
+bool ChunkStore::read(const Sha256Digest &digest, std::vector<unsigned char> &data) const
+{
+    ChunkLocation location;
+    int fd;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = chunks.find(digest);
+        if (it == chunks.end())
+        {
+            errno = ENOENT;
+            return false;
+        }
+        location = it->second;
+
+        auto cached = readFds.find(location.pack);
+        if (cached == readFds.end())
+        {
+            int opened = ::open(packPath(location.pack).c_str(), O_RDONLY | O_CLOEXEC);
+            if (opened < 0)
+            {
+                return false;
+            }
+            cached = readFds.emplace(location.pack, opened).first;
+        }
+        fd = cached->second;
+    }
+
+    data.resize(location.size);
+    size_t done = 0;
+    while (done < location.size)
+    {
+        ssize_t result = ::pread(fd, data.data() + done, location.size - done, static_cast<off_t>(location.offset + done));
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result <= 0)
+        {
+            if (result == 0)
+            {
+                errno = EIO; // The pack is shorter than the index says
+            }
+            return false;
+        }
+        done += static_cast<size_t>(result);
+    }
+    return true;
+}
+
+/**
+ * @brief Flush the packs written in this run and append the new chunks to the index
+ * @details The index is only appended once every pack it points into has been written, so an
+ *          interrupted run leaves at most unreferenced pack files behind. The index, and the
+ *          directory entries of new files, are on disk before this returns, since the metafile
+ *          that references the new chunks is written right after.
+ *
+ * @return true
+ * @return false
+ */
+bool ChunkStore::close()
+{
+    TraceSpan span("repository", "repository close");
+    std::lock_guard<std::mutex> lock(mutex);
+    bool ok = true;
+    bool wrotePacks = !packFds.empty();
+    for (int fd : packFds)
+    {
+        ok = ::fsync(fd) == 0 && ok;
+        ok = ::close(fd) == 0 && ok;
+    }
+    packFds.clear();
+    if (!ok)
+    {
+        std::cerr << "Cannot write the chunk packs in " << directory << "\n";
+        return false;
+    }
+    if (added.empty() && isRepository(directory.parent_path()))
+    {
+        return true;
+    }
+
+    std::filesystem::path indexPath = directory / "index";
+    FileDescriptor index(::open(indexPath.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644));
+    struct stat status;
+    if (!index.valid() || ::fstat(index.get(), &status) != 0)
+    {
+        std::cerr << "Cannot open the chunk index " << indexPath << "\n";
+        return false;
+    }
+
+    // Appended at the end that open() left on a record boundary
+    bool isNew = status.st_size == 0;
+    std::vector<unsigned char> buffer;
+    buffer.reserve(sizeof(INDEX_MAGIC) + added.size() * sizeof(IndexRecord));
+    if (isNew)
+    {
+        buffer.insert(buffer.end(), std::begin(INDEX_MAGIC), std::end(INDEX_MAGIC));
+    }
+    for (const Sha256Digest &digest : added)
+    {
+        const ChunkLocation &location = chunks[digest];
+        IndexRecord record;
+        std::copy(digest.begin(), digest.end(), std::begin(record.digest));
+        record.pack = location.pack;
+        record.size = location.size;
+        record.offset = location.offset;
+        const unsigned char *bytes = reinterpret_cast<const unsigned char *>(&record);
+        buffer.insert(buffer.end(), bytes, bytes + sizeof(record));
+    }
+    added.clear();
+
+    ok = writeAll(index.get(), buffer.data(), buffer.size(), static_cast<uint64_t>(status.st_size)) &&
+         ::fsync(index.get()) == 0;
+    ok = ::close(index.release()) == 0 && ok;
+    if (ok && (wrotePacks || isNew))
+    {
+        ok = syncDirectory(directory);
+    }
+    if (ok && directoryCreated)
+    {
+        ok = syncDirectory(directory.parent_path());
+    }
+    if (!ok)
+    {
+        std::cerr << "Cannot write the chunk index " << indexPath << "\n";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Get the path of a pack file
+ *
+ * @param pack
+ * @return std::filesystem::path
+ */
+std::filesystem::path ChunkStore::packPath(uint32_t pack) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "pack-%06u", pack);
+    return directory / name;
+}
+
+/**
+ * @brief Create the next pack file of this run
+ *
+ * @return true
+ * @return false
+ */
+bool ChunkStore::startPack()
+{
+    uint32_t pack = firstPack + static_cast<uint32_t>(packFds.size());
+    int fd = ::open(packPath(pack).c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+    packFds.push_back(fd);
+    packSize = 0;
+    return true;
+}
@@ -0,0 +1,132 @@
+#ifndef CHUNKSTORE_H
+#define CHUNKSTORE_H
+
+#include "Hasher.h"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Where a chunk is stored
+ */
+struct ChunkLocation
+{
+    uint32_t pack = 0;   // Pack file number
+    uint32_t size = 0;   // Chunk length in bytes
+    uint64_t offset = 0; // Offset of the chunk in the pack file
+};
+
+/**
+ * @brief Content-addressed chunk repository: chunks stored once, by SHA-256, in append-only packs
+ * @details Layout under the backup directory:
+ *          chunks/index        magic + one fixed-size record per chunk (digest, pack, size, offset)
+ *          chunks/pack-NNNNNN  chunk data back to back
+ *          A run only ever appends: new chunks go to new pack files and the records of the new
+ *          chunks are appended to the index when the run is closed. A record torn by a crash is
+ *          cut off when the repository is opened again, so later records stay aligned.
+ */
+class ChunkStore
+{
+public:
+    static constexpr uint64_t PACK_SIZE_LIMIT = 1ULL << 30; // A new pack is started past this size
+
+    ChunkStore() = default;
+    ~ChunkStore();
+    ChunkStore(const ChunkStore &) = delete;
+    ChunkStore &operator=(const ChunkStore &) = delete;
+
+    /**
+     * @brief Whether a backup directory holds a chunk repository
+     *
+     * @param backupDir
+     * @return true
+     * @return false
+     */
+    static bool isRepository(const std::filesystem::path &backupDir);
+
+    /**
+     * @brief Open (and create if needed) the repository of a backup directory
+     *
+     * @param backupDir
+     * @return true on success, false when the index cannot be read or the directory created
+     */
+    bool open(const std::filesystem::path &backupDir);
+
+    /**
+     * @brief Store a chunk unless a chunk with the same digest is already stored
+     *
+     * @param digest SHA-256 of data
+     * @param data
+     * @param size
+     * @return true on success, false on a write error (errno is set)
+     * @note Thread safe
+     */
+    bool put(const Sha256Digest &digest, const unsigned char *data, size_t size);
+
+    /**
+     * @brief Look up a chunk
+     *
+     * @param digest
+     * @return const ChunkLocation* nullptr when the chunk is not stored
+     */
+    const ChunkLocation *find(const Sha256Digest &digest) const;
+
+    /**
+     * @brief Read a chunk back
+     *
+     * @param digest
+     * @param data Resized to the chunk size
+     * @return true on success, false when the chunk is missing or cannot be read
+     */
+    bool read(const Sha256Digest &digest, std::vector<unsigned char> &data) const;
+
+    /**
+     * @brief Flush the packs written in this run and append the new chunks to the index
+     *
+     * @return true
+     * @return false
+     */
+    bool close();
+
+    size_t getNewChunks() const { return newChunks; }       // Get the number of chunks written in this run
+    uint64_t getNewBytes() const { return newBytes; }       // Get the number of bytes written in this run
+    size_t getReusedChunks() const { return reusedChunks; } // Get the number of chunks that were already stored
+    uint64_t getReusedBytes() const { return reusedBytes; } // Get the number of bytes that did not need to be written
+    size_t size() const { return chunks.size(); }           // Get the number of stored chunks
+
+private:
+    struct DigestHash
+    {
+        size_t operator()(const Sha256Digest &digest) const
+        {
+            size_t value;
+            std::memcpy(&value, digest.data(), sizeof(value)); // The digest is already uniformly distributed
+            return value;
+        }
+    };
+
+    std::filesystem::path directory;
+    bool directoryCreated = false;    // chunks/ was created by open()
+    std::unordered_map<Sha256Digest, ChunkLocation, DigestHash> chunks;
+    std::vector<Sha256Digest> added;  // Chunks written in this run, in index order
+
+    mutable std::mutex mutex;
+    std::vector<int> packFds;         // Pack files written in this run, indexed by pack - firstPack
+    mutable std::unordered_map<uint32_t, int> readFds; // Pack files opened by read()
+    uint32_t firstPack = 0;
+    uint64_t packSize = 0;            // Bytes reserved in the current pack
+
+    std::atomic<size_t> newChunks{0};
+    std::atomic<uint64_t> newBytes{0};
+    std::atomic<size_t> reusedChunks{0};
+    std::atomic<uint64_t> reusedBytes{0};
+
+    std::filesystem::path packPath(uint32_t pack) const;
+    bool startPack();
+};
+
+#endif // CHUNKSTORE_H
@@ -0,0 +1,78 @@
+#include "Chunker.h"
+#include <algorithm>
+#include <array>
+
+namespace
+{
+    /**
+     * @brief Random 64-bit value per byte value, generated with splitmix64 so the table is fixed
+     *        across builds (chunk boundaries must never change between versions)
+     */
+    constexpr std::array<uint64_t, 256> makeGearTable()
+    {
+        std::array<uint64_t, 256> table{};
+        uint64_t state = 0x6a09e667f3bcc908ULL;
+        for (auto &value : table)
+        {
+            state += 0x9e3779b97f4a7c15ULL;
+            uint64_t z = state;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            value = z ^ (z >> 31);
+        }
+        return table;
+    }
+
+    constexpr std::array<uint64_t, 256> GEAR = makeGearTable();
+
+    /**
+     * @brief Mask of the top bits of the gear hash, which depend on the last 64 bytes
+     */
+    constexpr uint64_t topBits(unsigned count)
+    {
+        return ~uint64_t(0) << (64 - count);
+    }
+
+    // log2(AVERAGE_SIZE) = 16; normalized chunking level 2 makes a cut harder before the
+    // average size and easier after it, which narrows the size distribution
+    constexpr uint64_t MASK_SMALL = topBits(16 + 2);
+    constexpr uint64_t MASK_LARGE = topBits(16 - 2);
+    static_assert(Chunker::AVERAGE_SIZE == 1 << 16);
+}
+
+/**
+ * @brief Find the end of the first chunk of data
+ *
+ * @param data
+ * @param size
+ * @return size_t
+ */
+size_t Chunker::findBoundary(const unsigned char *data, size_t size)
+{
+    if (size <= MIN_SIZE)
+    {
+        return size;
+    }
+
+    size_t limit = std::min(size, MAX_SIZE);
+    size_t normal = std::min(limit, AVERAGE_SIZE);
+    uint64_t hash = 0;
+    size_t i = MIN_SIZE;
+    for (; i < normal; ++i)
+    {
+        hash = (hash << 1) + GEAR[data[i]];
+        if ((hash & MASK_SMALL) == 0)
+        {
+            return i + 1;
+        }
+    }
+    for (; i < limit; ++i)
+    {
+        hash = (hash << 1) + GEAR[data[i]];
+        if ((hash & MASK_LARGE) == 0)
+        {
+            return i + 1;
+        }
+    }
+    return limit;
+}
@@ -0,0 +1,30 @@
+#ifndef CHUNKER_H
+#define CHUNKER_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Content-defined chunking with the FastCDC gear hash and normalized chunking
+ * @details Boundaries depend only on the bytes around them, so inserting or removing data in a
+ *          file only changes the chunks next to the edit; every other chunk keeps its digest and
+ *          is deduplicated against the previous backup.
+ */
+class Chunker
+{
+public:
+    static constexpr size_t MIN_SIZE = 16 * 1024;     // No boundary is looked for before this
+    static constexpr size_t AVERAGE_SIZE = 64 * 1024; // Expected chunk size
+    static constexpr size_t MAX_SIZE = 256 * 1024;    // A chunk is cut here when no boundary was found
+
+    /**
+     * @brief Find the end of the first chunk of data
+     *
+     * @param data
+     * @param size Bytes available; at least MAX_SIZE unless data reaches the end of the file
+     * @return size_t Length of the first chunk (size itself when size <= MIN_SIZE)
+     */
+    static size_t findBoundary(const unsigned char *data, size_t size);
+};
+
+#endif // CHUNKER_H
@@ -0,0 +1,362 @@
+#include "CopyBackend.h"
+#include "FileDescriptor.h"
+#include "SparseFile.h"
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <system_error>
+
+#if defined(__linux__)
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#endif
+
+namespace
+{
+    constexpr size_t KERNEL_COPY_CHUNK = 1 << 30; // Bytes requested per copy_file_range/sendfile call
+
+    /**
+     * @brief Throw a filesystem_error built from errno
+     */
+    [[noreturn]] void throwCopyError(const char *what, const std::filesystem::path &source,
+                                     const std::filesystem::path &destination)
+    {
+        throw std::filesystem::filesystem_error(what, source, destination,
+                                                std::error_code(errno, std::generic_category()));
+    }
+
+    /**
+     * @brief Whether errno means "this data path is not available here" rather than an I/O failure
+     */
+    bool isUnsupported(int error)
+    {
+        return error == ENOSYS || error == EXDEV || error == EINVAL || error == EOPNOTSUPP ||
+               error == ENOTTY || error == EBADF || error == EPERM;
+    }
+}
+
+/**
+ * @brief Get the display name of a copy strategy
+ *
+ * @param strategy
+ * @return const char*
+ */
+const char *copyStrategyName(CopyStrategy strategy)
+{
+    switch (strategy)
+    {
+    case CopyStrategy::Reflink:
+        return "reflink";
+    case CopyStrategy::CopyFileRange:
+        return "copy_file_range";
+    case CopyStrategy::Sendfile:
+        return "sendfile";
+    case CopyStrategy::ReadWrite:
+        return "read/write";
+    case CopyStrategy::IoUring:
+        return "io_uring";
+    case CopyStrategy::Delta:
+        return "delta";
+    case CopyStrategy::Sparse:
+        return "sparse";
+    default:
+        return "unknown";
+    }
+}
+
+/**
+ * @brief Copy a regular file, trying the cheapest strategy first
+ * @details Order: reflink -> copy_file_range -> sendfile -> buffered read/write. A kernel path
+ *          that stops part way through hands the remaining range to the next strategy. A sparse
+ *          file that is not reflinked is copied extent by extent instead.
+ *
+ * @param source
+ * @param destination
+ * @param copiedSize
+ * @param digest
+ * @param hashes
+ * @return CopyStrategy
+ */
+CopyStrategy CopyBackend::copyFile(const std::filesystem::path &source,
+                                   const std::filesystem::path &destination,
+                                   uintmax_t *copiedSize,
+                                   FileDigest *digest,
+                                   unsigned hashes)
+{
+    FileDescriptor in(::open(source.c_str(), O_RDONLY | O_CLOEXEC));
+    if (!in.valid())
+    {
+        throwCopyError("cannot open source file", source, destination);
+    }
+
+    struct stat sourceStat;
+    if (::fstat(in.get(), &sourceStat) != 0)
+    {
+        throwCopyError("cannot stat source file", source, destination);
+    }
+
+    FileDescriptor out(::open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                              sourceStat.st_mode & 07777));
+    if (!out.valid())
+    {
+        throwCopyError("cannot open destination file", source, destination);
+    }
+    // O_CREAT does not change the mode of an existing file
+    ::fchmod(out.get(), sourceStat.st_mode & 07777);
+
+    uintmax_t size = static_cast<uintmax_t>(sourceStat.st_size);
+    uintmax_t offset = 0;
+    CopyStrategy used = CopyStrategy::ReadWrite;
+    uintmax_t dataSize = 0;
+    thread_local ContentHasher hasher;
+
+    try
+    {
+#if defined(__linux__)
+        if (reflinkSupported && size > 0)
+        {
+            if (::ioctl(out.get(), FICLONE, in.get()) == 0)
+            {
+                offset = size;
+                used = CopyStrategy::Reflink;
+            }
+            else if (isUnsupported(errno))
+            {
+                reflinkSupported = false;
+            }
+        }
+#endif
+        if (used != CopyStrategy::Reflink &&
+            SparseFile::isSparse(size, static_cast<uintmax_t>(sourceStat.st_blocks) * SparseFile::STAT_BLOCK_SIZE))
+        {
+            hasher.reset(hashes);
+            dataSize = copyExtents(in.get(), out.get(), size, digest != nullptr ? &hasher : nullptr);
+            offset = size;
+            used = CopyStrategy::Sparse;
+            if (digest != nullptr)
+            {
+                *digest = hasher.finish();
+            }
+        }
+        else if (digest != nullptr)
+        {
+            if (used == CopyStrategy::Reflink)
+            {
+                if (!Hasher::hashDescriptor(in.get(), *digest, hashes))
+                {
+                    throw std::system_error(errno, std::generic_category(), "read");
+                }
+            }
+            else
+            {
+                hasher.reset(hashes);
+                copyWithBuffer(in.get(), out.get(), offset, &hasher);
+                *digest = hasher.finish();
+            }
+        }
+        else
+        {
+            for (CopyStrategy strategy : {CopyStrategy::CopyFileRange, CopyStrategy::Sendfile})
+            {
+                if (offset < size && copyWithKernel(strategy, in.get(), out.get(), size, offset))
+                {
+                    used = strategy;
+                }
+            }
+            if (offset < size || size == 0)
+            {
+                // Also covers files whose st_size is not authoritative (e.g. procfs style files)
+                uintmax_t before = offset;
+                copyWithBuffer(in.get(), out.get(), offset, nullptr);
+                if (offset != before || size == 0)
+                {
+                    used = CopyStrategy::ReadWrite;
+                }
+            }
+        }
+    }
+    catch (const std::system_error &e)
+    {
+        errno = e.code().value();
+        throwCopyError(e.what(), source, destination);
+    }
+
+    if (::close(out.release()) != 0)
+    {
+        throwCopyError("cannot close destination file", source, destination);
+    }
+    if (copiedSize != nullptr)
+    {
+        *copiedSize = used == CopyStrategy::Sparse ? dataSize : offset;
+    }
+    return used;
+}
+
+/**
+ * @brief Copy [offset, size) with an in-kernel data path
+ *
+ * @param strategy CopyFileRange or Sendfile
+ * @param in
+ * @param out
+ * @param size
+ * @param offset Advanced by the number of bytes copied
+ * @return true when the strategy copied everything up to size
+ */
+bool CopyBackend::copyWithKernel(CopyStrategy strategy, int in, int out, uintmax_t size, uintmax_t &offset)
+{
+#if defined(__linux__)
+    bool &supported = strategy == CopyStrategy::CopyFileRange ? copyFileRangeSupported : sendfileSupported;
+    if (!supported)
+    {
+        return false;
+    }
+
+    while (offset < size)
+    {
+        size_t request = static_cast<size_t>(std::min<uintmax_t>(size - offset, KERNEL_COPY_CHUNK));
+        off_t inOffset = static_cast<off_t>(offset);
+        ssize_t copied;
+        if (strategy == CopyStrategy::CopyFileRange)
+        {
+            off_t outOffset = inOffset;
+            copied = ::copy_file_range(in, &inOffset, out, &outOffset, request, 0);
+        }
+        else
+        {
+            if (::lseek(out, inOffset, SEEK_SET) < 0)
+            {
+                return false;
+            }
+            copied = ::sendfile(out, in, &inOffset, request);
+        }
+
+        if (copied < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (isUnsupported(errno))
+            {
+                supported = false;
+                return false;
+            }
+            throw std::system_error(errno, std::generic_category(), copyStrategyName(strategy));
+        }
+        if (copied == 0)
+        {
+            // The file shrank while copying; let the buffered path confirm the end of file
+            return false;
+        }
+        offset += static_cast<uintmax_t>(copied);
+    }
+    return true;
+#else
+    (void)strategy;
+    (void)in;
+    (void)out;
+    (void)size;
+    (void)offset;
+    return false;
+#endif
+}
+
+/**
+ * @brief Copy from offset to end, or to the end of file, through a user-space buffer
+ *
+ * @param in
+ * @param out
+ * @param offset Advanced by the number of bytes copied
+ * @param hasher Receives every byte read from in (may be nullptr)
+ * @param end Offset to stop at
+ */
+void CopyBackend::copyWithBuffer(int in, int out, uintmax_t &offset, ContentHasher *hasher, uintmax_t end)
+{
+    unsigned char *buffer = Hasher::threadBuffer();
+    while (offset < end)
+    {
+        size_t request = static_cast<size_t>(std::min<uintmax_t>(end - offset, Hasher::BUFFER_SIZE));
+        ssize_t readBytes = ::pread(in, buffer, request, static_cast<off_t>(offset));
+        if (readBytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "read");
+        }
+        if (readBytes == 0)
+        {
+            return;
+        }
+        if (hasher != nullptr)
+        {
+            hasher->update(buffer, static_cast<size_t>(readBytes));
+        }
+
+        for (ssize_t written = 0; written < readBytes;)
+        {
+            ssize_t result = ::pwrite(out, buffer + written, static_cast<size_t>(readBytes - written),
+                                      static_cast<off_t>(offset) + written);
+            if (result < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::system_error(errno, std::generic_category(), "write");
+            }
+            written += result;
+        }
+        offset += static_cast<uintmax_t>(readBytes);
+    }
+}
+
+/**
+ * @brief Copy the data extents of a sparse file and leave its holes unwritten
+ * @details The destination is freshly truncated, so every range that is not written stays a hole
+ *          once the file is extended to its full size. The hasher sees the holes as zero runs.
+ *
+ * @param in
+ * @param out
+ * @param size Logical size of the file
+ * @param hasher Receives the content of the whole file (may be nullptr)
+ * @return uintmax_t Number of data bytes copied
+ */
+uintmax_t CopyBackend::copyExtents(int in, int out, uintmax_t size, ContentHasher *hasher)
+{
+    uintmax_t dataSize = 0;
+    uintmax_t position = 0;
+    SparseFile::Extent extent;
+    while (SparseFile::nextData(in, position, size, extent))
+    {
+        if (hasher != nullptr)
+        {
+            hasher->updateZeros(extent.offset - position);
+        }
+        uintmax_t offset = extent.offset;
+        uintmax_t end = extent.offset + extent.length;
+        if (hasher != nullptr || !copyWithKernel(CopyStrategy::CopyFileRange, in, out, end, offset))
+        {
+            copyWithBuffer(in, out, offset, hasher, end);
+        }
+        if (offset < end && hasher != nullptr)
+        {
+            // The file shrank while copying; the destination reads back zeros there
+            hasher->updateZeros(end - offset);
+        }
+        dataSize += offset - extent.offset;
+        position = end;
+    }
+    if (hasher != nullptr && position < size)
+    {
+        hasher->updateZeros(size - position);
+    }
+    if (::ftruncate(out, static_cast<off_t>(size)) != 0)
+    {
+        throw std::system_error(errno, std::generic_category(), "truncate");
+    }
+    return dataSize;
+}
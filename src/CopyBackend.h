@@ -0,0 +1,68 @@
+#ifndef COPYBACKEND_H
+#define COPYBACKEND_H
+
+#include "Hasher.h"
+#include <cstdint>
+#include <filesystem>
+
+/**
+ * @brief Data path used to copy a file, from cheapest to most expensive
+ */
+enum class CopyStrategy
+{
+    Reflink,       // ioctl(FICLONE): shares extents, no data is moved (btrfs, XFS)
+    CopyFileRange, // copy_file_range: in-kernel copy, may be offloaded by the filesystem
+    Sendfile,      // sendfile: in-kernel copy through the page cache
+    ReadWrite,     // Buffered read/write in user space
+    IoUring,       // Batched asynchronous open/read/write/close through io_uring (small files, --io-uring)
+    Delta,         // Only the blocks changed since the previous backup are written (large files, --delta)
+    Sparse,        // Only the data extents are copied, holes stay holes (SEEK_DATA/SEEK_HOLE)
+    Count
+};
+
+/**
+ * @brief Get the display name of a copy strategy
+ *
+ * @param strategy
+ * @return const char*
+ */
+const char *copyStrategyName(CopyStrategy strategy);
+
+class CopyBackend
+{
+public:
+    /**
+     * @brief Copy a regular file, trying the cheapest strategy first
+     *
+     * @param source
+     * @param destination Created or truncated; receives the permission bits of source
+     * @param copiedSize Receives the number of bytes copied (may be nullptr)
+     * @param digest Receives the digests of the copied bytes (may be nullptr)
+     * @param hashes Digests to compute when digest is given: Hasher::SHA256 and/or Hasher::BLAKE3
+     * @return CopyStrategy The strategy that completed the copy
+     *
+     * @throws std::filesystem::filesystem_error when the file cannot be copied
+     * @note A strategy that reports itself unsupported is skipped for the rest of the run
+     * @note When a digest is requested the source is still read only once: either the data is
+     *       shared by a reflink and then hashed, or it is hashed while it streams through the
+     *       read/write path. copy_file_range and sendfile are skipped in that case.
+     * @note A sparse source that cannot be reflinked has only its data extents copied, so
+     *       copiedSize counts the data bytes rather than the logical size.
+     */
+    CopyStrategy copyFile(const std::filesystem::path &source,
+                          const std::filesystem::path &destination,
+                          uintmax_t *copiedSize = nullptr,
+                          FileDigest *digest = nullptr,
+                          unsigned hashes = Hasher::SHA256);
+
+private:
+    bool reflinkSupported = true;
+    bool copyFileRangeSupported = true;
+    bool sendfileSupported = true;
+
+    bool copyWithKernel(CopyStrategy strategy, int in, int out, uintmax_t size, uintmax_t &offset);
+    void copyWithBuffer(int in, int out, uintmax_t &offset, ContentHasher *hasher, uintmax_t end = UINTMAX_MAX);
+    uintmax_t copyExtents(int in, int out, uintmax_t size, ContentHasher *hasher);
+};
+
+#endif // COPYBACKEND_H
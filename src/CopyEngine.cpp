@@ -0,0 +1,369 @@
+#include "CopyEngine.h"
+#include "Chunker.h"
+#include "FileDescriptor.h"
+#include "FileUtils.h"
+#include "SparseFile.h"
+#include "Trace.h"
+#include "UringEngine.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+    /**
+     * @brief Counters owned by one worker, padded so workers never share a cache line
+     */
+    struct alignas(64) WorkerCounters
+    {
+        std::atomic<uintmax_t> copiedSize{0};
+        size_t copiedCount = 0;
+        std::array<size_t, static_cast<size_t>(CopyStrategy::Count)> strategyCounts{};
+        CopyBackend backend;
+        DeltaCopier delta;
+        uintmax_t deltaSize = 0;
+        uintmax_t deltaWritten = 0;
+        LatencyHistogram latency;
+        std::filesystem::path lastParent;
+        std::vector<CopyError> errors;
+    };
+
+    /**
+     * @brief Sum the bytes copied so far by every worker
+     */
+    uintmax_t sumCopied(const std::vector<WorkerCounters> &counters)
+    {
+        uintmax_t copied = 0;
+        for (const auto &counter : counters)
+        {
+            copied += counter.copiedSize.load(std::memory_order_relaxed);
+        }
+        return copied;
+    }
+
+    /**
+     * @brief Create the parent directory of a destination file
+     * @details Consecutive files usually share a directory, so the redundant mkdir round trips are skipped.
+     *
+     * @throws std::filesystem::filesystem_error
+     */
+    void prepareDestination(WorkerCounters &counter, const std::filesystem::path &destFile)
+    {
+        if (destFile.parent_path() != counter.lastParent)
+        {
+            std::filesystem::create_directories(destFile.parent_path());
+            counter.lastParent = destFile.parent_path();
+        }
+    }
+
+    /**
+     * @brief Store the digests of the copied bytes in the record
+     */
+    void setDigests(FileRecord &file, const FileDigest &digest)
+    {
+        file.sha256 = Hasher::toHex(digest.sha256);
+        file.blake3 = (digest.hashes & Hasher::BLAKE3) ? Hasher::toHex(digest.blake3) : std::string();
+    }
+
+    /**
+     * @brief Record a successfully copied file
+     */
+    void recordCopy(WorkerCounters &counter, FileRecord &file, const FileDigest &digest,
+                    uintmax_t fileSize, CopyStrategy strategy)
+    {
+        setDigests(file, digest);
+        file.copied = true;
+        counter.copiedSize.fetch_add(fileSize, std::memory_order_relaxed);
+        counter.copiedCount++;
+        counter.strategyCounts[static_cast<size_t>(strategy)]++;
+    }
+
+    /**
+     * @brief Merge the counters of every worker into the results of a run
+     */
+    void mergeCounters(std::vector<WorkerCounters> &counters, size_t &copiedCount,
+                       std::array<size_t, static_cast<size_t>(CopyStrategy::Count)> &strategyCounts,
+                       std::vector<CopyError> &errors, uintmax_t &deltaSize, uintmax_t &deltaWritten,
+                       LatencyHistogram &latency)
+    {
+        copiedCount = 0;
+        strategyCounts = {};
+        errors.clear();
+        deltaSize = deltaWritten = 0;
+        latency = {};
+        for (auto &counter : counters)
+        {
+            copiedCount += counter.copiedCount;
+            deltaSize += counter.deltaSize;
+            deltaWritten += counter.deltaWritten;
+            latency.merge(counter.latency);
+            for (size_t i = 0; i < strategyCounts.size(); ++i)
+            {
+                strategyCounts[i] += counter.strategyCounts[i];
+            }
+            errors.insert(errors.end(), std::make_move_iterator(counter.errors.begin()),
+                          std::make_move_iterator(counter.errors.end()));
+        }
+    }
+
+    /**
+     * @brief Copy one file with the synchronous backend
+     */
+    void copyOne(WorkerCounters &counter, FileRecord &file, const std::filesystem::path &sourceDir,
+                 const std::filesystem::path &backupDir, bool useDelta, unsigned hashes)
+    {
+        std::filesystem::path sourceFile = sourceDir / file.relativePath;
+        std::filesystem::path destFile = backupDir / file.relativePath;
+        TraceSpan span("copy", "copy file", file.relativePath);
+        auto start = std::chrono::steady_clock::now();
+        try
+        {
+            prepareDestination(counter, destFile);
+
+            // Sparse files keep their holes through the extent copy rather than the block delta
+            if (useDelta && file.size >= DeltaCopier::MIN_FILE_SIZE && !SparseFile::isSparse(file.size, file.allocatedSize))
+            {
+                FileDigest digest;
+                DeltaResult result = counter.delta.copyFile(sourceFile, destFile,
+                                                            DeltaCopier::signaturePath(backupDir, file.relativePath), digest, hashes);
+                counter.deltaSize += result.size;
+                counter.deltaWritten += result.written;
+                recordCopy(counter, file, digest, result.size,
+                           result.usedSignature ? CopyStrategy::Delta : CopyStrategy::ReadWrite);
+            }
+            else
+            {
+                uintmax_t fileSize = 0;
+                FileDigest digest;
+                CopyStrategy strategy = counter.backend.copyFile(sourceFile, destFile, &fileSize, &digest, hashes);
+                recordCopy(counter, file, digest, fileSize, strategy);
+            }
+        }
+        catch (const std::filesystem::filesystem_error &e)
+        {
+            counter.errors.push_back({sourceFile, destFile, e.what()});
+        }
+        counter.latency.record(std::chrono::steady_clock::now() - start);
+    }
+}
+
+/**
+ * @brief Copy every file to the same relative location under backupDir
+ * @details Each worker only ever touches its own counters; the calling thread sums them to
+ *          drive the progress display and merges them once all workers have finished.
+ *
+ *          With io_uring, the small files are dealt out to the workers first and each worker
+ *          keeps a batch of them in flight on its own ring. Large files then go through the
+ *          synchronous backend, whose reflink and copy_file_range paths io_uring cannot beat.
+ *
+ * @param files
+ * @param sourceDir
+ * @param backupDir
+ * @param totalSize
+ * @return uintmax_t
+ */
+uintmax_t CopyEngine::copyFiles(std::vector<FileRecord> &files,
+                                const std::filesystem::path &sourceDir,
+                                const std::filesystem::path &backupDir,
+                                uintmax_t totalSize)
+{
+    std::vector<WorkerCounters> counters(pool.size());
+    Tool tool;
+
+    std::vector<size_t> batched;
+    std::vector<size_t> individual;
+    for (size_t index = 0; index < files.size(); ++index)
+    {
+        bool small = useIoUring && files[index].size <= UringEngine::MAX_FILE_SIZE;
+        (small ? batched : individual).push_back(index);
+    }
+
+    // Batch b holds every batches-th small file, starting at b
+    unsigned batches = static_cast<unsigned>(std::min<size_t>(pool.size(), batched.size()));
+    pool.forEach(
+        batches,
+        [&](size_t batch, unsigned worker)
+        {
+            WorkerCounters &counter = counters[worker];
+            size_t count = (batched.size() - batch + batches - 1) / batches;
+            TraceSpan span("copy", "copy batch");
+            auto fileAt = [&](size_t position) -> FileRecord &
+            { return files[batched[batch + position * batches]]; };
+
+            UringEngine engine(UringEngine::depthPerWorker(batches), hashes);
+            if (!engine.valid())
+            {
+                for (size_t position = 0; position < count; ++position)
+                {
+                    copyOne(counter, fileAt(position), sourceDir, backupDir, false, hashes);
+                }
+                return;
+            }
+
+            std::vector<std::chrono::steady_clock::time_point> started(count);
+            engine.run(
+                count,
+                [&](size_t position, UringFile &job)
+                {
+                    started[position] = std::chrono::steady_clock::now();
+                    FileRecord &file = fileAt(position);
+                    job.source = sourceDir / file.relativePath;
+                    job.destination = backupDir / file.relativePath;
+                    job.mode = file.mode;
+                    try
+                    {
+                        prepareDestination(counter, job.destination);
+                    }
+                    catch (const std::filesystem::filesystem_error &e)
+                    {
+                        counter.errors.push_back({job.source, job.destination, e.what()});
+                        return false;
+                    }
+                    return true;
+                },
+                [&](size_t position, const UringResult &result)
+                {
+                    counter.latency.record(std::chrono::steady_clock::now() - started[position]);
+                    FileRecord &file = fileAt(position);
+                    if (result.ok)
+                    {
+                        recordCopy(counter, file, result.digest, result.size, CopyStrategy::IoUring);
+                    }
+                    else
+                    {
+                        counter.errors.push_back({sourceDir / file.relativePath, backupDir / file.relativePath, result.error});
+                    }
+                });
+        },
+        [&] { tool.showCopyProgress(sumCopied(counters), totalSize); });
+
+    pool.forEach(
+        individual.size(),
+        [&](size_t index, unsigned worker)
+        { copyOne(counters[worker], files[individual[index]], sourceDir, backupDir, useDelta, hashes); },
+        [&] { tool.showCopyProgress(sumCopied(counters), totalSize); });
+
+    uintmax_t copiedSize = sumCopied(counters);
+    tool.showCopyProgress(copiedSize, totalSize);
+    mergeCounters(counters, copiedCount, strategyCounts, errors, deltaSize, deltaWritten, latency);
+    return copiedSize;
+}
+
+/**
+ * @brief Split every file into content-defined chunks and store the chunks in a repository
+ * @details The file is streamed through the worker's buffer once; chunk boundaries are found
+ *          in the buffer, each chunk is hashed and handed to the store, and the whole-file digest
+ *          is computed from the same bytes.
+ *
+ * @param files
+ * @param sourceDir
+ * @param store
+ * @param totalSize
+ * @return uintmax_t
+ */
+uintmax_t CopyEngine::storeFiles(std::vector<FileRecord> &files,
+                                 const std::filesystem::path &sourceDir,
+                                 ChunkStore &store,
+                                 uintmax_t totalSize)
+{
+    std::vector<WorkerCounters> counters(pool.size());
+    Tool tool;
+
+    pool.forEach(
+        files.size(),
+        [&](size_t index, unsigned worker)
+        {
+            WorkerCounters &counter = counters[worker];
+            FileRecord &file = files[index];
+            std::filesystem::path sourceFile = sourceDir / file.relativePath;
+            TraceSpan span("copy", "store file", file.relativePath);
+            auto startTime = std::chrono::steady_clock::now();
+            auto fail = [&](const char *what)
+            {
+                counter.errors.push_back({sourceFile, std::filesystem::path(), std::string(what) + ": " + std::strerror(errno)});
+                counter.latency.record(std::chrono::steady_clock::now() - startTime);
+            };
+
+            FileDescriptor in(::open(sourceFile.c_str(), O_RDONLY | O_CLOEXEC));
+            if (!in.valid())
+            {
+                return fail("cannot open source file");
+            }
+#if defined(__linux__)
+            ::posix_fadvise(in.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+            // The buffer holds several maximum-size chunks, so a boundary search never runs short
+            static_assert(Hasher::BUFFER_SIZE >= 2 * Chunker::MAX_SIZE);
+            unsigned char *buffer = Hasher::threadBuffer();
+            thread_local ContentHasher fileHash;
+            thread_local Sha256 chunkHash;
+            fileHash.reset(hashes);
+            chunkHash.reset();
+
+            std::vector<Sha256Digest> chunks;
+            uintmax_t readSize = 0; // Counted as copied only once the whole file is stored
+            size_t start = 0;
+            size_t filled = 0;
+            bool endOfFile = false;
+            while (!endOfFile || start < filled)
+            {
+                if (!endOfFile)
+                {
+                    std::memmove(buffer, buffer + start, filled - start);
+                    filled -= start;
+                    start = 0;
+                    while (filled < Hasher::BUFFER_SIZE)
+                    {
+                        ssize_t readBytes = ::read(in.get(), buffer + filled, Hasher::BUFFER_SIZE - filled);
+                        if (readBytes < 0 && errno == EINTR)
+                        {
+                            continue;
+                        }
+                        if (readBytes < 0)
+                        {
+                            return fail("read");
+                        }
+                        if (readBytes == 0)
+                        {
+                            endOfFile = true;
+                            break;
+                        }
+                        fileHash.update(buffer + filled, static_cast<size_t>(readBytes));
+                        readSize += static_cast<uintmax_t>(readBytes);
+                        filled += static_cast<size_t>(readBytes);
+                    }
+                }
+
+                while (filled - start >= Chunker::MAX_SIZE || (endOfFile && start < filled))
+                {
+                    size_t length = Chunker::findBoundary(buffer + start, filled - start);
+                    chunkHash.update(buffer + start, length);
+                    Sha256Digest digest = chunkHash.finish();
+                    if (!store.put(digest, buffer + start, length))
+                    {
+                        return fail("cannot write chunk");
+                    }
+                    chunks.push_back(digest);
+                    start += length;
+                }
+            }
+
+            file.chunks = std::move(chunks);
+            setDigests(file, fileHash.finish());
+            file.copied = true;
+            counter.copiedSize.fetch_add(readSize, std::memory_order_relaxed);
+            counter.copiedCount++;
+            counter.latency.record(std::chrono::steady_clock::now() - startTime);
+        },
+        [&] { tool.showCopyProgress(sumCopied(counters), totalSize); });
+
+    uintmax_t storedSize = sumCopied(counters);
+    tool.showCopyProgress(storedSize, totalSize);
+    mergeCounters(counters, copiedCount, strategyCounts, errors, deltaSize, deltaWritten, latency);
+    return storedSize;
+}
@@ -0,0 +1,103 @@
+#ifndef COPYENGINE_H
+#define COPYENGINE_H
+
+#include "ChunkStore.h"
+#include "CopyBackend.h"
+#include "DeltaCopier.h"
+#include "FileRecord.h"
+#include "LatencyHistogram.h"
+#include "WorkerPool.h"
+#include <array>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+/**
+ * @brief A single file that could not be copied
+ */
+struct CopyError
+{
+    std::filesystem::path source;
+    std::filesystem::path destination;
+    std::string message;
+};
+
+class CopyEngine
+{
+public:
+    /**
+     * @brief Construct a new Copy Engine object
+     *
+     * @param jobs Number of concurrent copy workers (0 means hardware concurrency)
+     * @param useIoUring Copy small files in batches through io_uring (falls back to the workers when unavailable)
+     * @param useDelta Update large files that already have a copy by writing only their changed blocks
+     * @param hashes Digests of every copied file: Hasher::SHA256, plus Hasher::BLAKE3 for change detection
+     */
+    explicit CopyEngine(unsigned jobs = 0, bool useIoUring = false, bool useDelta = false, unsigned hashes = Hasher::SHA256)
+        : pool(jobs), useIoUring(useIoUring), useDelta(useDelta), hashes(hashes) {}
+
+    /**
+     * @brief Copy every file to the same relative location under backupDir
+     * @details Each file is read once: its SHA256 (and BLAKE3 when requested) is calculated from
+     *          the bytes as they are copied and stored in the record together with the copied flag.
+     *
+     * @param files Records of the regular files to copy (sha256, blake3 and copied are filled in)
+     * @param sourceDir Root the relative paths of the records are based on
+     * @param backupDir Destination root
+     * @param totalSize Total number of bytes, used for the progress display
+     * @return uintmax_t Number of bytes copied successfully
+     *
+     * @note A failing file is recorded in errors() and does not abort the run
+     */
+    uintmax_t copyFiles(std::vector<FileRecord> &files,
+                        const std::filesystem::path &sourceDir,
+                        const std::filesystem::path &backupDir,
+                        uintmax_t totalSize);
+
+    /**
+     * @brief Split every file into content-defined chunks and store the chunks in a repository
+     * @details Each file is read once: the chunk digests, the file's SHA256 and the chunk list
+     *          are filled into the record together with the copied flag. Chunks the repository
+     *          already holds are not written again.
+     *
+     * @param files Records of the regular files to store
+     * @param sourceDir Root the relative paths of the records are based on
+     * @param store Open chunk repository
+     * @param totalSize Total number of bytes, used for the progress display
+     * @return uintmax_t Number of bytes of the files stored successfully
+     *
+     * @note A failing file is recorded in errors() and does not abort the run
+     */
+    uintmax_t storeFiles(std::vector<FileRecord> &files,
+                         const std::filesystem::path &sourceDir,
+                         ChunkStore &store,
+                         uintmax_t totalSize);
+
+    size_t getCopiedCount() const { return copiedCount; }                  // Get the number of files copied
+    const std::vector<CopyError> &getErrors() const { return errors; }     // Get the files that failed
+    unsigned getJobs() const { return pool.size(); }                       // Get the number of workers
+    uintmax_t getDeltaSize() const { return deltaSize; }                   // Get the size of the files updated with --delta
+    uintmax_t getDeltaWritten() const { return deltaWritten; }             // Get the bytes those files actually took from the source
+    const LatencyHistogram &getLatency() const { return latency; }         // Get the time each file took to copy or store
+
+    /**
+     * @brief Get how many files each copy strategy completed during the last run
+     *
+     * @return const std::array<size_t, static_cast<size_t>(CopyStrategy::Count)>& Indexed by CopyStrategy
+     */
+    const std::array<size_t, static_cast<size_t>(CopyStrategy::Count)> &getStrategyCounts() const { return strategyCounts; }
+
+private:
+    WorkerPool pool;
+    bool useIoUring;
+    bool useDelta;
+    unsigned hashes;
+    size_t copiedCount = 0;
+    uintmax_t deltaSize = 0;
+    uintmax_t deltaWritten = 0;
+    LatencyHistogram latency;
+    std::array<size_t, static_cast<size_t>(CopyStrategy::Count)> strategyCounts{};
+    std::vector<CopyError> errors;
+};
+
+#endif // COPYENGINE_H
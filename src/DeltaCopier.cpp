@@ -0,0 +1,750 @@
+#include "DeltaCopier.h"
+#include "FileDescriptor.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+    constexpr char SIGNATURE_MAGIC[8] = {'B', 'K', 'S', 'I', 'G', '0', '0', '1'};
+    constexpr size_t MIN_BLOCK_SIZE = 8 * 1024;
+    constexpr uint64_t MAX_BLOCKS = 1 << 20;      // Keeps a signature under ~20 MiB
+    constexpr size_t MIN_WINDOW_SIZE = 4 << 20;   // Read size of the matching pass
+
+    using StrongSum = std::array<unsigned char, 16>;
+
+    /**
+     * @brief Per-block checksums of one version of a file
+     */
+    struct Signature
+    {
+        uint32_t blockSize = 0;
+        uint64_t fileSize = 0;
+        int64_t mtimeNs = 0;          // Modification time of the destination the signature describes
+        std::vector<uint32_t> weak;
+        std::vector<StrongSum> strong;
+    };
+
+    /**
+     * @brief On-disk signature header (host byte order), followed by 20 bytes per block
+     */
+    struct SignatureHeader
+    {
+        char magic[8];
+        uint32_t blockSize;
+        uint32_t reserved;
+        uint64_t fileSize;
+        int64_t mtimeNs;
+    };
+    static_assert(sizeof(SignatureHeader) == 32);
+
+    /**
+     * @brief rsync's rolling checksum: a = sum of the bytes, b = sum of the prefix sums, 16 bits each
+     * @details Sliding the window by one byte is O(1), which is what makes searching for a block at
+     *          every offset affordable. Arithmetic wraps modulo 2^32 and is reduced in value().
+     */
+    struct RollingChecksum
+    {
+        uint32_t a = 0;
+        uint32_t b = 0;
+
+        void reset()
+        {
+            a = b = 0;
+        }
+
+        void update(const unsigned char *data, size_t size)
+        {
+            for (size_t i = 0; i < size; ++i)
+            {
+                a += data[i];
+                b += a;
+            }
+        }
+
+        void roll(unsigned char out, unsigned char in, size_t blockSize)
+        {
+            a += static_cast<uint32_t>(in) - out;
+            b += a - static_cast<uint32_t>(blockSize) * out;
+        }
+
+        uint32_t value() const { return (a & 0xffff) | (b << 16); }
+    };
+
+    StrongSum strongSum(Sha256 &sha256, const unsigned char *data, size_t size)
+    {
+        sha256.update(data, size);
+        Sha256Digest digest = sha256.finish();
+        StrongSum sum;
+        std::copy_n(digest.begin(), sum.size(), sum.begin());
+        return sum;
+    }
+
+    int64_t mtimeOf(const struct stat &status)
+    {
+#if defined(__APPLE__)
+        return static_cast<int64_t>(status.st_mtimespec.tv_sec) * 1000000000 + status.st_mtimespec.tv_nsec;
+#else
+        return static_cast<int64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+#endif
+    }
+
+    bool sameVersion(const struct stat &before, const struct stat &after)
+    {
+#if defined(__APPLE__)
+        bool sameCtime = before.st_ctimespec.tv_sec == after.st_ctimespec.tv_sec && before.st_ctimespec.tv_nsec == after.st_ctimespec.tv_nsec;
+#else
+        bool sameCtime = before.st_ctim.tv_sec == after.st_ctim.tv_sec && before.st_ctim.tv_nsec == after.st_ctim.tv_nsec;
+#endif
+        return before.st_size == after.st_size && mtimeOf(before) == mtimeOf(after) && sameCtime;
+    }
+
+    /**
+     * @brief Pick a block size so that even very large files have at most MAX_BLOCKS blocks
+     */
+    uint32_t chooseBlockSize(uint64_t fileSize)
+    {
+        uint64_t blockSize = MIN_BLOCK_SIZE;
+        while (fileSize / blockSize > MAX_BLOCKS)
+        {
+            blockSize *= 2;
+        }
+        return static_cast<uint32_t>(blockSize);
+    }
+
+    /**
+     * @brief Load a signature if it still describes the destination as it is on disk
+     */
+    bool loadSignature(const std::filesystem::path &file, const struct stat &destination, Signature &signature)
+    {
+        std::ifstream input(file, std::ios::binary);
+        SignatureHeader header;
+        if (!input.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+            !std::equal(std::begin(header.magic), std::end(header.magic), std::begin(SIGNATURE_MAGIC)) ||
+            header.blockSize == 0 ||
+            header.fileSize != static_cast<uint64_t>(destination.st_size) ||
+            header.mtimeNs != mtimeOf(destination))
+        {
+            return false;
+        }
+
+        uint64_t blocks = (header.fileSize + header.blockSize - 1) / header.blockSize;
+        if (blocks > 4 * MAX_BLOCKS)
+        {
+            return false;
+        }
+        signature.blockSize = header.blockSize;
+        signature.fileSize = header.fileSize;
+        signature.mtimeNs = header.mtimeNs;
+        signature.weak.resize(blocks);
+        signature.strong.resize(blocks);
+        for (uint64_t block = 0; block < blocks; ++block)
+        {
+            input.read(reinterpret_cast<char *>(&signature.weak[block]), sizeof(uint32_t));
+            input.read(reinterpret_cast<char *>(signature.strong[block].data()), sizeof(StrongSum));
+        }
+        return static_cast<bool>(input);
+    }
+
+    /**
+     * @brief Write a signature through a temporary file, so a torn write is never mistaken for a signature
+     */
+    bool saveSignature(const std::filesystem::path &file, const Signature &signature)
+    {
+        std::error_code error;
+        std::filesystem::create_directories(file.parent_path(), error);
+        std::filesystem::path temporary = file;
+        temporary += ".tmp";
+
+        std::ofstream output(temporary, std::ios::binary | std::ios::trunc);
+        SignatureHeader header;
+        std::copy(std::begin(SIGNATURE_MAGIC), std::end(SIGNATURE_MAGIC), header.magic);
+        header.blockSize = signature.blockSize;
+        header.reserved = 0;
+        header.fileSize = signature.fileSize;
+        header.mtimeNs = signature.mtimeNs;
+        output.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        for (size_t block = 0; block < signature.weak.size(); ++block)
+        {
+            output.write(reinterpret_cast<const char *>(&signature.weak[block]), sizeof(uint32_t));
+            output.write(reinterpret_cast<const char *>(signature.strong[block].data()), sizeof(StrongSum));
+        }
+        if (!output.flush())
+        {
+            return false;
+        }
+        output.close();
+        std::filesystem::rename(temporary, file, error);
+        return !error;
+    }
+
+    /**
+     * @brief Builds the signature of the new version from the bytes as they are read
+     */
+    class SignatureBuilder
+    {
+    public:
+        explicit SignatureBuilder(uint32_t blockSize) { signature.blockSize = blockSize; }
+
+        void update(const unsigned char *data, size_t size)
+        {
+            while (size > 0)
+            {
+                size_t take = std::min<size_t>(size, signature.blockSize - filled);
+                weak.update(data, take);
+                sha256.update(data, take);
+                filled += take;
+                data += take;
+                size -= take;
+                signature.fileSize += take;
+                if (filled == signature.blockSize)
+                {
+                    finishBlock();
+                }
+            }
+        }
+
+        Signature &finish()
+        {
+            if (filled > 0)
+            {
+                finishBlock();
+            }
+            return signature;
+        }
+
+    private:
+        Signature signature;
+        RollingChecksum weak;
+        Sha256 sha256;
+        size_t filled = 0;
+
+        void finishBlock()
+        {
+            signature.weak.push_back(weak.value());
+            Sha256Digest digest = sha256.finish();
+            StrongSum sum;
+            std::copy_n(digest.begin(), sum.size(), sum.begin());
+            signature.strong.push_back(sum);
+            weak.reset();
+            filled = 0;
+        }
+    };
+
+    /**
+     * @brief Weak checksum -> block lookup over the full-size blocks of a signature
+     * @details A 64 Ki-bit filter rejects almost every offset that has no candidate before the
+     *          sorted table is searched.
+     */
+    class BlockLookup
+    {
+    public:
+        explicit BlockLookup(const Signature &signature) : filter(1 << 16)
+        {
+            uint64_t fullBlocks = signature.fileSize / signature.blockSize;
+            entries.reserve(fullBlocks);
+            for (uint32_t block = 0; block < fullBlocks; ++block)
+            {
+                entries.push_back({signature.weak[block], block});
+                filter[bucket(signature.weak[block])] = true;
+            }
+            std::sort(entries.begin(), entries.end());
+        }
+
+        /**
+         * @brief Call match(block) for every block with this weak checksum until it returns true
+         */
+        template <typename Match>
+        bool find(uint32_t weak, Match &&match) const
+        {
+            if (!filter[bucket(weak)])
+            {
+                return false;
+            }
+            for (auto it = std::lower_bound(entries.begin(), entries.end(), std::make_pair(weak, uint32_t(0)));
+                 it != entries.end() && it->first == weak; ++it)
+            {
+                if (match(it->second))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        std::vector<std::pair<uint32_t, uint32_t>> entries;
+        std::vector<bool> filter;
+
+        static size_t bucket(uint32_t weak) { return (weak ^ (weak >> 16)) & 0xffff; }
+    };
+
+    /**
+     * @brief A range of the new version: either new data or a block range of the previous version
+     */
+    struct DeltaOp
+    {
+        uint64_t offset;  // Offset in the new version
+        uint64_t length;
+        int64_t source;   // Offset in the previous version, or -1 for data taken from the source
+    };
+
+    void appendOp(std::vector<DeltaOp> &ops, uint64_t offset, uint64_t length, int64_t source)
+    {
+        if (!ops.empty())
+        {
+            DeltaOp &last = ops.back();
+            bool contiguous = last.offset + last.length == offset &&
+                              ((last.source < 0 && source < 0) ||
+                               (last.source >= 0 && source >= 0 && static_cast<uint64_t>(last.source) + last.length == static_cast<uint64_t>(source)));
+            if (contiguous)
+            {
+                last.length += length;
+                return;
+            }
+        }
+        ops.push_back({offset, length, source});
+    }
+
+    [[noreturn]] void throwDeltaError(const char *what, const std::filesystem::path &source,
+                                      const std::filesystem::path &destination, int error)
+    {
+        throw std::filesystem::filesystem_error(what, source, destination,
+                                                std::error_code(error, std::generic_category()));
+    }
+}
+
+/**
+ * @brief Get the path of the signature of a backed-up file
+ *
+ * @param backupDir
+ * @param relativePath
+ * @return std::filesystem::path
+ */
+std::filesystem::path DeltaCopier::signaturePath(const std::filesystem::path &backupDir, std::string_view relativePath)
+{
+    std::filesystem::path file = backupDir / ".signatures" / relativePath;
+    file += ".sig";
+    return file;
+}
+
+/**
+ * @brief Bring destination up to date with source and refresh its signature
+ * @details Pass 1 reads the source once: it hashes the whole file, builds the new signature and
+ *          slides the rolling checksum over the data to find the blocks of the previous version,
+ *          producing a list of ranges. Pass 2 applies it. When (almost) every matched block is
+ *          at its old offset the destination is patched in place and only the changed ranges are
+ *          written; otherwise the new version is assembled in a temporary file from ranges of
+ *          the old destination and of the source, then renamed over the destination.
+ *
+ * @param source
+ * @param destination
+ * @param signature
+ * @param digest
+ * @param hashes
+ * @return DeltaResult
+ */
+DeltaResult DeltaCopier::copyFile(const std::filesystem::path &source,
+                                  const std::filesystem::path &destination,
+                                  const std::filesystem::path &signature,
+                                  FileDigest &digest,
+                                  unsigned hashes)
+{
+    DeltaResult result;
+
+    FileDescriptor in(::open(source.c_str(), O_RDONLY | O_CLOEXEC));
+    struct stat sourceBefore;
+    if (!in.valid() || ::fstat(in.get(), &sourceBefore) != 0)
+    {
+        throwDeltaError("cannot open source file", source, destination, errno);
+    }
+#if defined(__linux__)
+    ::posix_fadvise(in.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    Signature previous;
+    FileDescriptor old(::open(destination.c_str(), O_RDONLY | O_CLOEXEC));
+    struct stat destinationStat;
+    result.usedSignature = old.valid() && ::fstat(old.get(), &destinationStat) == 0 &&
+                           loadSignature(signature, destinationStat, previous);
+
+    // Without a previous version the file is copied whole in pass 1 itself
+    FileDescriptor direct;
+    if (!result.usedSignature)
+    {
+        old.reset();
+        std::error_code ignored;
+        std::filesystem::remove(signature, ignored);
+        direct.reset(::open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, sourceBefore.st_mode & 07777));
+        if (!direct.valid())
+        {
+            throwDeltaError("cannot open destination file", source, destination, errno);
+        }
+    }
+
+    // Pass 1: read the source, hash it, and match it against the previous version
+    size_t blockSize = result.usedSignature ? previous.blockSize : MIN_BLOCK_SIZE;
+    size_t capacity = std::max(MIN_WINDOW_SIZE, 4 * blockSize);
+    std::unique_ptr<unsigned char[]> window(new unsigned char[capacity]);
+    thread_local ContentHasher fileHash;
+    thread_local Sha256 blockHash;
+    fileHash.reset(hashes);
+    blockHash.reset();
+    SignatureBuilder builder(chooseBlockSize(static_cast<uint64_t>(sourceBefore.st_size)));
+
+    std::vector<DeltaOp> ops;
+    uint64_t base = 0;        // Source offset of window[0]
+    size_t position = 0;      // Start of the block being matched, in the window
+    size_t filled = 0;
+    bool endOfFile = false;
+    uint64_t literalStart = 0;
+
+    auto refill = [&]
+    {
+        std::memmove(window.get(), window.get() + position, filled - position);
+        base += position;
+        filled -= position;
+        position = 0;
+        while (!endOfFile && filled < capacity)
+        {
+            ssize_t readBytes = ::read(in.get(), window.get() + filled, capacity - filled);
+            if (readBytes < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (readBytes < 0)
+            {
+                throwDeltaError("read", source, destination, errno);
+            }
+            if (readBytes == 0)
+            {
+                endOfFile = true;
+                break;
+            }
+            fileHash.update(window.get() + filled, static_cast<size_t>(readBytes));
+            builder.update(window.get() + filled, static_cast<size_t>(readBytes));
+            if (direct.valid())
+            {
+                for (ssize_t written = 0; written < readBytes;)
+                {
+                    ssize_t count = ::pwrite(direct.get(), window.get() + filled + written, static_cast<size_t>(readBytes - written),
+                                             static_cast<off_t>(base + filled + written));
+                    if (count < 0 && errno != EINTR)
+                    {
+                        throwDeltaError("write", source, destination, errno);
+                    }
+                    written += std::max<ssize_t>(count, 0);
+                }
+            }
+            filled += static_cast<size_t>(readBytes);
+        }
+    };
+
+    if (result.usedSignature)
+    {
+        BlockLookup lookup(previous);
+        uint64_t fullBlocks = previous.fileSize / blockSize;
+        RollingChecksum rolling;
+        bool rollingValid = false;
+
+        for (;;)
+        {
+            // Keep one byte beyond the block so the checksum can always roll
+            if (!endOfFile && filled - position <= blockSize)
+            {
+                refill();
+            }
+            if (filled - position < blockSize)
+            {
+                break;
+            }
+            if (!rollingValid)
+            {
+                rolling.reset();
+                rolling.update(window.get() + position, blockSize);
+                rollingValid = true;
+            }
+
+            const unsigned char *data = window.get() + position;
+            uint64_t offset = base + position;
+            uint32_t weak = rolling.value();
+            bool haveStrong = false;
+            StrongSum strong;
+            auto matches = [&](uint64_t block)
+            {
+                if (previous.weak[block] != weak)
+                {
+                    return false;
+                }
+                if (!haveStrong)
+                {
+                    strong = strongSum(blockHash, data, blockSize);
+                    haveStrong = true;
+                }
+                return previous.strong[block] == strong;
+            };
+
+            // The block at the same offset is by far the most likely match
+            int64_t matched = -1;
+            if (offset % blockSize == 0 && offset / blockSize < fullBlocks && matches(offset / blockSize))
+            {
+                matched = static_cast<int64_t>(offset);
+            }
+            else
+            {
+                lookup.find(weak, [&](uint32_t block)
+                            {
+                    if (matches(block))
+                    {
+                        matched = static_cast<int64_t>(block) * static_cast<int64_t>(blockSize);
+                        return true;
+                    }
+                    return false; });
+            }
+
+            if (matched >= 0)
+            {
+                if (offset > literalStart)
+                {
+                    appendOp(ops, literalStart, offset - literalStart, -1);
+                }
+                appendOp(ops, offset, blockSize, matched);
+                position += blockSize;
+                literalStart = base + position;
+                rollingValid = false;
+            }
+            else if (filled - position > blockSize)
+            {
+                rolling.roll(data[0], data[blockSize], blockSize);
+                position++;
+            }
+            else
+            {
+                position++;
+                rollingValid = false;
+            }
+        }
+
+        // The short last block of the previous version can only match the end of the file
+        uint64_t tailLength = previous.fileSize % blockSize;
+        if (tailLength != 0 && filled - position == tailLength &&
+            strongSum(blockHash, window.get() + position, tailLength) == previous.strong.back())
+        {
+            uint64_t offset = base + position;
+            if (offset > literalStart)
+            {
+                appendOp(ops, literalStart, offset - literalStart, -1);
+            }
+            appendOp(ops, offset, tailLength, static_cast<int64_t>(previous.fileSize - tailLength));
+            position = filled;
+            literalStart = base + filled;
+        }
+    }
+    else
+    {
+        while (!endOfFile)
+        {
+            position = filled;
+            refill();
+        }
+    }
+
+    uint64_t newSize = base + filled;
+    if (newSize > literalStart)
+    {
+        appendOp(ops, literalStart, newSize - literalStart, -1);
+    }
+    digest = fileHash.finish();
+    result.size = newSize;
+
+    // Pass 2: apply the ranges
+    FileDescriptor out;
+    if (direct.valid())
+    {
+        out = std::move(direct);
+        result.written = newSize;
+    }
+    else
+    {
+        uint64_t matchedBytes = 0;
+        uint64_t alignedBytes = 0;
+        for (const DeltaOp &op : ops)
+        {
+            if (op.source >= 0)
+            {
+                matchedBytes += op.length;
+                alignedBytes += static_cast<uint64_t>(op.source) == op.offset ? op.length : 0;
+            }
+        }
+        result.inPlace = alignedBytes * 10 >= matchedBytes * 9;
+
+        // An interrupted update must not leave a signature that claims the old content
+        std::error_code ignored;
+        std::filesystem::remove(signature, ignored);
+
+        std::filesystem::path temporary = destination;
+        temporary += ".delta-tmp";
+        if (result.inPlace)
+        {
+            out.reset(::open(destination.c_str(), O_WRONLY | O_CLOEXEC));
+        }
+        else
+        {
+            out.reset(::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, sourceBefore.st_mode & 07777));
+        }
+        if (!out.valid())
+        {
+            throwDeltaError("cannot open destination file", source, destination, errno);
+        }
+
+        try
+        {
+            for (const DeltaOp &op : ops)
+            {
+                if (op.source >= 0 && static_cast<uint64_t>(op.source) == op.offset && result.inPlace)
+                {
+                    continue; // Already in place
+                }
+                if (op.source >= 0 && !result.inPlace)
+                {
+                    copyRange(old.get(), out.get(), static_cast<uint64_t>(op.source), op.offset, op.length);
+                }
+                else
+                {
+                    // In place, a moved block may already be overwritten in the destination, so it
+                    // is taken from the source, which pass 1 verified to hold the same bytes
+                    copyRange(in.get(), out.get(), op.offset, op.offset, op.length);
+                    result.written += op.length;
+                }
+            }
+            if (::ftruncate(out.get(), static_cast<off_t>(newSize)) != 0)
+            {
+                throw std::system_error(errno, std::generic_category(), "truncate");
+            }
+        }
+        catch (const std::system_error &e)
+        {
+            if (!result.inPlace)
+            {
+                std::filesystem::remove(temporary, ignored);
+            }
+            throwDeltaError(e.what(), source, destination, e.code().value());
+        }
+
+        if (!result.inPlace)
+        {
+            old.reset();
+            std::filesystem::rename(temporary, destination, ignored);
+            if (ignored)
+            {
+                std::filesystem::remove(temporary, ignored);
+                throwDeltaError("cannot replace destination file", source, destination, EIO);
+            }
+        }
+    }
+
+    // Pass 2 re-reads ranges of the source; they must still be the bytes pass 1 hashed
+    struct stat sourceAfter;
+    if (result.usedSignature && (::fstat(in.get(), &sourceAfter) != 0 || !sameVersion(sourceBefore, sourceAfter)))
+    {
+        throwDeltaError("source file changed while it was copied", source, destination, EAGAIN);
+    }
+
+    // O_CREAT does not change the mode of an existing file
+    ::fchmod(out.get(), sourceBefore.st_mode & 07777);
+    struct stat written;
+    if (::fstat(out.get(), &written) != 0 || ::close(out.release()) != 0)
+    {
+        throwDeltaError("cannot close destination file", source, destination, errno);
+    }
+
+    Signature &next = builder.finish();
+    next.mtimeNs = mtimeOf(written);
+    saveSignature(signature, next);
+    return result;
+}
+
+/**
+ * @brief Copy a byte range between two files, in the kernel when possible
+ *
+ * @param in
+ * @param out
+ * @param inOffset
+ * @param outOffset
+ * @param length
+ */
+void DeltaCopier::copyRange(int in, int out, uint64_t inOffset, uint64_t outOffset, uint64_t length)
+{
+#if defined(__linux__)
+    while (copyFileRangeSupported && length > 0)
+    {
+        off_t from = static_cast<off_t>(inOffset);
+        off_t to = static_cast<off_t>(outOffset);
+        ssize_t copied = ::copy_file_range(in, &from, out, &to, static_cast<size_t>(length), 0);
+        if (copied < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (copied < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP || errno == EBADF))
+        {
+            copyFileRangeSupported = false;
+            break;
+        }
+        if (copied < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "copy_file_range");
+        }
+        if (copied == 0)
+        {
+            throw std::system_error(EIO, std::generic_category(), "source file shrank while it was copied");
+        }
+        inOffset += static_cast<uint64_t>(copied);
+        outOffset += static_cast<uint64_t>(copied);
+        length -= static_cast<uint64_t>(copied);
+    }
+#endif
+
+    unsigned char *buffer = Hasher::threadBuffer();
+    while (length > 0)
+    {
+        ssize_t readBytes = ::pread(in, buffer, static_cast<size_t>(std::min<uint64_t>(length, Hasher::BUFFER_SIZE)),
+                                    static_cast<off_t>(inOffset));
+        if (readBytes < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (readBytes < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "read");
+        }
+        if (readBytes == 0)
+        {
+            throw std::system_error(EIO, std::generic_category(), "source file shrank while it was copied");
+        }
+        for (ssize_t written = 0; written < readBytes;)
+        {
+            ssize_t count = ::pwrite(out, buffer + written, static_cast<size_t>(readBytes - written),
+                                     static_cast<off_t>(outOffset) + written);
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count < 0)
+            {
+                throw std::system_error(errno, std::generic_category(), "write");
+            }
+            written += count;
+        }
+        inOffset += static_cast<uint64_t>(readBytes);
+        outOffset += static_cast<uint64_t>(readBytes);
+        length -= static_cast<uint64_t>(readBytes);
+    }
+}
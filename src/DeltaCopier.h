@@ -0,0 +1,70 @@
+#ifndef DELTACOPIER_H
+#define DELTACOPIER_H
+
+#include "Hasher.h"
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+
+/**
+ * @brief Outcome of a delta copy
+ */
+struct DeltaResult
+{
+    uintmax_t size = 0;          // Size of the new version
+    uintmax_t written = 0;       // Bytes taken from the source (the rest was already in the destination)
+    bool usedSignature = false;  // A valid signature of the previous version was found
+    bool inPlace = false;        // Only the changed ranges were rewritten in the destination itself
+};
+
+/**
+ * @brief rsync-style block delta between a source file and its previous copy in the backup
+ * @details Every copy leaves a signature of the destination behind (a rolling weak checksum and
+ *          a truncated SHA-256 for each block). The next copy reads the source once, finds the
+ *          blocks it shares with the previous version, and then either rewrites only the changed
+ *          ranges in place (blocks still at their old offsets, e.g. database pages) or assembles
+ *          a temporary file from the old destination and the new data (data shifted by an
+ *          insertion) and renames it over the destination.
+ */
+class DeltaCopier
+{
+public:
+    static constexpr uintmax_t MIN_FILE_SIZE = 8ULL << 20; // Smaller files are copied whole
+
+    /**
+     * @brief Get the path of the signature of a backed-up file
+     *
+     * @param backupDir
+     * @param relativePath
+     * @return std::filesystem::path backupDir/.signatures/<relativePath>.sig
+     */
+    static std::filesystem::path signaturePath(const std::filesystem::path &backupDir, std::string_view relativePath);
+
+    /**
+     * @brief Bring destination up to date with source and refresh its signature
+     *
+     * @param source
+     * @param destination Created when missing; receives the permission bits of source
+     * @param signature Signature of the previous version; rewritten for the new version
+     * @param digest Receives the digests of the new version
+     * @param hashes Digests to compute: Hasher::SHA256 and/or Hasher::BLAKE3
+     * @return DeltaResult
+     *
+     * @throws std::filesystem::filesystem_error when the file cannot be copied, or when the
+     *         source changed while it was being copied
+     * @note Without a signature matching the destination, the file is copied whole (and a
+     *       signature is written for the next run)
+     */
+    DeltaResult copyFile(const std::filesystem::path &source,
+                         const std::filesystem::path &destination,
+                         const std::filesystem::path &signature,
+                         FileDigest &digest,
+                         unsigned hashes = Hasher::SHA256);
+
+private:
+    bool copyFileRangeSupported = true;
+
+    void copyRange(int in, int out, uint64_t inOffset, uint64_t outOffset, uint64_t length);
+};
+
+#endif // DELTACOPIER_H
@@ -0,0 +1,274 @@
+#include "DirectoryWalker.h"
+#include "FileDescriptor.h"
+#include "FileUtils.h"
+#include "Trace.h"
+#include "WorkerPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <sys/stat.h>
+#include <thread>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    /**
+     * @brief Directories waiting to be read by one worker
+     * @details The owner pushes and pops at the back (depth first, hot in cache); thieves take from
+     *          the front, where the shallowest and therefore largest subtrees are.
+     */
+    struct alignas(64) WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<std::string_view> directories;
+    };
+
+    /**
+     * @brief State owned by one worker, merged into the result at the end of the walk
+     */
+    struct alignas(64) WorkerState
+    {
+        PathArena arena;
+        std::vector<FileRecord> records;
+    };
+
+#ifdef __linux__
+    struct LinuxDirent64
+    {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+    };
+
+    /**
+     * @brief Call visit(name, type) for every entry of an open directory using raw getdents64
+     * @details One syscall returns a whole buffer of entries together with their d_type, without
+     *          the extra copy and per-entry bookkeeping of readdir.
+     *
+     * @return int 0 on success, otherwise errno
+     */
+    template <typename Visitor>
+    int readEntries(int fd, Visitor &&visit)
+    {
+        constexpr size_t DIRENT_BUFFER_SIZE = 64 * 1024;
+        alignas(8) thread_local char buffer[DIRENT_BUFFER_SIZE];
+
+        for (;;)
+        {
+            long length = ::syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+            if (length == 0)
+            {
+                return 0;
+            }
+            if (length < 0)
+            {
+                return errno;
+            }
+            for (long offset = 0; offset < length;)
+            {
+                const auto *entry = reinterpret_cast<const LinuxDirent64 *>(buffer + offset);
+                offset += entry->d_reclen;
+                visit(entry->d_name, entry->d_type);
+            }
+        }
+    }
+#else
+    template <typename Visitor>
+    int readEntries(int fd, Visitor &&visit)
+    {
+        int streamFd = ::dup(fd);
+        DIR *stream = streamFd >= 0 ? ::fdopendir(streamFd) : nullptr;
+        if (stream == nullptr)
+        {
+            int error = errno;
+            if (streamFd >= 0)
+            {
+                ::close(streamFd);
+            }
+            return error;
+        }
+        while (const struct dirent *entry = ::readdir(stream))
+        {
+            visit(entry->d_name, entry->d_type);
+        }
+        ::closedir(stream);
+        return 0;
+    }
+#endif
+}
+
+/**
+ * @brief Walk the tree and record every regular file
+ * @details Every relative path is built from its parent's relative path and the entry name, so
+ *          no path is ever made relative (or canonical) again. Files are stat'ed relative to
+ *          their directory descriptor, so the kernel does not resolve the full path either;
+ *          directories reported by d_type are never stat'ed.
+ *
+ *          Each worker owns a queue of directories and steals from the others when it runs dry,
+ *          so a wide tree keeps every worker busy and many directory reads are in flight at
+ *          once, which is what matters on high-latency (network) filesystems. The walk is over
+ *          when no directory is queued or being read.
+ *
+ * @param arena
+ * @return std::vector<FileRecord> Sorted by relative path
+ */
+std::vector<FileRecord> DirectoryWalker::scan(PathArena &arena)
+{
+    std::vector<FileRecord> records;
+
+    FileDescriptor rootFd(::open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (!rootFd.valid())
+    {
+        std::cerr << "Cannot open directory " << root << ": " << std::strerror(errno) << "\n";
+        return records;
+    }
+
+    WorkerPool pool(jobs);
+    std::vector<WorkQueue> queues(pool.size());
+    std::vector<WorkerState> states(pool.size());
+    std::atomic<size_t> outstanding{1}; // Directories queued or being read
+
+    // Directories are queued as paths relative to root ("" is root itself)
+    queues[0].directories.push_back(std::string_view());
+
+    auto push = [&](unsigned worker, std::string_view directory)
+    {
+        outstanding.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(queues[worker].mutex);
+        queues[worker].directories.push_back(directory);
+    };
+
+    auto take = [&](unsigned worker, std::string_view &directory)
+    {
+        {
+            WorkQueue &own = queues[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.directories.empty())
+            {
+                directory = own.directories.back();
+                own.directories.pop_back();
+                return true;
+            }
+        }
+        for (size_t step = 1; step < queues.size(); ++step)
+        {
+            WorkQueue &victim = queues[(worker + step) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.directories.empty())
+            {
+                directory = victim.directories.front();
+                victim.directories.pop_front();
+                return true;
+            }
+        }
+        return false;
+    };
+
+    auto readDirectory = [&](unsigned worker, std::string_view directory)
+    {
+        TraceSpan span("walk", "walk directory", directory);
+        WorkerState &state = states[worker];
+        FileDescriptor fd(::openat(rootFd.get(), directory.empty() ? "." : directory.data(),
+                                   O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+        int error = fd.valid() ? readEntries(fd.get(), [&](const char *entryName, unsigned char type)
+                                             {
+            std::string_view name(entryName);
+            if (name == "." || name == "..")
+            {
+                return;
+            }
+
+            if (type == DT_DIR)
+            {
+                push(worker, state.arena.join(directory, name));
+                return;
+            }
+            if (std::find(excludedNames.begin(), excludedNames.end(), name) != excludedNames.end())
+            {
+                return;
+            }
+
+            // Regular files, symbolic links and entries whose type the filesystem did not report
+            FileRecord record;
+            if (!Tool::statFile(record, fd.get(), entryName))
+            {
+                return; // Dangling link, or removed while walking
+            }
+            if (S_ISREG(record.mode))
+            {
+                record.relativePath = state.arena.join(directory, name);
+                state.records.push_back(record);
+            }
+            else if (S_ISDIR(record.mode) && type == DT_UNKNOWN)
+            {
+                // Only descend into real directories, not symbolic links to them
+                struct stat linkStat;
+                if (::fstatat(fd.get(), entryName, &linkStat, AT_SYMLINK_NOFOLLOW) == 0 &&
+                    S_ISDIR(linkStat.st_mode))
+                {
+                    push(worker, state.arena.join(directory, name));
+                }
+            } })
+                                 : errno;
+        if (error != 0)
+        {
+            std::string message = "Cannot read directory " + (root / directory).string() + ": " + std::strerror(error) + "\n";
+            std::cerr << message;
+        }
+    };
+
+    // One task per worker; the task index doubles as the worker's queue
+    pool.forEach(pool.size(), [&](size_t index, unsigned)
+                 {
+        unsigned worker = static_cast<unsigned>(index);
+        unsigned idleRounds = 0;
+        while (outstanding.load(std::memory_order_acquire) != 0)
+        {
+            std::string_view directory;
+            if (take(worker, directory))
+            {
+                readDirectory(worker, directory);
+                outstanding.fetch_sub(1, std::memory_order_acq_rel);
+                idleRounds = 0;
+            }
+            else if (++idleRounds < 64)
+            {
+                std::this_thread::yield();
+            }
+            else
+            {
+                // Others are blocked in slow directory reads; do not burn a core waiting for them
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        } });
+
+    size_t total = 0;
+    for (const WorkerState &state : states)
+    {
+        total += state.records.size();
+    }
+    records.reserve(total);
+    for (WorkerState &state : states)
+    {
+        records.insert(records.end(), state.records.begin(), state.records.end());
+        arena.merge(std::move(state.arena));
+    }
+
+    // The walk order depends on scheduling; keep listings and copy order reproducible
+    std::sort(records.begin(), records.end(), [](const FileRecord &a, const FileRecord &b)
+              { return a.relativePath < b.relativePath; });
+    return records;
+}
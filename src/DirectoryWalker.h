@@ -0,0 +1,42 @@
+#ifndef DIRECTORYWALKER_H
+#define DIRECTORYWALKER_H
+
+#include "FileRecord.h"
+#include "PathArena.h"
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class DirectoryWalker
+{
+public:
+    /**
+     * @brief Construct a new Directory Walker object
+     *
+     * @param root Directory to walk
+     * @param excludedNames File names that are never reported (e.g. the metafile), at any depth
+     * @param jobs Number of worker threads reading directories (0 means hardware concurrency)
+     */
+    DirectoryWalker(const std::filesystem::path &root, std::vector<std::string> excludedNames, unsigned jobs = 0)
+        : root(root), excludedNames(std::move(excludedNames)), jobs(jobs) {}
+
+    /**
+     * @brief Walk the tree and record every regular file
+     * @details Symbolic links to files are followed, symbolic links to directories are not
+     *          (the same as std::filesystem::recursive_directory_iterator).
+     *
+     * @param arena Receives the relative paths; the records point into it
+     * @return std::vector<FileRecord> Sorted by relative path
+     *
+     * @note Unreadable directories are reported on std::cerr and skipped
+     */
+    std::vector<FileRecord> scan(PathArena &arena);
+
+private:
+    std::filesystem::path root;
+    std::vector<std::string> excludedNames;
+    unsigned jobs;
+};
+
+#endif // DIRECTORYWALKER_H
@@ -0,0 +1,51 @@
+#ifndef FILEDESCRIPTOR_H
+#define FILEDESCRIPTOR_H
+
+#include <unistd.h>
+#include <utility>
+
+/**
+ * @brief Owning wrapper around a POSIX file descriptor (closed on destruction)
+ */
+class FileDescriptor
+{
+public:
+    FileDescriptor() = default;
+    explicit FileDescriptor(int fd) : fd(fd) {}
+    ~FileDescriptor() { reset(); }
+
+    FileDescriptor(const FileDescriptor &) = delete;
+    FileDescriptor &operator=(const FileDescriptor &) = delete;
+    FileDescriptor(FileDescriptor &&other) noexcept : fd(std::exchange(other.fd, -1)) {}
+    FileDescriptor &operator=(FileDescriptor &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset(std::exchange(other.fd, -1));
+        }
+        return *this;
+    }
+
+    int get() const { return fd; }                  // Get the raw descriptor
+    bool valid() const { return fd >= 0; }          // Check whether a descriptor is held
+    int release() { return std::exchange(fd, -1); } // Give up ownership without closing
+
+    /**
+     * @brief Close the held descriptor and take ownership of a new one
+     *
+     * @param newFd
+     */
+    void reset(int newFd = -1)
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        fd = newFd;
+    }
+
+private:
+    int fd = -1;
+};
+
+#endif // FILEDESCRIPTOR_H
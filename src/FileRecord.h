@@ -0,0 +1,33 @@
+#ifndef FILERECORD_H
+#define FILERECORD_H
+
+#include "Hasher.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Everything the backup needs to know about one source file
+ * @details Filled in once by the directory walk with a single statx call (Tool::statFile) and
+ *          handed from stage to stage (diff, copy, metadata), so no stage has to stat or read the
+ *          file again.
+ */
+struct FileRecord
+{
+    std::string_view relativePath;  // Path relative to the source directory (metafile key), NUL-terminated, stored in a PathArena
+    uintmax_t size = 0;             // Size in bytes at scan time
+    uintmax_t allocatedSize = 0;    // Bytes allocated on disk at scan time (below size for sparse files)
+    uint32_t mode = 0;              // File type and permission bits (st_mode)
+    int64_t creationNs = 0;         // Creation time, nanoseconds since the epoch
+    int64_t mtimeNs = 0;            // Last modification time, nanoseconds since the epoch
+    int64_t ctimeNs = 0;            // Last status change time, nanoseconds since the epoch
+    uint64_t inode = 0;             // Inode number
+    uint64_t device = 0;            // Device the file lives on
+    std::string sha256;             // Hex digest of the bytes that were copied (filled by the copy stage)
+    std::string blake3;             // Hex BLAKE3 of the same bytes when it is the change hash (empty otherwise)
+    bool copied = false;            // Set by the copy stage when the file reached the destination
+    std::vector<Sha256Digest> chunks; // Content chunks in file order (repository mode only)
+};
+
+#endif // FILERECORD_H
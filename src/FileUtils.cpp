@@ -1,49 +1,69 @@
 #include "FileUtils.h"
+#include "Hasher.h"
+#include "SparseFile.h"
 #include <iostream>
 #include <fstream>
 #include <vector>
 #include <cstring>
-#include <openssl/evp.h>
-#include <openssl/sha.h>
-#include <iomanip>
-#include <sstream>
 #include <ctime>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 /**
- * @brief Get the last time the file was modified (formatted)
+ * @brief Format a timestamp for display as "%Y-%m-%d %H:%M:%S" (local time)
+ * @details Only used when a time is shown to the user; stored and compared times stay integers.
  *
- * @param filePath
+ * @param timeNs
  * @return std::string
  */
-std::string Tool::getFileModificationTime(const std::filesystem::path &filePath)
+std::string Tool::formatTime(int64_t timeNs)
 {
-    auto ftime = std::filesystem::last_write_time(filePath);
-    auto sctp = std::chrono::time_point_cast<std::chrono::system_clock::duration>(
-        ftime - std::filesystem::file_time_type::clock::now() + std::chrono::system_clock::now());
-    std::time_t cftime = std::chrono::system_clock::to_time_t(sctp);
+    std::time_t seconds = static_cast<std::time_t>(timeNs / 1000000000);
+    struct tm localTime;
+    localtime_r(&seconds, &localTime);
     char buffer[80];
-    std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", std::localtime(&cftime));
+    std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &localTime);
     return std::string(buffer);
 }
 
+namespace
+{
+    int64_t toNs(const struct timespec &time)
+    {
+        return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+    }
+
+    /**
+     * @brief Fill a record from a struct stat (creation time is filled by the caller)
+     */
+    void fillFromStat(FileRecord &record, const struct stat &fileStat)
+    {
+#if defined(__APPLE__)
+        record.mtimeNs = toNs(fileStat.st_mtimespec);
+        record.ctimeNs = toNs(fileStat.st_ctimespec);
+#else
+        record.mtimeNs = toNs(fileStat.st_mtim);
+        record.ctimeNs = toNs(fileStat.st_ctim);
+#endif
+        record.size = static_cast<uintmax_t>(fileStat.st_size);
+        record.allocatedSize = static_cast<uintmax_t>(fileStat.st_blocks) * SparseFile::STAT_BLOCK_SIZE;
+        record.mode = static_cast<uint32_t>(fileStat.st_mode);
+        record.inode = static_cast<uint64_t>(fileStat.st_ino);
+        record.device = static_cast<uint64_t>(fileStat.st_dev);
+    }
+}
+
 /**
- * @brief Converts formatted datetime strings to timestamps of type time_t
- * @details Functions automatically handle daylight saving time (via tm_isdst = -1).
+ * @brief Fill the metadata of a record with a single stat call on a path
  *
- * @param timeStr Enter a datetime string in the format "%Y-%m-%d %H:%M:%S" (e.g. "2025-06-05 14:30:00")
- * @return time_t (Returns -1 on failure)
+ * @param filePath
+ * @param record
+ * @return true
+ * @return false
  */
-time_t Tool::stringToTimeT(const std::string &timeStr)
+bool Tool::statFile(const std::filesystem::path &filePath, FileRecord &record)
 {
-    struct tm tm = {0};
-    std::istringstream iss(timeStr);
-    iss >> std::get_time(&tm, "%Y-%m-%d %H:%M:%S");
-    if (iss.fail())
-    {
-        return -1;
-    }
-    tm.tm_isdst = -1;
-    return mktime(&tm);
+    return statFile(record, AT_FDCWD, filePath.c_str());
 }
 
 // Windows
@@ -51,62 +71,82 @@ time_t Tool::stringToTimeT(const std::string &timeStr)
 
 // Linux
 #elif defined(__linux__)
-#include <sys/stat.h>
+#include <sys/sysmacros.h>
 
 /**
- * @brief Linux system gitFileCreationTime (There is no test).
- *
- * @param filePath
- * @return std::string
+ * @brief Linux system statFile
+ * @details One statx call that asks only for the fields the backup uses. STATX_BTIME gives the
+ *          real creation time on filesystems that record it (ext4, XFS, btrfs); elsewhere st_ctime
+ *          is used as the approximate creation time. Falls back to fstatat on kernels without statx.
  *
- * @warning ext4 file system needs special handling crtime[8]
+ * @param record
+ * @param dirFd
+ * @param name
+ * @return true
+ * @return false
  */
-std::string Tool::getFileCreationTime(const std::filesystem::path &filePath)
+bool Tool::statFile(FileRecord &record, int dirFd, const char *name)
 {
-    struct stat fileStat;
-    if (stat(filePath.c_str(), &fileStat) != 0)
+#if defined(STATX_BTIME)
+    constexpr unsigned int STATX_FIELDS = STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME |
+                                          STATX_CTIME | STATX_INO | STATX_BTIME | STATX_BLOCKS;
+    struct statx fileStatx;
+    if (statx(dirFd, name, AT_STATX_SYNC_AS_STAT, STATX_FIELDS, &fileStatx) == 0)
     {
-        perror("stat");
-        return "Error";
+        auto statxNs = [](const struct statx_timestamp &time)
+        {
+            return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+        };
+        record.size = fileStatx.stx_size;
+        record.allocatedSize = (fileStatx.stx_mask & STATX_BLOCKS) ? fileStatx.stx_blocks * SparseFile::STAT_BLOCK_SIZE : record.size;
+        record.mode = fileStatx.stx_mode;
+        record.mtimeNs = statxNs(fileStatx.stx_mtime);
+        record.ctimeNs = statxNs(fileStatx.stx_ctime);
+        record.creationNs = (fileStatx.stx_mask & STATX_BTIME) ? statxNs(fileStatx.stx_btime) : record.ctimeNs;
+        record.inode = fileStatx.stx_ino;
+        record.device = makedev(fileStatx.stx_dev_major, fileStatx.stx_dev_minor);
+        return true;
+    }
+    if (errno != ENOSYS)
+    {
+        return false;
     }
+#endif
 
+    struct stat fileStat;
+    if (fstatat(dirFd, name, &fileStat, 0) != 0)
+    {
+        return false;
+    }
+    fillFromStat(record, fileStat);
     // Linux uses st_ctime (Time of State Change) as the approximate creation time
-    time_t creationTime = fileStat.st_ctime; // Note: ctime is the time when the metadata was modified, not strictly created
-    char buffer[80];
-    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", localtime(&creationTime));
-    return std::string(buffer);
-
-    // Priority is given to birthtime (macOS), Linux needs to check the file system
-    time_t time = fileStat.st_ctime; // Or custom logic to handle the crtime of ext4
-    char buffer[80];
-    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", localtime(&time));
-    return std::string(buffer);
+    record.creationNs = record.ctimeNs;
+    return true;
 }
 
 // macOS
 #elif defined(__APPLE__)
-#include <sys/stat.h>
 
 /**
- * @brief macOS system gitFileCreationTime
+ * @brief macOS system statFile
  *
- * @param filePath
- * @return std::string
+ * @param record
+ * @param dirFd
+ * @param name
+ * @return true
+ * @return false
  */
-std::string Tool::getFileCreationTime(const std::filesystem::path &filePath)
+bool Tool::statFile(FileRecord &record, int dirFd, const char *name)
 {
     struct stat fileStat;
-    if (stat(filePath.c_str(), &fileStat) != 0)
+    if (fstatat(dirFd, name, &fileStat, 0) != 0)
     {
-        perror("stat");
-        return "Error";
+        return false;
     }
-
+    fillFromStat(record, fileStat);
     // macOS uses st_birthtime to get the creation time
-    time_t creationTime = fileStat.st_birthtime;
-    char buffer[80];
-    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", localtime(&creationTime));
-    return std::string(buffer);
+    record.creationNs = toNs(fileStat.st_birthtimespec);
+    return true;
 }
 
 // Other systems
@@ -114,75 +154,57 @@ std::string Tool::getFileCreationTime(const std::filesystem::path &filePath)
 #error "Unsupported operating systems"
 #endif
 
+/**
+ * @brief Get the creation time of a file (formatted)
+ *
+ * @param filePath
+ * @return std::string "Error" if the file cannot be stat'ed
+ */
+std::string Tool::getFileCreationTime(const std::filesystem::path &filePath)
+{
+    FileRecord record;
+    if (!statFile(filePath, record))
+    {
+        perror("stat");
+        return "Error";
+    }
+    return formatTime(record.creationNs);
+}
+
 /**
  * @brief Calculate the SHA256 hash of the file
  *
  * @param file_path The path of the file to be hashed (must be absolute)
  * @return std::string A 64-character hexadecimal hash string is returned on success and an empty string is returned on failure
  *
- * @note SHA256 implementation that relies on OpenSSL library (SHA256_Init/Update/Final)
+ * @note SHA256 implementation that relies on the OpenSSL EVP API (see Hasher)
  * @warning Undefined behavior when file size exceeds 2^64 bytes (SHA256 theoretical limit)
  */
 std::string Tool::calculate_sha256(const std::string &file_path)
 {
-    std::ifstream file(file_path, std::ios::binary);
-    if (!file)
+    Sha256Digest digest;
+    if (!Hasher::hashFile(file_path, digest))
     {
         std::cerr << "Error opening file: " << file_path << std::endl;
         return "";
     }
-
-    SHA256_CTX sha256;
-    SHA256_Init(&sha256);
-
-    const int buffer_size = 1024;
-    std::vector<char> buffer(buffer_size);
-    while (file.read(buffer.data(), buffer_size))
-    {
-        SHA256_Update(&sha256, buffer.data(), file.gcount());
-    }
-
-    unsigned char hash[SHA256_DIGEST_LENGTH];
-    SHA256_Final(hash, &sha256);
-
-    std::stringstream ss;
-    for (int i = 0; i < SHA256_DIGEST_LENGTH; ++i)
-    {
-        ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(hash[i]);
-    }
-
-    return ss.str();
+    return Hasher::toHex(digest);
 }
 
 /**
- * @brief Calculate the total folder size.
- * 
- * @param fileList 
- * @return uintmax_t 
+ * @brief Calculate the total size of the files to be backed up.
+ * @details Uses the sizes captured by the directory walk, so no file is stat'ed again.
+ *
+ * @param fileList
+ * @param allocated
+ * @return uintmax_t
  */
-uintmax_t Tool::calculateFileListSize(const std::vector<std::filesystem::path> &fileList)
+uintmax_t Tool::calculateFileListSize(const std::vector<FileRecord> &fileList, bool allocated)
 {
     uintmax_t totalSize = 0;
-    for (const auto &filePath : fileList)
+    for (const auto &file : fileList)
     {
-        if (std::filesystem::exists(filePath))
-        {
-            if (std::filesystem::is_regular_file(filePath))
-            {
-                totalSize += std::filesystem::file_size(filePath);
-            }
-            else if (std::filesystem::is_directory(filePath))
-            {
-                // In the case of a directory, all file sizes under it are recursively calculated
-                for (const auto &entry : std::filesystem::recursive_directory_iterator(filePath))
-                {
-                    if (entry.is_regular_file())
-                    {
-                        totalSize += entry.file_size();
-                    }
-                }
-            }
-        }
+        totalSize += allocated && SparseFile::isSparse(file.size, file.allocatedSize) ? file.allocatedSize : file.size;
     }
 
     return totalSize;
@@ -2,6 +2,7 @@
 #ifndef FILEUTILS_H
 #define FILEUTILS_H
 
+#include "FileRecord.h"
 #include <filesystem>
 #include <string>
 #include <iostream>
@@ -9,12 +10,13 @@
 #include <chrono>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 class Tool
 {
 public:
     /**
-     * @brief Get the last time the file was modified (formatted)
+     * @brief Get the creation time of a file (formatted)
      *
      * @param filePath
      * @return std::string
@@ -25,36 +27,50 @@ public:
 
 public:
     /**
-     * @brief Converts formatted datetime strings to timestamps of type time_t
+     * @brief Format a timestamp for display as "%Y-%m-%d %H:%M:%S" (local time)
      *
-     * @param timeStr Enter a datetime string in the format "%Y-%m-%d %H:%M:%S" (e.g. "2025-06-05 14:30:00")
-     * @return time_t (Returns -1 on failure)
+     * @param timeNs Nanoseconds since the epoch
+     * @return std::string
      */
-    time_t stringToTimeT(const std::string &timeStr);
+    static std::string formatTime(int64_t timeNs);
     /**
-     * @brief Get the File Modification Time object
+     * @brief Fill the size, mode, timestamps (in nanoseconds), inode and device of a record with a single stat call
      *
      * @param filePath
-     * @return std::string
+     * @param record
+     * @return true on success, false if the file cannot be stat'ed
+     */
+    static bool statFile(const std::filesystem::path &filePath, FileRecord &record);
+    /**
+     * @brief Same as statFile(filePath, record), for a file named relative to an open directory
+     *
+     * @param record
+     * @param dirFd Directory descriptor (or AT_FDCWD)
+     * @param name Path relative to dirFd
+     * @return true on success, false if the file cannot be stat'ed
+     *
+     * @note Linux uses statx (with the real creation time where the filesystem records it)
      */
-    std::string getFileModificationTime(const std::filesystem::path &filePath);
+    static bool statFile(FileRecord &record, int dirFd, const char *name);
     /**
      * @brief Calculate the SHA256 hash of the file
      *
      * @param file_path
      * @return std::string
      *
-     * @note SHA256 implementation that relies on OpenSSL library (SHA256_Init/Update/Final)
+     * @note SHA256 implementation that relies on the OpenSSL EVP API (see Hasher)
      */
     std::string calculate_sha256(const std::string &file_path);
 
     /**
-     * @brief Calculate the total folder size.
+     * @brief Calculate the total size of the files to be backed up.
      *
      * @param fileList
+     * @param allocated Count sparse files by their allocated bytes, which is all a copy moves
+     *                  (the chunk repository reads every logical byte)
      * @return uintmax_t
      */
-    uintmax_t calculateFileListSize(const std::vector<std::filesystem::path> &fileList);
+    uintmax_t calculateFileListSize(const std::vector<FileRecord> &fileList, bool allocated = true);
 
     /**
      * @brief Displays the percentage of copies.
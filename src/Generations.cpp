@@ -0,0 +1,134 @@
+#include "Generations.h"
+#include "Trace.h"
+#include "WorkerPool.h"
+#include <ctime>
+#include <iostream>
+#include <mutex>
+
+/**
+ * @brief Whether a backup directory holds generations
+ *
+ * @param backupDir
+ * @return true
+ * @return false
+ */
+bool Generations::isGenerational(const std::filesystem::path &backupDir)
+{
+    std::error_code error;
+    return std::filesystem::is_symlink(backupDir / LATEST_NAME, error);
+}
+
+/**
+ * @brief Find the previous generation and choose the name of the new one (nothing is created yet)
+ *
+ * @param backupDir
+ * @param timeNs
+ */
+void Generations::open(const std::filesystem::path &backupDir, int64_t timeNs)
+{
+    this->backupDir = backupDir;
+    linkedCount = 0;
+    copiedCount = 0;
+
+    std::error_code error;
+    std::filesystem::path latest = std::filesystem::read_symlink(backupDir / LATEST_NAME, error);
+    previousName.clear();
+    if (!error && std::filesystem::is_directory(backupDir / latest.filename(), error))
+    {
+        previousName = latest.filename().string();
+    }
+
+    // Names sort in time order; two runs within the same second get a suffix
+    std::time_t seconds = static_cast<std::time_t>(timeNs / 1000000000);
+    struct tm localTime;
+    localtime_r(&seconds, &localTime);
+    char buffer[32];
+    std::strftime(buffer, sizeof(buffer), "%Y%m%d-%H%M%S", &localTime);
+    name = buffer;
+    for (int suffix = 2; std::filesystem::exists(backupDir / name, error) || name == previousName; ++suffix)
+    {
+        name = std::string(buffer) + "-" + std::to_string(suffix);
+    }
+}
+
+/**
+ * @brief Hard link the files of the source that the new generation does not have yet from the previous one
+ *
+ * @param paths
+ * @param jobs
+ * @return true
+ * @return false
+ */
+bool Generations::linkUnchanged(const std::vector<std::string_view> &paths, unsigned jobs)
+{
+    std::filesystem::path current = getDirectory();
+    std::error_code error;
+    std::filesystem::create_directories(current, error);
+    if (error)
+    {
+        std::cerr << "Failed to create the generation " << current << ": " << error.message() << std::endl;
+        return false;
+    }
+    if (previousName.empty())
+    {
+        return true;
+    }
+
+    TraceSpan span("generations", "link unchanged", current.native());
+    std::filesystem::path previous = getPreviousDirectory();
+    std::mutex errorMutex;
+    bool complete = true;
+    WorkerPool(jobs).forEach(paths.size(), [&](size_t index, unsigned)
+    {
+        std::filesystem::path source = previous / paths[index];
+        std::filesystem::path destination = current / paths[index];
+        std::error_code error;
+        if (std::filesystem::exists(destination, error))
+        {
+            return; // Copied by this run
+        }
+        if (!std::filesystem::is_regular_file(source, error))
+        {
+            return; // New in this run and not copied; it is retried next time
+        }
+        std::filesystem::create_directories(destination.parent_path(), error);
+        std::filesystem::create_hard_link(source, destination, error);
+        if (!error)
+        {
+            linkedCount++;
+            return;
+        }
+        if (std::filesystem::copy_file(source, destination, error))
+        {
+            copiedCount++;
+            return;
+        }
+        std::lock_guard<std::mutex> lock(errorMutex);
+        std::cerr << "[Link failed]: " << destination << ": " << error.message() << "\n";
+        complete = false;
+    });
+    return complete;
+}
+
+/**
+ * @brief Point "latest" at the new generation
+ * @details The new link is created next to the old one and renamed over it, so "latest" always
+ *          names a complete generation.
+ *
+ * @return true
+ * @return false
+ */
+bool Generations::publish() const
+{
+    std::filesystem::path latest = backupDir / LATEST_NAME;
+    std::filesystem::path temporary = latest;
+    temporary += ".tmp";
+    std::error_code error;
+    std::filesystem::remove(temporary, error);
+    std::filesystem::create_directory_symlink(name, temporary, error);
+    if (!error)
+    {
+        std::filesystem::rename(temporary, latest, error);
+    }
+    return !error;
+}
@@ -0,0 +1,79 @@
+#ifndef GENERATIONS_H
+#define GENERATIONS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Point-in-time snapshots of a backup directory, one subdirectory per run
+ * @details Layout under the backup directory:
+ *          <YYYYMMDD-HHMMSS>/  one complete copy of the source per run
+ *          latest              symbolic link to the newest complete generation
+ *          A run copies the files it backs up into a new generation and then hard links every
+ *          other file the source still has from the previous one (like `rsync --link-dest`), so
+ *          each generation is a full view of the source at the time of its run while only the
+ *          changed files take time and space. Files deleted from the source are left behind in
+ *          the older generations. Files of a generation are never written again: changed files
+ *          are copied first, into a directory that holds no links yet.
+ */
+class Generations
+{
+public:
+    static constexpr const char *LATEST_NAME = "latest";
+
+    /**
+     * @brief Whether a backup directory holds generations
+     *
+     * @param backupDir
+     * @return true
+     * @return false
+     */
+    static bool isGenerational(const std::filesystem::path &backupDir);
+
+    /**
+     * @brief Find the previous generation and choose the name of the new one (nothing is created yet)
+     *
+     * @param backupDir
+     * @param timeNs Start of the run, the new generation is named after it
+     */
+    void open(const std::filesystem::path &backupDir, int64_t timeNs);
+
+    /**
+     * @brief Hard link the files of the source that the new generation does not have yet from the previous one
+     * @details A file that cannot be linked (another file system, link count limit, ...) is copied.
+     *          Files the previous generation does not have either are skipped.
+     *
+     * @param paths Relative paths of every file the source has in this run
+     * @param jobs Number of worker threads
+     * @return true on success, false when some file could neither be linked nor copied
+     */
+    bool linkUnchanged(const std::vector<std::string_view> &paths, unsigned jobs);
+
+    /**
+     * @brief Point "latest" at the new generation
+     *
+     * @return true on success, false when the link cannot be replaced
+     */
+    bool publish() const;
+
+    const std::string &getName() const { return name; }                      // Get the name of the new generation
+    const std::string &getPreviousName() const { return previousName; }      // Get the name of the previous generation (empty if none)
+    std::filesystem::path getDirectory() const { return backupDir / name; }  // Get the directory of the new generation
+    std::filesystem::path getPreviousDirectory() const { return previousName.empty() ? std::filesystem::path() : backupDir / previousName; } // Get the directory of the previous generation (empty if none)
+    uint64_t getLinkedCount() const { return linkedCount; }                  // Get the number of files linked from the previous generation
+    uint64_t getCopiedCount() const { return copiedCount; }                  // Get the number of files copied because they could not be linked
+
+private:
+    std::filesystem::path backupDir;
+    std::string name;
+    std::string previousName;
+    std::atomic<uint64_t> linkedCount{0};
+    std::atomic<uint64_t> copiedCount{0};
+};
+
+#endif // GENERATIONS_H
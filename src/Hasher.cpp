@@ -0,0 +1,593 @@
+#include "Hasher.h"
+#include "FileDescriptor.h"
+#include "SparseFile.h"
+#include "Trace.h"
+#include "UringEngine.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <memory>
+#include <new>
+#include <openssl/evp.h>
+#include <sys/stat.h>
+
+namespace
+{
+    struct AlignedFree
+    {
+        void operator()(unsigned char *buffer) const { std::free(buffer); }
+    };
+
+    int hexValue(char c)
+    {
+        if (c >= '0' && c <= '9')
+        {
+            return c - '0';
+        }
+        if (c >= 'a' && c <= 'f')
+        {
+            return c - 'a' + 10;
+        }
+        if (c >= 'A' && c <= 'F')
+        {
+            return c - 'A' + 10;
+        }
+        return -1;
+    }
+
+    /**
+     * @brief Read until size bytes are in buffer or the end of the file is reached
+     *
+     * @return ssize_t Bytes read, -1 on a read error
+     */
+    ssize_t readUpTo(int fd, unsigned char *buffer, size_t size)
+    {
+        size_t total = 0;
+        while (total < size)
+        {
+            ssize_t readBytes = ::read(fd, buffer + total, size - total);
+            if (readBytes < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return -1;
+            }
+            if (readBytes == 0)
+            {
+                break;
+            }
+            total += static_cast<size_t>(readBytes);
+        }
+        return static_cast<ssize_t>(total);
+    }
+}
+
+Sha256::Sha256() : context(EVP_MD_CTX_new())
+{
+    if (context == nullptr || EVP_DigestInit_ex(context, EVP_sha256(), nullptr) != 1)
+    {
+        EVP_MD_CTX_free(context);
+        throw std::bad_alloc();
+    }
+}
+
+Sha256::~Sha256()
+{
+    EVP_MD_CTX_free(context);
+}
+
+void Sha256::update(const void *data, size_t size)
+{
+    EVP_DigestUpdate(context, data, size);
+}
+
+Sha256Digest Sha256::finish()
+{
+    Sha256Digest digest{};
+    unsigned int length = 0;
+    EVP_DigestFinal_ex(context, digest.data(), &length);
+    reset();
+    return digest;
+}
+
+void Sha256::reset()
+{
+    EVP_DigestInit_ex(context, EVP_sha256(), nullptr);
+}
+
+void ContentHasher::reset(unsigned hashes)
+{
+    this->hashes = hashes;
+    sha256.reset();
+    blake3.reset();
+}
+
+void ContentHasher::update(const void *data, size_t size)
+{
+    if (hashes & Hasher::SHA256)
+    {
+        sha256.update(data, size);
+    }
+    if (hashes & Hasher::BLAKE3)
+    {
+        blake3.update(data, size);
+    }
+}
+
+void ContentHasher::updateZeros(uint64_t length)
+{
+    static constexpr unsigned char ZEROS[64 * 1024] = {};
+    while (length > 0)
+    {
+        size_t size = static_cast<size_t>(std::min<uint64_t>(length, sizeof(ZEROS)));
+        update(ZEROS, size);
+        length -= size;
+    }
+}
+
+FileDigest ContentHasher::finish()
+{
+    FileDigest digest;
+    digest.hashes = hashes;
+    if (hashes & Hasher::SHA256)
+    {
+        digest.sha256 = sha256.finish();
+    }
+    if (hashes & Hasher::BLAKE3)
+    {
+        digest.blake3 = blake3.finish();
+    }
+    return digest;
+}
+
+/**
+ * @brief Get the calling thread's aligned read buffer
+ * @details Allocated once per thread, so hashing many small files does not churn the allocator.
+ *
+ * @return unsigned char*
+ */
+unsigned char *Hasher::threadBuffer()
+{
+    thread_local std::unique_ptr<unsigned char, AlignedFree> buffer(
+        static_cast<unsigned char *>(std::aligned_alloc(BUFFER_ALIGNMENT, BUFFER_SIZE)));
+    if (!buffer)
+    {
+        throw std::bad_alloc();
+    }
+    return buffer.get();
+}
+
+/**
+ * @brief Calculate the SHA256 digest of a file
+ *
+ * @param filePath
+ * @param digest
+ * @return true
+ * @return false
+ */
+bool Hasher::hashFile(const std::filesystem::path &filePath, Sha256Digest &digest)
+{
+    FileDigest digests;
+    if (!hashFile(filePath, digests, SHA256))
+    {
+        return false;
+    }
+    digest = digests.sha256;
+    return true;
+}
+
+/**
+ * @brief Calculate several digests of a file in one pass
+ * @details Reads the whole file (including the final partial block) in 1 MiB chunks and tells
+ *          the kernel the access is sequential so read-ahead is as aggressive as possible.
+ *
+ * @param filePath
+ * @param digest
+ * @param hashes
+ * @return true
+ * @return false
+ */
+bool Hasher::hashFile(const std::filesystem::path &filePath, FileDigest &digest, unsigned hashes)
+{
+    FileDescriptor file(::open(filePath.c_str(), O_RDONLY | O_CLOEXEC));
+    if (!file.valid())
+    {
+        return false;
+    }
+#if defined(POSIX_FADV_SEQUENTIAL)
+    ::posix_fadvise(file.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    return hashDescriptor(file.get(), digest, hashes);
+}
+
+/**
+ * @brief Calculate the SHA256 digest of an open file from its current offset to the end
+ *
+ * @param fd
+ * @param digest
+ * @return true
+ * @return false
+ */
+bool Hasher::hashDescriptor(int fd, Sha256Digest &digest)
+{
+    FileDigest digests;
+    if (!hashDescriptor(fd, digests, SHA256))
+    {
+        return false;
+    }
+    digest = digests.sha256;
+    return true;
+}
+
+/**
+ * @brief Calculate several digests of an open file in one pass, from its current offset to the end
+ *
+ * @param fd
+ * @param digest
+ * @param hashes
+ * @return true
+ * @return false
+ */
+bool Hasher::hashDescriptor(int fd, FileDigest &digest, unsigned hashes)
+{
+    thread_local ContentHasher hasher;
+    hasher.reset(hashes);
+
+    struct stat status;
+    off_t offset = ::lseek(fd, 0, SEEK_CUR);
+    if (offset >= 0 && ::fstat(fd, &status) == 0 && S_ISREG(status.st_mode) &&
+        SparseFile::isSparse(static_cast<uint64_t>(status.st_size),
+                             static_cast<uint64_t>(status.st_blocks) * SparseFile::STAT_BLOCK_SIZE))
+    {
+        if (!hashExtents(fd, static_cast<uint64_t>(offset), static_cast<uint64_t>(status.st_size), hasher))
+        {
+            return false;
+        }
+        digest = hasher.finish();
+        return true;
+    }
+
+    unsigned char *buffer = threadBuffer();
+    for (;;)
+    {
+        ssize_t readBytes = ::read(fd, buffer, BUFFER_SIZE);
+        if (readBytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        if (readBytes == 0)
+        {
+            break;
+        }
+        hasher.update(buffer, static_cast<size_t>(readBytes));
+    }
+
+    digest = hasher.finish();
+    return true;
+}
+
+/**
+ * @brief Feed a file to a hasher from offset to its end, reading only its data extents
+ *
+ * @param fd
+ * @param offset
+ * @param size
+ * @param hasher
+ * @return true
+ * @return false
+ */
+bool Hasher::hashExtents(int fd, uint64_t offset, uint64_t size, ContentHasher &hasher)
+{
+    unsigned char *buffer = threadBuffer();
+    SparseFile::Extent extent;
+    while (SparseFile::nextData(fd, offset, size, extent))
+    {
+        hasher.updateZeros(extent.offset - offset);
+        offset = extent.offset;
+        uint64_t end = extent.offset + extent.length;
+        while (offset < end)
+        {
+            size_t request = static_cast<size_t>(std::min<uint64_t>(end - offset, BUFFER_SIZE));
+            ssize_t readBytes = ::pread(fd, buffer, request, static_cast<off_t>(offset));
+            if (readBytes < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            if (readBytes == 0)
+            {
+                return true; // The file shrank while it was read
+            }
+            hasher.update(buffer, static_cast<size_t>(readBytes));
+            offset += static_cast<uint64_t>(readBytes);
+        }
+    }
+    if (offset < size)
+    {
+        hasher.updateZeros(size - offset);
+    }
+    return true;
+}
+
+/**
+ * @brief Format bytes as lowercase hexadecimal
+ *
+ * @param data
+ * @param size
+ * @return std::string
+ */
+std::string Hasher::toHex(const unsigned char *data, size_t size)
+{
+    static constexpr char HEX_DIGITS[] = "0123456789abcdef";
+    std::string hex(size * 2, '\0');
+    for (size_t i = 0; i < size; ++i)
+    {
+        hex[2 * i] = HEX_DIGITS[data[i] >> 4];
+        hex[2 * i + 1] = HEX_DIGITS[data[i] & 0x0f];
+    }
+    return hex;
+}
+
+/**
+ * @brief Parse a 64-character hexadecimal string
+ *
+ * @param hex
+ * @param digest
+ * @return true
+ * @return false
+ */
+bool Hasher::fromHex(const std::string &hex, Sha256Digest &digest)
+{
+    if (hex.size() != digest.size() * 2)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < digest.size(); ++i)
+    {
+        int high = hexValue(hex[2 * i]);
+        int low = hexValue(hex[2 * i + 1]);
+        if (high < 0 || low < 0)
+        {
+            return false;
+        }
+        digest[i] = static_cast<unsigned char>((high << 4) | low);
+    }
+    return true;
+}
+
+/**
+ * @brief Parse a change hash name
+ *
+ * @param name
+ * @param changeHash
+ * @return true
+ * @return false
+ */
+bool Hasher::parseChangeHash(const std::string &name, ChangeHash &changeHash)
+{
+    if (name == "sha256")
+    {
+        changeHash = ChangeHash::Sha256;
+        return true;
+    }
+    if (name == "blake3")
+    {
+        changeHash = ChangeHash::Blake3;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Get the name of a change hash
+ *
+ * @param changeHash
+ * @return const char*
+ */
+const char *Hasher::changeHashName(ChangeHash changeHash)
+{
+    return changeHash == ChangeHash::Blake3 ? "blake3" : "sha256";
+}
+
+/**
+ * @brief Calculate the SHA256 of every file in parallel
+ *
+ * @param files
+ * @return std::vector<std::string>
+ */
+std::vector<std::string> HashPool::hashFiles(const std::vector<std::filesystem::path> &files)
+{
+    std::vector<FileDigest> digests = digestFiles(files, Hasher::SHA256);
+    std::vector<std::string> hexDigests(digests.size());
+    for (size_t i = 0; i < digests.size(); ++i)
+    {
+        if (digests[i].hashes != 0)
+        {
+            hexDigests[i] = Hasher::toHex(digests[i].sha256);
+        }
+    }
+    return hexDigests;
+}
+
+/**
+ * @brief Calculate several digests of every file in parallel, reading each file once
+ * @details Without io_uring each worker takes GROUP_SIZE files at a time and reads them into its
+ *          buffer, one SMALL_FILE_SIZE slot per file. The SHA-256 of the files that fit in their
+ *          slot is computed together at the end of the group; a larger file is streamed through
+ *          the buffer right away, after the files read before it have been hashed.
+ *
+ *          With io_uring the files are dealt out to the workers and each worker keeps a batch of
+ *          them in flight on its own ring instead of reading one file at a time.
+ *
+ * @param files
+ * @param hashes
+ * @return std::vector<FileDigest>
+ */
+std::vector<FileDigest> HashPool::digestFiles(const std::vector<std::filesystem::path> &files, unsigned hashes)
+{
+    std::vector<FileDigest> digests(files.size());
+    std::vector<LatencyHistogram> latencies(pool.size());
+    auto hashOne = [&](size_t index, unsigned worker)
+    {
+        TraceSpan span("hash", "hash file", files[index].native());
+        auto start = std::chrono::steady_clock::now();
+        FileDigest digest;
+        if (Hasher::hashFile(files[index], digest, hashes))
+        {
+            digests[index] = digest;
+        }
+        latencies[worker].record(std::chrono::steady_clock::now() - start);
+    };
+
+    auto hashGroup = [&](size_t group, unsigned worker)
+    {
+        unsigned char *buffer = Hasher::threadBuffer();
+        thread_local ContentHasher hasher;
+        std::array<size_t, GROUP_SIZE> indices;
+        std::array<const unsigned char *, GROUP_SIZE> messages;
+        std::array<size_t, GROUP_SIZE> sizes;
+        std::array<std::chrono::steady_clock::time_point, GROUP_SIZE> started;
+        size_t pending = 0;
+
+        // Hash the small files read so far, which frees the whole buffer
+        auto hashPending = [&]
+        {
+            if (pending == 0)
+            {
+                return;
+            }
+            TraceSpan span("hash", "hash small files");
+            std::array<Sha256Digest, GROUP_SIZE> sha256;
+            if (hashes & Hasher::SHA256)
+            {
+                Sha256Batch::hash(messages.data(), sizes.data(), pending, sha256.data());
+            }
+            for (size_t i = 0; i < pending; ++i)
+            {
+                hasher.reset(hashes & ~Hasher::SHA256);
+                hasher.update(messages[i], sizes[i]);
+                FileDigest &digest = digests[indices[i]];
+                digest = hasher.finish();
+                digest.sha256 = sha256[i];
+                digest.hashes = hashes;
+                latencies[worker].record(std::chrono::steady_clock::now() - started[i]);
+            }
+            pending = 0;
+        };
+
+        for (size_t index = group * GROUP_SIZE; index < std::min(files.size(), (group + 1) * GROUP_SIZE); ++index)
+        {
+            TraceSpan span("hash", "hash file", files[index].native());
+            auto start = std::chrono::steady_clock::now();
+            FileDescriptor file(::open(files[index].c_str(), O_RDONLY | O_CLOEXEC));
+            unsigned char *slot = buffer + pending * SMALL_FILE_SIZE;
+            ssize_t size = file.valid() ? readUpTo(file.get(), slot, SMALL_FILE_SIZE) : -1;
+            if (size < 0)
+            {
+                latencies[worker].record(std::chrono::steady_clock::now() - start);
+                continue;
+            }
+            if (static_cast<size_t>(size) < SMALL_FILE_SIZE)
+            {
+                indices[pending] = index;
+                messages[pending] = slot;
+                sizes[pending] = static_cast<size_t>(size);
+                started[pending] = start;
+                pending++;
+                continue;
+            }
+
+            hashPending();
+            hasher.reset(hashes);
+            hasher.update(slot, static_cast<size_t>(size));
+            struct stat status;
+            if (::fstat(file.get(), &status) == 0 &&
+                SparseFile::isSparse(static_cast<uint64_t>(status.st_size),
+                                     static_cast<uint64_t>(status.st_blocks) * SparseFile::STAT_BLOCK_SIZE))
+            {
+                // Holes are fed as zero runs instead of being read
+                if (Hasher::hashExtents(file.get(), SMALL_FILE_SIZE, static_cast<uint64_t>(status.st_size), hasher))
+                {
+                    digests[index] = hasher.finish();
+                }
+                latencies[worker].record(std::chrono::steady_clock::now() - start);
+                continue;
+            }
+#if defined(POSIX_FADV_SEQUENTIAL)
+            ::posix_fadvise(file.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+            for (;;)
+            {
+                size = readUpTo(file.get(), buffer, Hasher::BUFFER_SIZE);
+                if (size <= 0)
+                {
+                    break;
+                }
+                hasher.update(buffer, static_cast<size_t>(size));
+            }
+            if (size == 0)
+            {
+                digests[index] = hasher.finish();
+            }
+            latencies[worker].record(std::chrono::steady_clock::now() - start);
+        }
+        hashPending();
+    };
+
+    if (useIoUring && IoUring::available())
+    {
+        // Batch b holds every batches-th file, starting at b
+        unsigned batches = static_cast<unsigned>(std::min<size_t>(pool.size(), files.size()));
+        pool.forEach(batches, [&](size_t batch, unsigned worker)
+                     {
+            size_t count = (files.size() - batch + batches - 1) / batches;
+            TraceSpan span("hash", "hash batch");
+            UringEngine engine(UringEngine::depthPerWorker(batches), hashes);
+            if (!engine.valid())
+            {
+                for (size_t position = 0; position < count; ++position)
+                {
+                    hashOne(batch + position * batches, worker);
+                }
+                return;
+            }
+            std::vector<std::chrono::steady_clock::time_point> started(count);
+            engine.run(
+                count,
+                [&](size_t position, UringFile &job)
+                {
+                    started[position] = std::chrono::steady_clock::now();
+                    job.source = files[batch + position * batches];
+                    return true;
+                },
+                [&](size_t position, const UringResult &result)
+                {
+                    latencies[worker].record(std::chrono::steady_clock::now() - started[position]);
+                    if (result.ok)
+                    {
+                        digests[batch + position * batches] = result.digest;
+                    }
+                }); });
+    }
+    else
+    {
+        pool.forEach((files.size() + GROUP_SIZE - 1) / GROUP_SIZE, hashGroup);
+    }
+
+    latency = {};
+    for (const auto &workerLatency : latencies)
+    {
+        latency.merge(workerLatency);
+    }
+    return digests;
+}
@@ -0,0 +1,265 @@
+#ifndef HASHER_H
+#define HASHER_H
+
+#include "Blake3.h"
+#include "LatencyHistogram.h"
+#include "Sha256Batch.h"
+#include "WorkerPool.h"
+#include <array>
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+typedef struct evp_md_ctx_st EVP_MD_CTX;
+
+struct FileDigest;
+
+/**
+ * @brief Hash used to detect whether a file's content changed since the last backup
+ */
+enum class ChangeHash
+{
+    Sha256, // Compare the integrity digest (metafiles written before the fast hash existed)
+    Blake3  // Compare a BLAKE3 digest, several times faster to compute (default)
+};
+
+/**
+ * @brief Incremental SHA-256 on the OpenSSL EVP API
+ */
+class Sha256
+{
+public:
+    Sha256();
+    ~Sha256();
+    Sha256(const Sha256 &) = delete;
+    Sha256 &operator=(const Sha256 &) = delete;
+
+    /**
+     * @brief Feed more bytes into the digest
+     *
+     * @param data
+     * @param size
+     */
+    void update(const void *data, size_t size);
+
+    /**
+     * @brief Finish the digest and reset the context for the next message
+     *
+     * @return Sha256Digest
+     */
+    Sha256Digest finish();
+
+    /**
+     * @brief Discard any bytes fed so far
+     *
+     */
+    void reset();
+
+private:
+    EVP_MD_CTX *context;
+};
+
+class ContentHasher;
+
+class Hasher
+{
+public:
+    static constexpr size_t BUFFER_SIZE = 1 << 20;  // 1 MiB read size
+    static constexpr size_t BUFFER_ALIGNMENT = 4096; // Page aligned so the kernel can copy whole pages
+
+    // Digests to compute while a file is read (bit set)
+    static constexpr unsigned SHA256 = 1 << 0; // Integrity digest stored in the metafile
+    static constexpr unsigned BLAKE3 = 1 << 1; // Change detection digest (ChangeHash::Blake3)
+
+    /**
+     * @brief Calculate the SHA256 digest of a file
+     *
+     * @param filePath
+     * @param digest Receives the raw 32-byte digest
+     * @return true on success, false when the file cannot be opened or read
+     */
+    static bool hashFile(const std::filesystem::path &filePath, Sha256Digest &digest);
+
+    /**
+     * @brief Calculate the SHA256 digest of an open file from its current offset to the end
+     *
+     * @param fd
+     * @param digest Receives the raw 32-byte digest
+     * @return true on success, false on a read error (errno is preserved)
+     */
+    static bool hashDescriptor(int fd, Sha256Digest &digest);
+
+    /**
+     * @brief Calculate several digests of an open file in one pass, from its current offset to the end
+     *
+     * @param fd
+     * @param digest Receives the digests
+     * @param hashes Hasher::SHA256 and/or Hasher::BLAKE3
+     * @return true on success, false on a read error (errno is preserved)
+     */
+    static bool hashDescriptor(int fd, FileDigest &digest, unsigned hashes);
+
+    /**
+     * @brief Feed a file to a hasher from offset to its end, reading only its data extents
+     * @details Holes are fed as runs of zeros without being read (see SparseFile).
+     *
+     * @param fd Read with pread; its file offset is moved by the extent lookups
+     * @param offset First byte to feed
+     * @param size Logical size of the file
+     * @param hasher
+     * @return true on success, false on a read error (errno is preserved)
+     */
+    static bool hashExtents(int fd, uint64_t offset, uint64_t size, ContentHasher &hasher);
+
+    /**
+     * @brief Calculate several digests of a file in one pass
+     *
+     * @param filePath
+     * @param digest Receives the digests
+     * @param hashes Hasher::SHA256 and/or Hasher::BLAKE3
+     * @return true on success, false when the file cannot be opened or read
+     */
+    static bool hashFile(const std::filesystem::path &filePath, FileDigest &digest, unsigned hashes);
+
+    /**
+     * @brief Format bytes as lowercase hexadecimal
+     *
+     * @param data
+     * @param size
+     * @return std::string
+     */
+    static std::string toHex(const unsigned char *data, size_t size);
+    static std::string toHex(const Sha256Digest &digest) { return toHex(digest.data(), digest.size()); }
+
+    /**
+     * @brief Parse a 64-character hexadecimal string
+     *
+     * @param hex
+     * @param digest
+     * @return true if hex was a well-formed digest
+     */
+    static bool fromHex(const std::string &hex, Sha256Digest &digest);
+
+    /**
+     * @brief Get the calling thread's aligned read buffer (BUFFER_SIZE bytes)
+     *
+     * @return unsigned char*
+     */
+    static unsigned char *threadBuffer();
+
+    /**
+     * @brief Parse a change hash name ("sha256" or "blake3")
+     *
+     * @param name
+     * @param changeHash
+     * @return true if name is known
+     */
+    static bool parseChangeHash(const std::string &name, ChangeHash &changeHash);
+
+    static const char *changeHashName(ChangeHash changeHash); // Get the name of a change hash
+
+    /**
+     * @brief Get the digests a copy has to compute for a change hash
+     *
+     * @param changeHash
+     * @return unsigned SHA256, plus BLAKE3 when it is the change hash
+     */
+    static unsigned copyHashes(ChangeHash changeHash) { return changeHash == ChangeHash::Blake3 ? SHA256 | BLAKE3 : SHA256; }
+};
+
+/**
+ * @brief Digests of the same bytes; hashes tells which of them were computed
+ */
+struct FileDigest
+{
+    Sha256Digest sha256{};
+    Blake3Digest blake3{};
+    unsigned hashes = 0;
+};
+
+/**
+ * @brief SHA-256 and/or BLAKE3 of the same bytes, fed once
+ */
+class ContentHasher
+{
+public:
+    explicit ContentHasher(unsigned hashes = Hasher::SHA256) : hashes(hashes) {}
+
+    /**
+     * @brief Choose the digests for the next message (discards any bytes fed so far)
+     *
+     * @param hashes Hasher::SHA256 and/or Hasher::BLAKE3
+     */
+    void reset(unsigned hashes);
+    void reset() { reset(hashes); } // Discard any bytes fed so far
+
+    /**
+     * @brief Feed more bytes into the digests
+     *
+     * @param data
+     * @param size
+     */
+    void update(const void *data, size_t size);
+
+    /**
+     * @brief Feed a run of zero bytes into the digests (a hole of a sparse file)
+     *
+     * @param length
+     */
+    void updateZeros(uint64_t length);
+
+    /**
+     * @brief Finish the digests and reset for the next message
+     *
+     * @return FileDigest
+     */
+    FileDigest finish();
+
+private:
+    unsigned hashes;
+    Sha256 sha256;
+    Blake3 blake3;
+};
+
+class HashPool
+{
+public:
+    static constexpr size_t GROUP_SIZE = 16;                                    // Files a worker reads before hashing the small ones together
+    static constexpr size_t SMALL_FILE_SIZE = Hasher::BUFFER_SIZE / GROUP_SIZE; // Larger files are hashed as they stream in
+
+    /**
+     * @brief Construct a new Hash Pool object
+     *
+     * @param jobs Number of files hashed concurrently (0 means hardware concurrency)
+     * @param useIoUring Read small files in batches through io_uring (falls back to the workers when unavailable)
+     */
+    explicit HashPool(unsigned jobs = 0, bool useIoUring = false) : pool(jobs), useIoUring(useIoUring) {}
+
+    /**
+     * @brief Calculate the SHA256 of every file in parallel
+     *
+     * @param files
+     * @return std::vector<std::string> Hex digests in the same order as files (empty string on failure)
+     */
+    std::vector<std::string> hashFiles(const std::vector<std::filesystem::path> &files);
+
+    /**
+     * @brief Calculate several digests of every file in parallel, reading each file once
+     * @details The SHA-256 of small files is computed several files at a time (Sha256Batch).
+     *
+     * @param files
+     * @param hashes Hasher::SHA256 and/or Hasher::BLAKE3
+     * @return std::vector<FileDigest> In the same order as files (hashes is 0 on failure)
+     */
+    std::vector<FileDigest> digestFiles(const std::vector<std::filesystem::path> &files, unsigned hashes);
+
+    const LatencyHistogram &getLatency() const { return latency; } // Get the time each file of the last hashFiles() took
+
+private:
+    WorkerPool pool;
+    bool useIoUring;
+    LatencyHistogram latency;
+};
+
+#endif // HASHER_H
@@ -0,0 +1,242 @@
+#include "IoUring.h"
+#include <cerrno>
+#include <cstring>
+#include <initializer_list>
+
+#ifdef BACKUP_HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace
+{
+    int ioUringSetup(unsigned entries, io_uring_params *params)
+    {
+        return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+    {
+        return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+    }
+
+    int ioUringRegister(int fd, unsigned opcode, const void *arg, unsigned count)
+    {
+        return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, count));
+    }
+}
+
+/**
+ * @brief Create a ring and map its queues
+ *
+ * @param entries
+ */
+IoUring::IoUring(unsigned entries)
+{
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    int fd = ioUringSetup(entries, &params);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap)
+    {
+        sqRingSize = cqRingSize = sqRingSize > cqRingSize ? sqRingSize : cqRingSize;
+    }
+
+    sqRing = ::mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED)
+    {
+        sqRing = nullptr;
+        ::close(fd);
+        return;
+    }
+    if (singleMap)
+    {
+        cqRing = sqRing;
+    }
+    else
+    {
+        cqRing = ::mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED)
+        {
+            cqRing = nullptr;
+            ::munmap(sqRing, sqRingSize);
+            sqRing = nullptr;
+            ::close(fd);
+            return;
+        }
+    }
+
+    sqeMemorySize = params.sq_entries * sizeof(io_uring_sqe);
+    sqeMemory = ::mmap(nullptr, sqeMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqeMemory == MAP_FAILED)
+    {
+        sqeMemory = nullptr;
+        if (cqRing != sqRing)
+        {
+            ::munmap(cqRing, cqRingSize);
+        }
+        ::munmap(sqRing, sqRingSize);
+        sqRing = cqRing = nullptr;
+        ::close(fd);
+        return;
+    }
+
+    char *sq = static_cast<char *>(sqRing);
+    sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sqEntries = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_entries);
+    sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    sqes = static_cast<io_uring_sqe *>(sqeMemory);
+    sqPendingTail = *sqTail;
+
+    char *cq = static_cast<char *>(cqRing);
+    cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    ringFd = fd;
+}
+
+IoUring::~IoUring()
+{
+    if (ringFd < 0)
+    {
+        return;
+    }
+    ::munmap(sqeMemory, sqeMemorySize);
+    if (cqRing != sqRing)
+    {
+        ::munmap(cqRing, cqRingSize);
+    }
+    ::munmap(sqRing, sqRingSize);
+    ::close(ringFd);
+}
+
+/**
+ * @brief Check once whether this kernel supports the operations the backup needs
+ * @details IORING_REGISTER_PROBE (5.6) is also the release that added openat, close, read and
+ *          write, so a kernel that cannot answer the probe is treated as unsupported.
+ *
+ * @return true
+ * @return false
+ */
+bool IoUring::available()
+{
+    static const bool supported = []
+    {
+        IoUring ring(1);
+        if (!ring.valid())
+        {
+            return false;
+        }
+
+        constexpr unsigned PROBE_OPS = 256;
+        alignas(io_uring_probe) unsigned char storage[sizeof(io_uring_probe) + PROBE_OPS * sizeof(io_uring_probe_op)] = {};
+        auto *probe = reinterpret_cast<io_uring_probe *>(storage);
+        if (ioUringRegister(ring.ringFd, IORING_REGISTER_PROBE, probe, PROBE_OPS) < 0)
+        {
+            return false;
+        }
+        for (unsigned op : {IORING_OP_OPENAT, IORING_OP_CLOSE, IORING_OP_READ, IORING_OP_WRITE,
+                            IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED})
+        {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+            {
+                return false;
+            }
+        }
+        return true;
+    }();
+    return supported;
+}
+
+/**
+ * @brief Get a cleared submission entry to fill in
+ *
+ * @return io_uring_sqe*
+ */
+io_uring_sqe *IoUring::getSqe()
+{
+    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (sqPendingTail - head >= sqEntries)
+    {
+        return nullptr;
+    }
+    unsigned index = sqPendingTail & sqMask;
+    io_uring_sqe *sqe = &sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+    sqPendingTail++;
+    return sqe;
+}
+
+/**
+ * @brief Submit every prepared entry and wait for completions
+ *
+ * @param waitCount
+ * @return int
+ */
+int IoUring::submitAndWait(unsigned waitCount)
+{
+    __atomic_store_n(sqTail, sqPendingTail, __ATOMIC_RELEASE);
+    // Includes entries a previous call published but the kernel did not consume
+    unsigned toSubmit = sqPendingTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+
+    for (;;)
+    {
+        int result = ioUringEnter(ringFd, toSubmit, waitCount, waitCount > 0 ? IORING_ENTER_GETEVENTS : 0);
+        if (result >= 0)
+        {
+            return result;
+        }
+        if (errno != EINTR)
+        {
+            return -errno;
+        }
+    }
+}
+
+/**
+ * @brief Register buffers for the *_FIXED operations
+ *
+ * @param buffers
+ * @param count
+ * @return true
+ * @return false
+ */
+bool IoUring::registerBuffers(const iovec *buffers, unsigned count)
+{
+    return ringFd >= 0 && ioUringRegister(ringFd, IORING_REGISTER_BUFFERS, buffers, count) == 0;
+}
+
+#else
+
+IoUring::IoUring(unsigned)
+{
+}
+
+IoUring::~IoUring()
+{
+}
+
+bool IoUring::available()
+{
+    return false;
+}
+
+bool IoUring::registerBuffers(const iovec *, unsigned)
+{
+    return false;
+}
+
+#endif
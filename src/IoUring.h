@@ -0,0 +1,113 @@
+#ifndef IOURING_H
+#define IOURING_H
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define BACKUP_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#endif
+
+struct iovec;
+
+/**
+ * @brief Minimal io_uring instance on the raw system calls (no liburing)
+ * @details Owns the ring file descriptor and the shared submission/completion queues. It is not
+ *          thread safe; one thread submits and reaps.
+ */
+class IoUring
+{
+public:
+    /**
+     * @brief Create a ring
+     *
+     * @param entries Submission queue size (rounded up to a power of two by the kernel)
+     * @note Check valid() afterwards; creation fails on kernels without io_uring or where it is disabled
+     */
+    explicit IoUring(unsigned entries);
+    ~IoUring();
+    IoUring(const IoUring &) = delete;
+    IoUring &operator=(const IoUring &) = delete;
+
+    bool valid() const { return ringFd >= 0; } // Whether the ring was created
+
+    /**
+     * @brief Check once whether this kernel supports the operations the backup needs
+     *
+     * @return true if openat, read, write and close can be submitted through io_uring
+     */
+    static bool available();
+
+#ifdef BACKUP_HAVE_IO_URING
+    /**
+     * @brief Get a cleared submission entry to fill in
+     *
+     * @return io_uring_sqe* nullptr when the submission queue is full
+     */
+    io_uring_sqe *getSqe();
+
+    /**
+     * @brief Submit every prepared entry and wait for completions
+     *
+     * @param waitCount Minimum number of completions to wait for
+     * @return int Number of entries submitted, or -errno
+     */
+    int submitAndWait(unsigned waitCount);
+
+    /**
+     * @brief Call visit(cqe) for every available completion and consume them
+     *
+     * @return unsigned Number of completions visited
+     */
+    template <typename Visitor>
+    unsigned reap(Visitor &&visit)
+    {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        unsigned count = 0;
+        for (; head != tail; ++head, ++count)
+        {
+            visit(cqes[head & cqMask]);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        return count;
+    }
+#endif
+
+    /**
+     * @brief Register buffers for the *_FIXED operations
+     *
+     * @param buffers
+     * @param count
+     * @return true on success (fails e.g. when RLIMIT_MEMLOCK is too low on older kernels)
+     */
+    bool registerBuffers(const iovec *buffers, unsigned count);
+
+private:
+    int ringFd = -1;
+
+    void *sqRing = nullptr;
+    size_t sqRingSize = 0;
+    void *cqRing = nullptr;
+    size_t cqRingSize = 0;
+    void *sqeMemory = nullptr;
+    size_t sqeMemorySize = 0;
+
+#ifdef BACKUP_HAVE_IO_URING
+    unsigned *sqHead = nullptr;
+    unsigned *sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned sqEntries = 0;
+    unsigned *sqArray = nullptr;
+    io_uring_sqe *sqes = nullptr;
+    unsigned sqPendingTail = 0; // Tail including entries handed out by getSqe() but not yet published
+
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe *cqes = nullptr;
+#endif
+};
+
+#endif // IOURING_H
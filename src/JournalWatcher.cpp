@@ -0,0 +1,346 @@
+#include "JournalWatcher.h"
+#include "ChangeJournal.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/file.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+
+namespace
+{
+    constexpr uint32_t WATCH_MASK = IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE |
+                                    IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+                                    IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+
+    volatile std::sig_atomic_t stopRequested = 0;
+
+    void requestStop(int)
+    {
+        stopRequested = 1;
+    }
+
+    std::string joinPath(const std::string &directory, std::string_view name)
+    {
+        return directory.empty() ? std::string(name) : directory + "/" + std::string(name);
+    }
+}
+
+/**
+ * @brief Watch until SIGINT or SIGTERM
+ * @details The journal is locked exclusively for the whole run: a backup only trusts a journal
+ *          whose lock is held, since events that happen while nobody watches are lost.
+ *
+ * @return int
+ */
+int JournalWatcher::run()
+{
+    std::filesystem::path journalPath = sourceDir / ChangeJournal::FILE_NAME;
+    journalFd.reset(::open(journalPath.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644));
+    if (!journalFd.valid())
+    {
+        std::cerr << "Cannot open the change journal " << journalPath << ": " << std::strerror(errno) << "\n";
+        return 1;
+    }
+    if (::flock(journalFd.get(), LOCK_EX | LOCK_NB) != 0)
+    {
+        std::cerr << "Another `backup watch` is already running for " << sourceDir << "\n";
+        return 1;
+    }
+
+    inotifyFd.reset(::inotify_init1(IN_CLOEXEC));
+    if (!inotifyFd.valid())
+    {
+        std::cerr << "Cannot start inotify: " << std::strerror(errno) << "\n";
+        return 1;
+    }
+
+    // Every directory is watched before the header is written; a backup needs the header to sync
+    if (!addWatches("") || !startJournal())
+    {
+        return 1;
+    }
+
+    struct sigaction action = {};
+    action.sa_handler = requestStop;
+    ::sigaction(SIGINT, &action, nullptr); // No SA_RESTART: the blocking read returns EINTR
+    ::sigaction(SIGTERM, &action, nullptr);
+
+    std::cout << "Watching " << sourceDir << " (" << watches.size() << " directories), journal "
+              << journalPath << ". Press Ctrl+C to stop." << std::endl;
+
+    alignas(struct inotify_event) char buffer[64 * 1024];
+    while (!stopRequested && !failed)
+    {
+        ssize_t length = ::read(inotifyFd.get(), buffer, sizeof(buffer));
+        if (length < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            std::cerr << "Reading inotify events failed: " << std::strerror(errno) << "\n";
+            failed = true;
+            break;
+        }
+
+        for (ssize_t offset = 0; offset < length;)
+        {
+            const auto *event = reinterpret_cast<const struct inotify_event *>(buffer + offset);
+            handleEvent(event->wd, event->mask, event->len ? std::string_view(event->name) : std::string_view());
+            offset += static_cast<ssize_t>(sizeof(struct inotify_event) + event->len);
+        }
+        if (!flush())
+        {
+            std::cerr << "Cannot write the change journal " << journalPath << ": " << std::strerror(errno) << "\n";
+            failed = true;
+        }
+    }
+
+    std::cout << "Stopped watching " << sourceDir << std::endl;
+    return failed ? 1 : 0;
+}
+
+/**
+ * @brief Empty the journal and write a header with a new id
+ * @details Backups that synced against the previous journal no longer match its id and fall back
+ *          to a full scan once.
+ *
+ * @return true
+ * @return false
+ */
+bool JournalWatcher::startJournal()
+{
+    if (::ftruncate(journalFd.get(), 0) != 0)
+    {
+        std::cerr << "Cannot reset the change journal: " << std::strerror(errno) << "\n";
+        return false;
+    }
+    journalSize = 0;
+    pending.clear();
+    batch.clear();
+    int64_t id = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::system_clock::now().time_since_epoch())
+                     .count();
+    append('H', std::to_string(id));
+    return flush();
+}
+
+/**
+ * @brief Watch a directory and every directory below it
+ *
+ * @param relativeDir
+ * @return true
+ * @return false when the inotify watch limit is reached
+ */
+bool JournalWatcher::addWatches(const std::string &relativeDir)
+{
+    std::vector<std::string> stack{relativeDir};
+    while (!stack.empty())
+    {
+        std::string directory = std::move(stack.back());
+        stack.pop_back();
+
+        std::filesystem::path path = directory.empty() ? sourceDir : sourceDir / directory;
+        int wd = ::inotify_add_watch(inotifyFd.get(), path.c_str(), WATCH_MASK);
+        if (wd < 0)
+        {
+            if (errno == ENOSPC)
+            {
+                std::cerr << "The inotify watch limit is reached (raise fs.inotify.max_user_watches)\n";
+                failed = true;
+                return false;
+            }
+            continue; // Removed again already, or unreadable: the walk skips it too
+        }
+        watches[wd] = directory;
+
+        std::error_code error;
+        for (const auto &entry : std::filesystem::directory_iterator(path, std::filesystem::directory_options::skip_permission_denied, error))
+        {
+            std::error_code typeError;
+            if (entry.is_directory(typeError) && !entry.is_symlink(typeError))
+            {
+                stack.push_back(joinPath(directory, entry.path().filename().string()));
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Stop watching a directory that was deleted or moved away, and everything below it
+ *
+ * @param relativeDir
+ */
+void JournalWatcher::removeWatches(const std::string &relativeDir)
+{
+    for (auto it = watches.begin(); it != watches.end();)
+    {
+        const std::string &directory = it->second;
+        if (directory == relativeDir ||
+            (directory.size() > relativeDir.size() && directory.compare(0, relativeDir.size(), relativeDir) == 0 &&
+             directory[relativeDir.size()] == '/'))
+        {
+            ::inotify_rm_watch(inotifyFd.get(), it->first);
+            it = watches.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+/**
+ * @brief Turn one inotify event into journal records
+ *
+ * @param wd
+ * @param mask
+ * @param name
+ */
+void JournalWatcher::handleEvent(int wd, uint32_t mask, std::string_view name)
+{
+    if (mask & IN_Q_OVERFLOW)
+    {
+        append('O', "");
+        return;
+    }
+
+    auto watch = watches.find(wd);
+    if (watch == watches.end())
+    {
+        return; // Queued before the directory was removed
+    }
+    const std::string &directory = watch->second;
+
+    if (mask & IN_IGNORED)
+    {
+        watches.erase(watch);
+        return;
+    }
+    if (mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+    {
+        if (directory.empty())
+        {
+            std::cerr << "The watched directory " << sourceDir << " was deleted or moved\n";
+            append('O', "");
+            failed = true;
+        }
+        return; // Below the root the parent reports the same change
+    }
+
+    if (directory.empty() && std::find(ignoredNames.begin(), ignoredNames.end(), name) != ignoredNames.end())
+    {
+        // A backup waiting for the journal to catch up; the cookie holds its token
+        if (name == ChangeJournal::COOKIE_NAME && (mask & IN_CLOSE_WRITE))
+        {
+            char token[64];
+            FileDescriptor cookie(::open((sourceDir / ChangeJournal::COOKIE_NAME).c_str(), O_RDONLY | O_CLOEXEC));
+            ssize_t size = cookie.valid() ? ::read(cookie.get(), token, sizeof(token)) : -1;
+            if (size > 0)
+            {
+                append('S', std::string_view(token, static_cast<size_t>(size)));
+                pending.clear();
+            }
+        }
+        return;
+    }
+
+    std::string path = joinPath(directory, name);
+    if (mask & IN_ISDIR)
+    {
+        if (mask & (IN_CREATE | IN_MOVED_TO))
+        {
+            // Files may have appeared in it before its watch was added; the backup scans it whole
+            addWatches(path);
+            append('R', path);
+        }
+        else if (mask & (IN_DELETE | IN_MOVED_FROM))
+        {
+            removeWatches(path);
+            append('D', path);
+        }
+        return;
+    }
+
+    if (mask & (IN_DELETE | IN_MOVED_FROM))
+    {
+        append('D', path);
+    }
+    else if (pending.insert(path).second)
+    {
+        // The backup stats the file when it reads the journal, so one record per sync is enough
+        append('M', path);
+        if (pending.size() > (1u << 20))
+        {
+            pending.clear();
+        }
+    }
+}
+
+/**
+ * @brief Queue a record
+ *
+ * @param type
+ * @param value
+ */
+void JournalWatcher::append(char type, std::string_view value)
+{
+    batch.push_back(type);
+    batch.append(value);
+    batch.push_back('\0');
+}
+
+/**
+ * @brief Append the queued records to the journal, restarting it once it grows too large
+ *
+ * @return true
+ * @return false
+ */
+bool JournalWatcher::flush()
+{
+    size_t done = 0;
+    while (done < batch.size())
+    {
+        ssize_t written = ::write(journalFd.get(), batch.data() + done, batch.size() - done);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written < 0)
+        {
+            return false;
+        }
+        done += static_cast<size_t>(written);
+    }
+    journalSize += batch.size();
+    batch.clear();
+
+    if (journalSize > JOURNAL_SIZE_LIMIT)
+    {
+        return startJournal();
+    }
+    return true;
+}
+
+#else
+
+/**
+ * @brief Watch until SIGINT or SIGTERM
+ *
+ * @return int
+ */
+int JournalWatcher::run()
+{
+    std::cerr << "`backup watch` needs inotify and is only available on Linux\n";
+    return 1;
+}
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef JOURNALWATCHER_H
+#define JOURNALWATCHER_H
+
+#include "FileDescriptor.h"
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * @brief `backup watch`: records the changes to a source directory in its ChangeJournal
+ * @details Every directory of the tree is watched with inotify (fanotify would need
+ *          CAP_SYS_ADMIN). Events are turned into journal records as they arrive, so the next
+ *          incremental backup only has to look at the paths in the journal instead of walking
+ *          the whole tree.
+ */
+class JournalWatcher
+{
+public:
+    static constexpr uint64_t JOURNAL_SIZE_LIMIT = 256ULL << 20; // The journal is restarted past this size
+
+    /**
+     * @brief Construct a new Journal Watcher object
+     *
+     * @param sourceDir Directory to watch
+     * @param ignoredNames Names in the root of sourceDir whose changes are not recorded (metafile, journal, cookie)
+     */
+    JournalWatcher(const std::filesystem::path &sourceDir, std::vector<std::string> ignoredNames)
+        : sourceDir(sourceDir), ignoredNames(std::move(ignoredNames)) {}
+
+    /**
+     * @brief Watch until SIGINT or SIGTERM
+     *
+     * @return int Exit code: 0 when stopped by a signal, 1 when the tree cannot be watched
+     * @note Linux only
+     */
+    int run();
+
+private:
+    std::filesystem::path sourceDir;
+    std::vector<std::string> ignoredNames;
+    FileDescriptor inotifyFd;
+    FileDescriptor journalFd;
+    std::unordered_map<int, std::string> watches; // Watch descriptor -> relative path of the directory
+    std::unordered_set<std::string> pending;      // Files recorded with 'M' since the last sync record
+    std::string batch;                            // Records not yet appended to the journal
+    uint64_t journalSize = 0;
+    bool failed = false;                          // The tree can no longer be watched completely
+
+    bool startJournal();
+    bool addWatches(const std::string &relativeDir);
+    void removeWatches(const std::string &relativeDir);
+    void handleEvent(int wd, uint32_t mask, std::string_view name);
+    void append(char type, std::string_view value);
+    bool flush();
+};
+
+#endif // JOURNALWATCHER_H
@@ -0,0 +1,56 @@
+#include "LatencyHistogram.h"
+#include <algorithm>
+#include <bit>
+
+/**
+ * @brief Add one measurement
+ *
+ * @param latency
+ */
+void LatencyHistogram::record(std::chrono::steady_clock::duration latency)
+{
+    uint64_t us = static_cast<uint64_t>(std::max<int64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(latency).count(), 0));
+    size_t bucket = std::min<size_t>(std::bit_width(us), BUCKETS - 1);
+    counts[bucket]++;
+    count++;
+    totalUs += us;
+    maxUs = std::max(maxUs, us);
+}
+
+/**
+ * @brief Add the measurements of another histogram
+ *
+ * @param other
+ */
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    for (size_t bucket = 0; bucket < BUCKETS; ++bucket)
+    {
+        counts[bucket] += other.counts[bucket];
+    }
+    count += other.count;
+    totalUs += other.totalUs;
+    maxUs = std::max(maxUs, other.maxUs);
+}
+
+/**
+ * @brief Estimate a percentile
+ *
+ * @param fraction
+ * @return uint64_t
+ */
+uint64_t LatencyHistogram::percentile(double fraction) const
+{
+    uint64_t rank = static_cast<uint64_t>(fraction * static_cast<double>(count));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < BUCKETS; ++bucket)
+    {
+        seen += counts[bucket];
+        if (seen > rank)
+        {
+            return std::min<uint64_t>(uint64_t{1} << bucket, maxUs);
+        }
+    }
+    return maxUs;
+}
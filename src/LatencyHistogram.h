@@ -0,0 +1,46 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Log2 histogram of per-file latencies
+ * @details Bucket b counts the latencies in [2^(b-1), 2^b) microseconds (bucket 0: below 1 us).
+ *          Not thread safe: every worker fills its own and they are merged afterwards.
+ */
+struct LatencyHistogram
+{
+    static constexpr size_t BUCKETS = 32;
+
+    std::array<uint64_t, BUCKETS> counts{};
+    uint64_t count = 0;
+    uint64_t totalUs = 0;
+    uint64_t maxUs = 0;
+
+    /**
+     * @brief Add one measurement
+     *
+     * @param latency
+     */
+    void record(std::chrono::steady_clock::duration latency);
+
+    /**
+     * @brief Add the measurements of another histogram
+     *
+     * @param other
+     */
+    void merge(const LatencyHistogram &other);
+
+    /**
+     * @brief Estimate a percentile
+     *
+     * @param fraction 0.5 for the median, 0.99 for p99, ...
+     * @return uint64_t Upper bound of the bucket holding the percentile, in microseconds
+     */
+    uint64_t percentile(double fraction) const;
+};
+
+#endif // LATENCYHISTOGRAM_H
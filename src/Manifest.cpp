@@ -0,0 +1,240 @@
+#include "Manifest.h"
+#include "Hasher.h"
+#include "Trace.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+using json = nlohmann::json;
+
+namespace
+{
+    // CBOR self-describe tag 55799 (RFC 8949, section 3.4.6), used as the magic number
+    constexpr unsigned char CBOR_MAGIC[] = {0xd9, 0xd9, 0xf7};
+
+    /**
+     * @brief Turn a hex digest into a 32-byte CBOR byte string (other values are left alone)
+     */
+    void digestToBinary(json &value)
+    {
+        Sha256Digest digest;
+        if (value.is_string() && Hasher::fromHex(value.get_ref<const std::string &>(), digest))
+        {
+            value = json::binary(std::vector<std::uint8_t>(digest.begin(), digest.end()));
+        }
+    }
+
+    /**
+     * @brief Turn a CBOR byte string back into hex (other values are left alone)
+     */
+    void digestToHex(json &value)
+    {
+        if (value.is_binary())
+        {
+            const auto &bytes = value.get_binary();
+            value = Hasher::toHex(bytes.data(), bytes.size());
+        }
+    }
+
+    /**
+     * @brief Apply convert to the file digests and to every chunk digest of a file entry
+     */
+    template <typename Convert>
+    void convertDigests(json &fileData, Convert convert)
+    {
+        for (const char *name : {"sha256", "blake3"})
+        {
+            auto digest = fileData.find(name);
+            if (digest != fileData.end())
+            {
+                convert(*digest);
+            }
+        }
+        auto chunks = fileData.find("chunks");
+        if (chunks != fileData.end() && chunks->is_array())
+        {
+            for (auto &chunk : *chunks)
+            {
+                convert(chunk);
+            }
+        }
+    }
+
+    /**
+     * @brief Apply fn to every file entry of every location
+     */
+    template <typename Json, typename Function>
+    void forEachFileEntry(Json &data, Function fn)
+    {
+        if (!data.is_object() || !data.contains("location"))
+        {
+            return;
+        }
+        for (auto &location : data["location"])
+        {
+            if (location.contains("listFiles") && location["listFiles"].is_object())
+            {
+                for (auto &fileData : location["listFiles"])
+                {
+                    fn(fileData);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Detect the encoding of a metafile from its first bytes
+ *
+ * @param file
+ * @return ManifestFormat
+ */
+ManifestFormat Manifest::detectFormat(const std::filesystem::path &file)
+{
+    std::ifstream input(file, std::ios::binary);
+    unsigned char header[sizeof(CBOR_MAGIC)] = {};
+    input.read(reinterpret_cast<char *>(header), sizeof(header));
+    if (input.gcount() == sizeof(header) && std::equal(std::begin(header), std::end(header), std::begin(CBOR_MAGIC)))
+    {
+        return ManifestFormat::Cbor;
+    }
+    return ManifestFormat::Json;
+}
+
+/**
+ * @brief Load a metafile in either format
+ * @details Binary digests are turned back into hex strings so callers see the same document
+ *          whatever the on-disk format.
+ *
+ * @param file
+ * @param data
+ * @param format
+ * @return true
+ * @return false
+ */
+bool Manifest::load(const std::filesystem::path &file, json &data, ManifestFormat *format)
+{
+    TraceSpan span("manifest", "manifest parse", file.native());
+    ManifestFormat detected = detectFormat(file);
+    if (format != nullptr)
+    {
+        *format = detected;
+    }
+
+    std::ifstream input(file, std::ios::binary);
+    if (!input)
+    {
+        return false;
+    }
+
+    try
+    {
+        if (detected == ManifestFormat::Cbor)
+        {
+            data = json::from_cbor(input, true, true, json::cbor_tag_handler_t::ignore);
+            forEachFileEntry(data, [](json &fileData)
+                             { convertDigests(fileData, digestToHex); });
+        }
+        else
+        {
+            data = json::parse(input);
+        }
+    }
+    catch (const json::exception &e)
+    {
+        std::cerr << "JSON processing error: " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Save a metafile
+ * @details The CBOR form stores every well-formed SHA-256 (file and chunk digests) as a 32-byte
+ *          byte string instead of 64 hex characters.
+ *
+ * @param file
+ * @param data
+ * @param format
+ * @return true
+ * @return false
+ */
+bool Manifest::save(const std::filesystem::path &file, json data, ManifestFormat format)
+{
+    TraceSpan span("manifest", "manifest serialize", file.native());
+    std::ofstream output(file, std::ios::binary | std::ios::trunc);
+    if (!output)
+    {
+        return false;
+    }
+
+    data["version"] = VERSION;
+    if (format == ManifestFormat::Cbor)
+    {
+        forEachFileEntry(data, [](json &fileData)
+                         { convertDigests(fileData, digestToBinary); });
+
+        output.write(reinterpret_cast<const char *>(CBOR_MAGIC), sizeof(CBOR_MAGIC));
+        json::to_cbor(data, nlohmann::detail::output_adapter<char>(output));
+    }
+    else
+    {
+        output << data.dump(4);
+    }
+    return static_cast<bool>(output.flush());
+}
+
+/**
+ * @brief Convert a metafile to another format
+ *
+ * @param input
+ * @param output
+ * @param format
+ * @return true
+ * @return false
+ */
+bool Manifest::convert(const std::filesystem::path &input, const std::filesystem::path &output, ManifestFormat format)
+{
+    json data;
+    if (!load(input, data))
+    {
+        return false;
+    }
+    return save(output, std::move(data), format);
+}
+
+/**
+ * @brief Parse a format name ("json" or "cbor")
+ *
+ * @param name
+ * @param format
+ * @return true
+ * @return false
+ */
+bool Manifest::parseFormat(const std::string &name, ManifestFormat &format)
+{
+    if (name == "json")
+    {
+        format = ManifestFormat::Json;
+        return true;
+    }
+    if (name == "cbor")
+    {
+        format = ManifestFormat::Cbor;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Get the name of a format
+ *
+ * @param format
+ * @return const char*
+ */
+const char *Manifest::formatName(ManifestFormat format)
+{
+    return format == ManifestFormat::Cbor ? "cbor" : "json";
+}
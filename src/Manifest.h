@@ -0,0 +1,78 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include "../include/nlohmann/json.hpp"
+#include <filesystem>
+#include <string>
+
+/**
+ * @brief On-disk encoding of the metafile (backup_timestamp.btd)
+ */
+enum class ManifestFormat
+{
+    Json, // Pretty-printed JSON (human readable, the historical format)
+    Cbor  // CBOR with the self-describe tag, raw 32-byte digests
+};
+
+class Manifest
+{
+public:
+    static constexpr int VERSION = 2; // Written as "version" at the top level
+
+    /**
+     * @brief Detect the encoding of a metafile from its first bytes
+     *
+     * @param file
+     * @return ManifestFormat Json when the file does not start with the CBOR self-describe tag
+     */
+    static ManifestFormat detectFormat(const std::filesystem::path &file);
+
+    /**
+     * @brief Load a metafile in either format
+     *
+     * @param file
+     * @param data Receives the metafile; digests are always hex strings in memory
+     * @param format Receives the detected format (may be nullptr)
+     * @return true on success, false if the file cannot be read or parsed
+     */
+    static bool load(const std::filesystem::path &file, nlohmann::json &data, ManifestFormat *format = nullptr);
+
+    /**
+     * @brief Save a metafile
+     *
+     * @param file
+     * @param data Taken by value so callers that are done with the document can move it in
+     * @param format
+     * @return true on success
+     */
+    static bool save(const std::filesystem::path &file, nlohmann::json data, ManifestFormat format);
+
+    /**
+     * @brief Convert a metafile to another format
+     *
+     * @param input
+     * @param output May be the same file as input
+     * @param format
+     * @return true on success
+     */
+    static bool convert(const std::filesystem::path &input, const std::filesystem::path &output, ManifestFormat format);
+
+    /**
+     * @brief Parse a format name ("json" or "cbor")
+     *
+     * @param name
+     * @param format
+     * @return true if name is a known format
+     */
+    static bool parseFormat(const std::string &name, ManifestFormat &format);
+
+    /**
+     * @brief Get the name of a format
+     *
+     * @param format
+     * @return const char*
+     */
+    static const char *formatName(ManifestFormat format);
+};
+
+#endif // MANIFEST_H
@@ -0,0 +1,752 @@
+#include "ManifestIndex.h"
+#include "FileDescriptor.h"
+#include "Manifest.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sys/stat.h>
+
+using json = nlohmann::json;
+
+namespace
+{
+    constexpr char LOOKUP_MAGIC[8] = {'B', 'K', 'M', 'I', 'D', 'X', '0', '1'};
+
+    /**
+     * @brief Header of the lookup file (host byte order)
+     * @details Followed by count path hashes, count records and the string pool, which starts
+     *          with the directory and the change hash name.
+     */
+    struct LookupHeader
+    {
+        char magic[8];
+        uint32_t recordSize;      // Record size of the writer, a different layout is not read
+        uint32_t reserved;
+        uint64_t metadataSize;    // Size and modification time of the metafile the file describes
+        int64_t metadataMtimeNs;
+        uint64_t count;
+        int64_t scanTimeNs;
+        int64_t journalId;
+        uint64_t journalOffset;
+        uint32_t directoryLength;
+        uint32_t changeHashLength;
+        uint64_t keysSize;        // Bytes in the string pool
+    };
+    static_assert(sizeof(LookupHeader) == 80);
+
+    uint64_t hashKey(std::string_view key)
+    {
+        return std::hash<std::string_view>{}(key);
+    }
+
+    /**
+     * @brief 64-bit FNV-1a; unlike std::hash it is the same in every build, as the lookup file needs
+     */
+    uint64_t lookupHash(std::string_view key)
+    {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (char c : key)
+        {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+        }
+        return hash;
+    }
+
+    /**
+     * @brief Get the size and modification time a lookup file is checked against
+     */
+    bool metadataVersion(const std::filesystem::path &metadataFile, uint64_t &size, int64_t &mtimeNs)
+    {
+        struct stat status;
+        if (::stat(metadataFile.c_str(), &status) != 0)
+        {
+            return false;
+        }
+        size = static_cast<uint64_t>(status.st_size);
+#if defined(__APPLE__)
+        mtimeNs = static_cast<int64_t>(status.st_mtimespec.tv_sec) * 1000000000 + status.st_mtimespec.tv_nsec;
+#else
+        mtimeNs = static_cast<int64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+#endif
+        return true;
+    }
+
+    /**
+     * @brief SAX consumer that streams "location[i].listFiles" into ManifestIndex objects
+     * @details Nesting levels: 1 = root object, 2 = "location" array, 3 = location object,
+     *          4 = "listFiles" object, 5 = file entry. Anything deeper is skipped.
+     */
+    class ManifestSaxHandler : public nlohmann::json_sax<json>
+    {
+    public:
+        ManifestSaxHandler(ManifestIndex &result, const std::string &directory)
+            : result(result), directory(directory) {}
+
+        bool null() override { return true; }
+        bool boolean(bool) override { return true; }
+        bool number_integer(number_integer_t value) override { return number(static_cast<int64_t>(value), static_cast<uint64_t>(value)); }
+        bool number_unsigned(number_unsigned_t value) override { return number(static_cast<int64_t>(value), static_cast<uint64_t>(value)); }
+        bool number_float(number_float_t, const string_t &) override { return true; }
+
+        bool string(string_t &value) override
+        {
+            if (depth == 3 && locationKey == "directory")
+            {
+                locationDirectory = value;
+                directoryKnown = true;
+            }
+            else if (depth == 3 && locationKey == "changeHash")
+            {
+                pendingChangeHash = value;
+            }
+            else if (depth == 5 && fieldKey == "sha256" && Hasher::fromHex(value, record.sha256))
+            {
+                record.flags |= ManifestRecord::HAS_SHA256;
+            }
+            else if (depth == 5 && fieldKey == "blake3" && Hasher::fromHex(value, record.blake3))
+            {
+                record.flags |= ManifestRecord::HAS_BLAKE3;
+            }
+            // Old metafiles store "modified" as a date string: ignored, so those files are re-hashed once
+            return true;
+        }
+
+        bool binary(binary_t &value) override
+        {
+            if (depth == 5 && fieldKey == "sha256" && value.size() == record.sha256.size())
+            {
+                std::copy(value.begin(), value.end(), record.sha256.begin());
+                record.flags |= ManifestRecord::HAS_SHA256;
+            }
+            else if (depth == 5 && fieldKey == "blake3" && value.size() == record.blake3.size())
+            {
+                std::copy(value.begin(), value.end(), record.blake3.begin());
+                record.flags |= ManifestRecord::HAS_BLAKE3;
+            }
+            return true;
+        }
+
+        bool start_object(std::size_t) override
+        {
+            ++depth;
+            if (depth == 3 && inLocations)
+            {
+                pending.clear();
+                pendingScanTimeNs = 0;
+                pendingJournalId = 0;
+                pendingJournalOffset = 0;
+                pendingChangeHash.clear();
+                locationDirectory.clear();
+                directoryKnown = false;
+            }
+            else if (depth == 5 && inListFiles)
+            {
+                record = ManifestRecord();
+                statFields = 0;
+            }
+            else if (depth == 4)
+            {
+                inListFiles = inLocations && locationKey == "listFiles";
+            }
+            return true;
+        }
+
+        bool key(string_t &value) override
+        {
+            switch (depth)
+            {
+            case 1:
+                rootKey = value;
+                break;
+            case 3:
+                locationKey = value;
+                break;
+            case 4:
+                entryKey = value;
+                break;
+            case 5:
+                fieldKey = value;
+                break;
+            default:
+                break;
+            }
+            return true;
+        }
+
+        bool end_object() override
+        {
+            if (depth == 5 && inListFiles && wanted())
+            {
+                if (statFields == 0x0f)
+                {
+                    record.flags |= ManifestRecord::HAS_STAT;
+                }
+                pending.insert(entryKey, record);
+            }
+            else if (depth == 4)
+            {
+                inListFiles = false;
+            }
+            else if (depth == 3 && inLocations)
+            {
+                finishLocation();
+            }
+            --depth;
+            return true;
+        }
+
+        bool start_array(std::size_t) override
+        {
+            ++depth;
+            if (depth == 2)
+            {
+                inLocations = rootKey == "location";
+            }
+            return true;
+        }
+
+        bool end_array() override
+        {
+            if (depth == 2)
+            {
+                inLocations = false;
+            }
+            --depth;
+            return true;
+        }
+
+        bool parse_error(std::size_t position, const std::string &, const nlohmann::detail::exception &e) override
+        {
+            std::cerr << "JSON processing error at byte " << position << ": " << e.what() << std::endl;
+            return false;
+        }
+
+    private:
+        ManifestIndex &result;
+        const std::string &directory;
+        ManifestIndex pending;        // Entries of the location being parsed
+        int64_t pendingScanTimeNs = 0;
+        int64_t pendingJournalId = 0;
+        uint64_t pendingJournalOffset = 0;
+        std::string pendingChangeHash;
+        size_t locationCount = 0;
+        bool found = false;           // A location for directory has been loaded
+
+        int depth = 0;
+        bool inLocations = false;
+        bool inListFiles = false;
+        std::string rootKey, locationKey, entryKey, fieldKey;
+        std::string locationDirectory;
+        bool directoryKnown = false;
+
+        ManifestRecord record;
+        unsigned statFields = 0;  // One bit per stat field seen in the current entry
+
+        /**
+         * @brief Whether the entries of the current location may end up in the result
+         */
+        bool wanted() const
+        {
+            if (found)
+            {
+                return false;
+            }
+            // The first location is kept as a fallback in case no location matches
+            return locationCount == 0 || !directoryKnown || locationDirectory == directory;
+        }
+
+        bool number(int64_t signedValue, uint64_t unsignedValue)
+        {
+            if (depth == 3 && locationKey == "scanTimeNs")
+            {
+                pendingScanTimeNs = signedValue;
+            }
+            else if (depth == 3 && locationKey == "journalId")
+            {
+                pendingJournalId = signedValue;
+            }
+            else if (depth == 3 && locationKey == "journalOffset")
+            {
+                pendingJournalOffset = unsignedValue;
+            }
+            else if (depth == 5)
+            {
+                if (fieldKey == "fileSize(Byte)")
+                {
+                    record.size = unsignedValue;
+                    record.flags |= ManifestRecord::HAS_SIZE;
+                }
+                else if (fieldKey == "modified" || fieldKey == "mtimeNs")
+                {
+                    record.mtimeNs = signedValue;
+                    statFields |= 1 << 0;
+                }
+                else if (fieldKey == "ctimeNs")
+                {
+                    record.ctimeNs = signedValue;
+                    statFields |= 1 << 1;
+                }
+                else if (fieldKey == "inode")
+                {
+                    record.inode = unsignedValue;
+                    statFields |= 1 << 2;
+                }
+                else if (fieldKey == "device")
+                {
+                    record.device = unsignedValue;
+                    statFields |= 1 << 3;
+                }
+            }
+            return true;
+        }
+
+        void finishLocation()
+        {
+            bool matches = directoryKnown && locationDirectory == directory;
+            if (!found && (matches || locationCount == 0))
+            {
+                std::swap(result, pending);
+                result.setScanTimeNs(pendingScanTimeNs);
+                result.setJournal(pendingJournalId, pendingJournalOffset);
+                result.setChangeHash(pendingChangeHash);
+                found = matches;
+            }
+            pending.clear();
+            locationCount++;
+        }
+    };
+}
+
+/**
+ * @brief Load the entries of one location of a metafile
+ *
+ * @param metadataFile
+ * @param directory
+ * @return true
+ * @return false
+ */
+bool ManifestIndex::load(const std::filesystem::path &metadataFile, const std::string &directory)
+{
+    TraceSpan span("manifest", "manifest index load", metadataFile.native());
+    clear();
+    if (map(metadataFile, directory))
+    {
+        return true;
+    }
+
+    ManifestFormat format = Manifest::detectFormat(metadataFile);
+    std::ifstream input(metadataFile, std::ios::binary);
+    if (!input)
+    {
+        return false;
+    }
+
+    ManifestSaxHandler handler(*this, directory);
+    if (format == ManifestFormat::Cbor)
+    {
+        // Skip the self-describe tag, the SAX reader does not accept tags
+        input.seekg(3);
+        return json::sax_parse(input, &handler, nlohmann::detail::input_format_t::cbor);
+    }
+    return json::sax_parse(input, &handler);
+}
+
+/**
+ * @brief Look up a file
+ *
+ * @param relativePath
+ * @return const ManifestRecord*
+ */
+const ManifestRecord *ManifestIndex::find(std::string_view relativePath) const
+{
+    if (mapped.valid())
+    {
+        return findMapped(relativePath);
+    }
+    if (slots.empty())
+    {
+        return nullptr;
+    }
+    const Slot &slot = slots[findSlot(relativePath, hashKey(relativePath))];
+    return slot.recordIndex == EMPTY_SLOT ? nullptr : &records[slot.recordIndex].record;
+}
+
+/**
+ * @brief Insert or replace an entry
+ *
+ * @param relativePath
+ * @param record
+ */
+void ManifestIndex::insert(std::string_view relativePath, const ManifestRecord &record)
+{
+    if (mapped.valid())
+    {
+        // Keep the mapping alive while its entries are copied
+        MappedFile mapping = std::move(mapped);
+        size_t count = mappedCount;
+        const StoredRecord *stored = mappedRecords;
+        const char *keys = mappedKeys;
+        uint64_t keysSize = mappedKeysSize;
+        unmap();
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (stored[i].keyOffset <= keysSize && stored[i].keyLength <= keysSize - stored[i].keyOffset)
+            {
+                insert(std::string_view(keys + stored[i].keyOffset, stored[i].keyLength), stored[i].record);
+            }
+        }
+    }
+
+    // Keep the load factor at or below 0.75
+    if ((records.size() + 1) * 4 > slots.size() * 3)
+    {
+        grow();
+    }
+
+    uint64_t hash = hashKey(relativePath);
+    Slot &slot = slots[findSlot(relativePath, hash)];
+    if (slot.recordIndex != EMPTY_SLOT)
+    {
+        records[slot.recordIndex].record = record;
+        return;
+    }
+
+    slot.recordIndex = static_cast<uint32_t>(records.size());
+    slot.hashTag = static_cast<uint32_t>(hash >> 32);
+    records.push_back({keyPool.size(), static_cast<uint32_t>(relativePath.size()), record});
+    keyPool.append(relativePath);
+}
+
+/**
+ * @brief Remove every entry
+ */
+void ManifestIndex::clear()
+{
+    slots.clear();
+    records.clear();
+    keyPool.clear();
+    scanTimeNs = 0;
+    journalId = 0;
+    journalOffset = 0;
+    changeHash.clear();
+    unmap();
+}
+
+/**
+ * @brief Find the slot holding key, or the empty slot where it would be inserted
+ *
+ * @param key
+ * @param hash
+ * @return size_t
+ */
+size_t ManifestIndex::findSlot(std::string_view key, uint64_t hash) const
+{
+    size_t mask = slots.size() - 1;
+    uint32_t tag = static_cast<uint32_t>(hash >> 32);
+    for (size_t index = static_cast<size_t>(hash) & mask;; index = (index + 1) & mask)
+    {
+        const Slot &slot = slots[index];
+        if (slot.recordIndex == EMPTY_SLOT ||
+            (slot.hashTag == tag && keyOf(records[slot.recordIndex]) == key))
+        {
+            return index;
+        }
+    }
+}
+
+/**
+ * @brief Double the number of slots and re-insert every record
+ */
+void ManifestIndex::grow()
+{
+    std::vector<Slot> oldSlots(std::max<size_t>(slots.size() * 2, 1024));
+    slots.swap(oldSlots);
+
+    size_t mask = slots.size() - 1;
+    for (uint32_t recordIndex = 0; recordIndex < records.size(); ++recordIndex)
+    {
+        uint64_t hash = hashKey(keyOf(records[recordIndex]));
+        size_t index = static_cast<size_t>(hash) & mask;
+        while (slots[index].recordIndex != EMPTY_SLOT)
+        {
+            index = (index + 1) & mask;
+        }
+        slots[index] = {recordIndex, static_cast<uint32_t>(hash >> 32)};
+    }
+}
+
+/**
+ * @brief Call fn for every entry, in no particular order
+ *
+ * @param fn
+ */
+void ManifestIndex::forEach(const std::function<void(std::string_view, const ManifestRecord &)> &fn) const
+{
+    for (size_t i = 0; i < mappedCount; ++i)
+    {
+        const StoredRecord &stored = mappedRecords[i];
+        if (stored.keyOffset <= mappedKeysSize && stored.keyLength <= mappedKeysSize - stored.keyOffset)
+        {
+            fn(std::string_view(mappedKeys + stored.keyOffset, stored.keyLength), stored.record);
+        }
+    }
+    for (const Entry &entry : records)
+    {
+        fn(keyOf(entry), entry.record);
+    }
+}
+
+/**
+ * @brief Load the entries of one location of a metafile document already in memory
+ * @details Reads the same fields as the SAX loader.
+ *
+ * @param location
+ */
+void ManifestIndex::loadLocation(const json &location)
+{
+    clear();
+    auto integer = [](const json &object, const char *key, auto &value)
+    {
+        auto field = object.find(key);
+        if (field != object.end() && field->is_number_integer())
+        {
+            value = field->get<std::remove_reference_t<decltype(value)>>();
+            return true;
+        }
+        return false;
+    };
+    integer(location, "scanTimeNs", scanTimeNs);
+    integer(location, "journalId", journalId);
+    integer(location, "journalOffset", journalOffset);
+    auto name = location.find("changeHash");
+    if (name != location.end() && name->is_string())
+    {
+        changeHash = name->get<std::string>();
+    }
+
+    auto listFiles = location.find("listFiles");
+    if (listFiles == location.end() || !listFiles->is_object())
+    {
+        return;
+    }
+    for (const auto &[path, entry] : listFiles->items())
+    {
+        if (!entry.is_object())
+        {
+            continue;
+        }
+        ManifestRecord record;
+        if (integer(entry, "fileSize(Byte)", record.size))
+        {
+            record.flags |= ManifestRecord::HAS_SIZE;
+        }
+        bool hasMtime = integer(entry, "modified", record.mtimeNs) || integer(entry, "mtimeNs", record.mtimeNs);
+        bool hasCtime = integer(entry, "ctimeNs", record.ctimeNs);
+        bool hasInode = integer(entry, "inode", record.inode);
+        bool hasDevice = integer(entry, "device", record.device);
+        if (hasMtime && hasCtime && hasInode && hasDevice)
+        {
+            record.flags |= ManifestRecord::HAS_STAT;
+        }
+        auto sha256 = entry.find("sha256");
+        if (sha256 != entry.end() && sha256->is_string() && Hasher::fromHex(sha256->get_ref<const std::string &>(), record.sha256))
+        {
+            record.flags |= ManifestRecord::HAS_SHA256;
+        }
+        auto blake3 = entry.find("blake3");
+        if (blake3 != entry.end() && blake3->is_string() && Hasher::fromHex(blake3->get_ref<const std::string &>(), record.blake3))
+        {
+            record.flags |= ManifestRecord::HAS_BLAKE3;
+        }
+        insert(path, record);
+    }
+}
+
+/**
+ * @brief Get the path of the lookup file of a metafile
+ *
+ * @param metadataFile
+ * @return std::filesystem::path
+ */
+std::filesystem::path ManifestIndex::lookupPath(const std::filesystem::path &metadataFile)
+{
+    std::filesystem::path path = metadataFile;
+    path += ".idx";
+    return path;
+}
+
+/**
+ * @brief Write the entries as the lookup file of a metafile
+ *
+ * @param metadataFile
+ * @param directory
+ * @return true
+ * @return false
+ */
+bool ManifestIndex::save(const std::filesystem::path &metadataFile, const std::string &directory) const
+{
+    TraceSpan span("manifest", "manifest lookup save", metadataFile.native());
+    LookupHeader header{};
+    std::copy(std::begin(LOOKUP_MAGIC), std::end(LOOKUP_MAGIC), header.magic);
+    header.recordSize = sizeof(StoredRecord);
+    if (!metadataVersion(metadataFile, header.metadataSize, header.metadataMtimeNs))
+    {
+        return false;
+    }
+    header.count = size();
+    header.scanTimeNs = scanTimeNs;
+    header.journalId = journalId;
+    header.journalOffset = journalOffset;
+    header.directoryLength = static_cast<uint32_t>(directory.size());
+    header.changeHashLength = static_cast<uint32_t>(changeHash.size());
+    header.keysSize = directory.size() + changeHash.size();
+
+    auto keyAt = [this](size_t i)
+    {
+        return mapped.valid() ? std::string_view(mappedKeys + mappedRecords[i].keyOffset, mappedRecords[i].keyLength)
+                              : keyOf(records[i]);
+    };
+    std::vector<std::pair<uint64_t, size_t>> order(size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        order[i] = {lookupHash(keyAt(i)), i};
+        header.keysSize += keyAt(i).size();
+    }
+    std::sort(order.begin(), order.end());
+
+    std::filesystem::path file = lookupPath(metadataFile);
+    std::filesystem::path temporary = file;
+    temporary += ".tmp";
+    std::ofstream output(temporary, std::ios::binary | std::ios::trunc);
+    output.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (const auto &[hash, i] : order)
+    {
+        output.write(reinterpret_cast<const char *>(&hash), sizeof(hash));
+    }
+    uint64_t keyOffset = directory.size() + changeHash.size();
+    for (const auto &[hash, i] : order)
+    {
+        StoredRecord stored{};
+        stored.keyOffset = keyOffset;
+        stored.keyLength = static_cast<uint32_t>(keyAt(i).size());
+        stored.record = mapped.valid() ? mappedRecords[i].record : records[i].record;
+        output.write(reinterpret_cast<const char *>(&stored), sizeof(stored));
+        keyOffset += stored.keyLength;
+    }
+    output << directory << changeHash;
+    for (const auto &[hash, i] : order)
+    {
+        output << keyAt(i);
+    }
+    if (!output.flush())
+    {
+        return false;
+    }
+    output.close();
+
+    std::error_code error;
+    std::filesystem::rename(temporary, file, error);
+    return !error;
+}
+
+/**
+ * @brief Map the lookup file of a metafile if it describes the metafile as it is on disk
+ *
+ * @param metadataFile
+ * @param directory Only a lookup file written for this directory is used
+ * @return true when the entries were mapped
+ */
+bool ManifestIndex::map(const std::filesystem::path &metadataFile, const std::string &directory)
+{
+    uint64_t metadataSize = 0;
+    int64_t metadataMtimeNs = 0;
+    if (!metadataVersion(metadataFile, metadataSize, metadataMtimeNs))
+    {
+        return false;
+    }
+    FileDescriptor file(::open(lookupPath(metadataFile).c_str(), O_RDONLY | O_CLOEXEC));
+    struct stat status;
+    if (!file.valid() || ::fstat(file.get(), &status) != 0 || static_cast<size_t>(status.st_size) < sizeof(LookupHeader))
+    {
+        return false;
+    }
+
+    MappedFile mapping;
+    if (!mapping.map(file.get(), static_cast<size_t>(status.st_size)))
+    {
+        return false;
+    }
+    LookupHeader header;
+    std::memcpy(&header, mapping.data(), sizeof(header));
+    constexpr uint64_t ENTRY_SIZE = sizeof(uint64_t) + sizeof(StoredRecord);
+    uint64_t available = mapping.size() - sizeof(header);
+    if (!std::equal(std::begin(header.magic), std::end(header.magic), std::begin(LOOKUP_MAGIC)) ||
+        header.recordSize != sizeof(StoredRecord) ||
+        header.metadataSize != metadataSize || header.metadataMtimeNs != metadataMtimeNs ||
+        header.count > available / ENTRY_SIZE || header.keysSize != available - header.count * ENTRY_SIZE ||
+        static_cast<uint64_t>(header.directoryLength) + header.changeHashLength > header.keysSize)
+    {
+        return false;
+    }
+
+    const unsigned char *hashes = mapping.data() + sizeof(header);
+    const unsigned char *stored = hashes + header.count * sizeof(uint64_t);
+    const char *keys = reinterpret_cast<const char *>(stored + header.count * sizeof(StoredRecord));
+    if (std::string_view(keys, header.directoryLength) != directory)
+    {
+        return false;
+    }
+
+    // Lookups jump around, read-ahead would only pull in pages nobody asked for
+    mapping.advise(MADV_RANDOM);
+    mapped = std::move(mapping);
+    mappedCount = header.count;
+    mappedHashes = reinterpret_cast<const uint64_t *>(hashes);
+    mappedRecords = reinterpret_cast<const StoredRecord *>(stored);
+    mappedKeys = keys;
+    mappedKeysSize = header.keysSize;
+    scanTimeNs = header.scanTimeNs;
+    journalId = header.journalId;
+    journalOffset = header.journalOffset;
+    changeHash.assign(keys + header.directoryLength, header.changeHashLength);
+    return true;
+}
+
+/**
+ * @brief Look up a file in the lookup file: binary search of the hashes, then compare the paths
+ *
+ * @param relativePath
+ * @return const ManifestRecord*
+ */
+const ManifestRecord *ManifestIndex::findMapped(std::string_view relativePath) const
+{
+    uint64_t hash = lookupHash(relativePath);
+    const uint64_t *end = mappedHashes + mappedCount;
+    for (const uint64_t *it = std::lower_bound(mappedHashes, end, hash); it != end && *it == hash; ++it)
+    {
+        const StoredRecord &stored = mappedRecords[it - mappedHashes];
+        if (stored.keyOffset <= mappedKeysSize && stored.keyLength <= mappedKeysSize - stored.keyOffset &&
+            std::string_view(mappedKeys + stored.keyOffset, stored.keyLength) == relativePath)
+        {
+            return &stored.record;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Drop the lookup file
+ */
+void ManifestIndex::unmap()
+{
+    mapped.reset();
+    mappedCount = 0;
+    mappedHashes = nullptr;
+    mappedRecords = nullptr;
+    mappedKeys = nullptr;
+    mappedKeysSize = 0;
+}
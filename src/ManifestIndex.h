@@ -0,0 +1,178 @@
+#ifndef MANIFESTINDEX_H
+#define MANIFESTINDEX_H
+
+#include "../include/nlohmann/json_fwd.hpp"
+#include "Hasher.h"
+#include "MappedFile.h"
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Fixed-size metafile entry, everything change detection needs about one file
+ */
+struct ManifestRecord
+{
+    static constexpr uint8_t HAS_SIZE = 1 << 0;
+    static constexpr uint8_t HAS_SHA256 = 1 << 1;
+    static constexpr uint8_t HAS_STAT = 1 << 2; // mtimeNs, ctimeNs, inode and device are all present
+    static constexpr uint8_t HAS_BLAKE3 = 1 << 3;
+
+    uint64_t size = 0;
+    int64_t mtimeNs = 0;
+    int64_t ctimeNs = 0;
+    uint64_t inode = 0;
+    uint64_t device = 0;
+    Sha256Digest sha256{};
+    Blake3Digest blake3{};
+    uint8_t flags = 0;
+};
+
+/**
+ * @brief Read-only map of relative path -> ManifestRecord for one location of a metafile
+ * @details Loaded with the SAX interface straight from the file (JSON or CBOR) without building a
+ *          json DOM. Keys live in one string pool and the records in one array, indexed by an
+ *          open-addressing (linear probing) hash table, so there is no per-entry allocation.
+ *
+ *          Each backup also writes the location it recorded as a lookup file next to the metafile
+ *          (backup_timestamp.btd.idx, host byte order): a header, the 64-bit hashes of the paths
+ *          in ascending order, one fixed-size record per hash in the same order, and a string pool
+ *          with the paths. While that file still matches the metafile it is mapped instead of
+ *          parsed, and lookups binary-search the hashes, so loading costs the same for ten entries
+ *          or ten million and a lookup touches only the pages it reads.
+ */
+class ManifestIndex
+{
+public:
+    /**
+     * @brief Load the entries of one location of a metafile
+     * @details Maps the lookup file instead when it was written for this metafile and directory.
+     *
+     * @param metadataFile
+     * @param directory Source directory whose location should be loaded; the first location is used when none matches
+     * @return true on success, false if the file cannot be read or parsed
+     */
+    bool load(const std::filesystem::path &metadataFile, const std::string &directory);
+
+    /**
+     * @brief Load the entries of one location of a metafile document already in memory
+     *
+     * @param location Element of the "location" array (digests as hex strings)
+     */
+    void loadLocation(const nlohmann::json &location);
+
+    /**
+     * @brief Write the entries as the lookup file of a metafile
+     * @details Written through a temporary file. The metafile's size and modification time are
+     *          recorded, so the lookup file is ignored once the metafile changes without it.
+     *
+     * @param metadataFile Metafile the entries were saved to (must already be written)
+     * @param directory Source directory of the location
+     * @return true on success, false when the file cannot be written
+     */
+    bool save(const std::filesystem::path &metadataFile, const std::string &directory) const;
+
+    /**
+     * @brief Get the path of the lookup file of a metafile
+     *
+     * @param metadataFile
+     * @return std::filesystem::path metadataFile with ".idx" appended
+     */
+    static std::filesystem::path lookupPath(const std::filesystem::path &metadataFile);
+
+    /**
+     * @brief Look up a file
+     *
+     * @param relativePath
+     * @return const ManifestRecord* nullptr when the file is not in the metafile
+     */
+    const ManifestRecord *find(std::string_view relativePath) const;
+
+    /**
+     * @brief Call fn for every entry, in no particular order
+     *
+     * @param fn Called as fn(relativePath, record)
+     */
+    void forEach(const std::function<void(std::string_view, const ManifestRecord &)> &fn) const;
+
+    size_t size() const { return mapped.valid() ? mappedCount : records.size(); } // Get the number of entries
+    bool isMapped() const { return mapped.valid(); }           // Whether the entries come from the lookup file
+    int64_t getScanTimeNs() const { return scanTimeNs; }        // Get the scan time of the loaded location
+    int64_t getJournalId() const { return journalId; }          // Get the change journal id recorded by the last backup (0 if none)
+    uint64_t getJournalOffset() const { return journalOffset; } // Get the change journal offset recorded by the last backup
+    const std::string &getChangeHash() const { return changeHash; } // Get the change hash name recorded by the last backup (empty if none)
+
+    /**
+     * @brief Insert or replace an entry
+     * @note A mapped index is copied into memory first
+     *
+     * @param relativePath
+     * @param record
+     */
+    void insert(std::string_view relativePath, const ManifestRecord &record);
+
+    /**
+     * @brief Remove every entry
+     */
+    void clear();
+
+    void setScanTimeNs(int64_t timeNs) { scanTimeNs = timeNs; } // Set the scan time of the loaded location
+    void setJournal(int64_t id, uint64_t offset) { journalId = id; journalOffset = offset; } // Set the change journal position of the loaded location
+    void setChangeHash(const std::string &name) { changeHash = name; }                     // Set the change hash name of the loaded location
+
+private:
+    static constexpr uint32_t EMPTY_SLOT = UINT32_MAX;
+
+    struct Slot
+    {
+        uint32_t recordIndex = EMPTY_SLOT;
+        uint32_t hashTag = 0; // High bits of the hash, checked before comparing keys
+    };
+
+    struct Entry
+    {
+        uint64_t keyOffset;
+        uint32_t keyLength;
+        ManifestRecord record;
+    };
+
+    /**
+     * @brief One record of the lookup file
+     */
+    struct StoredRecord
+    {
+        uint64_t keyOffset; // Position of the path in the string pool
+        uint32_t keyLength;
+        uint32_t reserved;
+        ManifestRecord record;
+    };
+
+    std::vector<Slot> slots;
+    std::vector<Entry> records;
+    std::string keyPool;
+
+    // Lookup file, when loaded from one
+    MappedFile mapped;
+    size_t mappedCount = 0;
+    const uint64_t *mappedHashes = nullptr;
+    const StoredRecord *mappedRecords = nullptr;
+    const char *mappedKeys = nullptr;
+    uint64_t mappedKeysSize = 0;
+
+    int64_t scanTimeNs = 0;
+    int64_t journalId = 0;
+    uint64_t journalOffset = 0;
+    std::string changeHash;
+
+    std::string_view keyOf(const Entry &entry) const { return std::string_view(keyPool).substr(entry.keyOffset, entry.keyLength); }
+    size_t findSlot(std::string_view key, uint64_t hash) const;
+    void grow();
+    bool map(const std::filesystem::path &metadataFile, const std::string &directory);
+    const ManifestRecord *findMapped(std::string_view relativePath) const;
+    void unmap();
+};
+
+#endif // MANIFESTINDEX_H
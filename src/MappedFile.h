@@ -0,0 +1,91 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <sys/mman.h>
+#include <utility>
+
+/**
+ * @brief Owning wrapper around a read-only memory mapping of a whole file (unmapped on destruction)
+ */
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile() { reset(); }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    MappedFile(MappedFile &&other) noexcept
+        : address(std::exchange(other.address, nullptr)), length(std::exchange(other.length, 0)) {}
+    MappedFile &operator=(MappedFile &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            address = std::exchange(other.address, nullptr);
+            length = std::exchange(other.length, 0);
+        }
+        return *this;
+    }
+
+    /**
+     * @brief Map the first size bytes of an open file, replacing any previous mapping
+     *
+     * @param fd May be closed afterwards, the mapping keeps the file alive
+     * @param size
+     * @return true on success, false when mmap fails or size is 0
+     */
+    bool map(int fd, size_t size)
+    {
+        reset();
+        if (size == 0)
+        {
+            return false;
+        }
+        void *mapped = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            return false;
+        }
+        address = mapped;
+        length = size;
+        return true;
+    }
+
+    /**
+     * @brief Tell the kernel how the mapping will be accessed
+     *
+     * @param advice MADV_RANDOM, MADV_SEQUENTIAL, ...
+     */
+    void advise(int advice) const
+    {
+        if (address != nullptr)
+        {
+            ::madvise(address, length, advice);
+        }
+    }
+
+    /**
+     * @brief Remove the mapping
+     */
+    void reset()
+    {
+        if (address != nullptr)
+        {
+            ::munmap(address, length);
+        }
+        address = nullptr;
+        length = 0;
+    }
+
+    const unsigned char *data() const { return static_cast<const unsigned char *>(address); } // Get the first byte
+    size_t size() const { return length; }                                                     // Get the mapped length
+    bool valid() const { return address != nullptr; }                                          // Check whether a file is mapped
+
+private:
+    void *address = nullptr;
+    size_t length = 0;
+};
+
+#endif // MAPPEDFILE_H
@@ -23,6 +23,79 @@ std::unordered_map<std::string, std::string> Parameter::parseArgs(int argc, char
         {
             args["version"] = "1.2.1";
         }
+        else if (arg == "--convert")
+        {
+            args["convert"] = "";
+        }
+        else if (arg == "--manifest-format" && i + 1 < argc)
+        {
+            args["manifest-format"] = argv[++i];
+        }
+        else if (arg == "--paranoid")
+        {
+            args["paranoid"] = "";
+        }
+        else if (arg == "--io-uring")
+        {
+            args["io-uring"] = "";
+        }
+        else if (arg == "--repository")
+        {
+            args["repository"] = "";
+        }
+        else if (arg == "--delta")
+        {
+            args["delta"] = "";
+        }
+        else if (arg == "--generations")
+        {
+            args["generations"] = "";
+        }
+        else if (arg == "--mode" && i + 1 < argc)
+        {
+            args["mode"] = argv[++i];
+        }
+        else if (arg == "--stats-json" && i + 1 < argc)
+        {
+            args["stats-json"] = argv[++i];
+        }
+        else if (arg == "--hash" && i + 1 < argc)
+        {
+            args["hash"] = argv[++i];
+        }
+        else if (arg == "--trace" && i + 1 < argc)
+        {
+            args["trace"] = argv[++i];
+        }
+        else if (arg == "-y" || arg == "--yes")
+        {
+            args["yes"] = "";
+        }
+        else if ((arg == "-j" || arg == "--jobs") && i + 1 < argc)
+        {
+            args["jobs"] = argv[++i];
+        }
+        else if (arg == "--path" && i + 1 < argc)
+        {
+            args["path"] = argv[++i];
+        }
+        else if (arg == "--manifest" && i + 1 < argc)
+        {
+            args["manifest"] = argv[++i];
+        }
+        else if (arg == "--sample" && i + 1 < argc)
+        {
+            args["sample"] = argv[++i];
+        }
+        else if ((arg == "watch" || arg == "verify" || arg == "restore") && !args.count("source") && !args.count("command"))
+        {
+            args["command"] = arg;
+        }
+        else if (arg.rfind("-", 0) != 0 && !args.count("destination"))
+        {
+            // Positional arguments: <source_directory> <destination_directory>
+            args[args.count("source") ? "destination" : "source"] = arg;
+        }
     }
     return args;
 }
@@ -34,6 +107,11 @@ void Parameter::displayHelp()
 {
     std::cout << "Help:\n"
               << "  backup <source_directory> <destination_directory>\n"
+              << "  backup <source_directory> <destination_directory> [--jobs N | -j N] [--paranoid] [--io-uring] [--repository] [--delta] [--generations] [--mode full|incremental] [--yes | -y] [--hash blake3|sha256] [--stats-json FILE] [--trace FILE]\n"
+              << "  backup watch <source_directory>\n"
+              << "  backup verify [<source_directory | metafile>] <destination_directory> [--sample P%] [--hash blake3|sha256] [--jobs N] [--io-uring] [--stats-json FILE]\n"
+              << "  backup restore <destination_directory> <target_directory> [--path SUB] [--manifest FILE] [--jobs N] [--io-uring] [--yes | -y] [--stats-json FILE]\n"
+              << "  backup --convert <metafile> <output_file> [--manifest-format json|cbor]\n"
               << "  backup [--version | -v]\n"
               << "  \n"
               << "  Usage:\n"
@@ -41,6 +119,28 @@ void Parameter::displayHelp()
               << "  \n"
               << "  All commands:\n"
               << "  --version, --help\n"
+              << "  --jobs N, -j N      Number of worker threads for scanning and copying, 1 to 1024 (default: number of CPU cores)\n"
+              << "  --paranoid          Incremental backup: hash every known file instead of trusting unchanged size/mtime/ctime/inode\n"
+              << "  --io-uring          Copy and hash small files in batches through io_uring (Linux 5.6+, falls back to the thread pool)\n"
+              << "  --repository        Store files as deduplicated content-defined chunks in <destination_directory>/chunks instead of copies (kept for later runs)\n"
+              << "  --delta             Update files of 8 MB or more by writing only the blocks that changed since the previous backup\n"
+              << "  --generations       Back up into a new <destination_directory>/<YYYYMMDD-HHMMSS>/ each run, hard linking unchanged files from the previous one (kept for later runs; not with --repository or --delta)\n"
+              << "  --mode M            Backup type without asking: full or incremental\n"
+              << "  --yes, -y           Do not ask for confirmation before backing up (for scripts)\n"
+              << "  --hash H            Hash that detects changed files: blake3 (default; fast, SIMD) or sha256. The SHA-256 of every copied file is always stored for integrity\n"
+              << "  --stats-json FILE   Write per-phase timings, I/O counters, file counts and per-file latency histograms to FILE (JSON)\n"
+              << "  --trace FILE        Write a Chrome/Perfetto trace (JSON) of the run to FILE: the phases and every directory read, file hash and file copy per thread\n"
+              << "  --manifest-format F Encoding of the written metafile: json (default for a new metafile) or cbor (compact binary). An existing metafile keeps its format\n"
+              << "  --convert           Convert <metafile> to <output_file> (to the other format unless --manifest-format is given)\n"
+              << "  \n"
+              << "  Watch:\n"
+              << "  backup watch <source_directory> keeps running and records every change to <source_directory> in backup_journal.btj. While it runs, incremental backups read the changed paths from the journal instead of walking the whole directory (they fall back to a full scan when the journal does not cover the time since the last backup)\n"
+              << "  \n"
+              << "  Verify:\n"
+              << "  backup verify [<source_directory>] <destination_directory> reads the backed up files again in parallel and compares their sizes and digests with the metafile (the copy kept in the backup, or the source directory's when it is given; BLAKE3 where recorded, else SHA-256; --hash sha256 always uses SHA-256). Missing, corrupt and extra files are listed with the throughput. --sample P% checks a random P percent of the files. Exit status: 0 when everything matches, 2 when a problem was found, 1 on errors\n"
+              << "  \n"
+              << "  Restore:\n"
+              << "  backup restore <destination_directory> <target_directory> copies the backed up files into <target_directory> in parallel, planned from the metafile kept in the backup (or --manifest FILE, or the one in <target_directory>). Files already at the target with the same size and modification time, or the same content, are skipped; every restored file is checked against its SHA-256 and gets its recorded modification time back. --path SUB restores only the file or directory SUB. Exit status: 0 when everything was restored, 2 when some file failed or is missing from the backup, 1 on errors\n"
               << "  \n"
               << "  Full backup:\n"
               << "  After running, select 1 to perform a full backup. The generated meta file is in the source_directory (you can choose to delete [only perform a full backup next time]) \n"
@@ -0,0 +1,72 @@
+#include "PathArena.h"
+#include <algorithm>
+#include <cstring>
+
+/**
+ * @brief Store prefix + separator + name
+ *
+ * @param prefix
+ * @param name
+ * @return std::string_view
+ */
+std::string_view PathArena::join(std::string_view prefix, std::string_view name)
+{
+    size_t separator = prefix.empty() ? 0 : 1;
+    size_t length = prefix.size() + separator + name.size();
+    char *text = allocate(length + 1);
+
+    std::memcpy(text, prefix.data(), prefix.size());
+    if (separator)
+    {
+        text[prefix.size()] = '/';
+    }
+    std::memcpy(text + prefix.size() + separator, name.data(), name.size());
+    text[length] = '\0';
+    return std::string_view(text, length);
+}
+
+/**
+ * @brief Take over the blocks of another arena
+ * @details The current block keeps being filled; the other arena's blocks are only kept alive.
+ *
+ * @param other
+ */
+void PathArena::merge(PathArena &&other)
+{
+    if (other.blocks.empty())
+    {
+        return;
+    }
+    // Keep our current (partially filled) block last so allocate() continues to use it
+    auto insertAt = blocks.empty() ? blocks.end() : blocks.end() - 1;
+    blocks.insert(insertAt, std::make_move_iterator(other.blocks.begin()), std::make_move_iterator(other.blocks.end()));
+    if (blockCapacity == 0)
+    {
+        blockUsed = other.blockUsed;
+        blockCapacity = other.blockCapacity;
+    }
+    totalUsed += other.totalUsed;
+
+    other.blocks.clear();
+    other.blockUsed = other.blockCapacity = other.totalUsed = 0;
+}
+
+/**
+ * @brief Reserve size bytes in the current block, starting a new block when it is full
+ *
+ * @param size
+ * @return char*
+ */
+char *PathArena::allocate(size_t size)
+{
+    if (blockUsed + size > blockCapacity)
+    {
+        blockCapacity = std::max(BLOCK_SIZE, size);
+        blocks.emplace_back(new char[blockCapacity]); // Left uninitialized, every byte is written before use
+        blockUsed = 0;
+    }
+    char *result = blocks.back().get() + blockUsed;
+    blockUsed += size;
+    totalUsed += size;
+    return result;
+}
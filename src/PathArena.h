@@ -0,0 +1,61 @@
+#ifndef PATHARENA_H
+#define PATHARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Append-only storage for path strings
+ * @details Strings are copied back to back into large blocks that never move, so the returned
+ *          views stay valid for the lifetime of the arena. Millions of relative paths cost a
+ *          handful of allocations instead of one heap object each.
+ */
+class PathArena
+{
+public:
+    PathArena() = default;
+    PathArena(const PathArena &) = delete;
+    PathArena &operator=(const PathArena &) = delete;
+    PathArena(PathArena &&) = default;
+    PathArena &operator=(PathArena &&) = default;
+
+    /**
+     * @brief Store prefix + separator + name (the separator is omitted when prefix is empty)
+     *
+     * @param prefix Relative path of the parent directory ("" for the root)
+     * @param name Entry name
+     * @return std::string_view NUL-terminated view into the arena
+     */
+    std::string_view join(std::string_view prefix, std::string_view name);
+
+    /**
+     * @brief Store a copy of a string
+     *
+     * @param text
+     * @return std::string_view NUL-terminated view into the arena
+     */
+    std::string_view store(std::string_view text) { return join({}, text); }
+
+    /**
+     * @brief Take over the blocks of another arena (views into it stay valid)
+     *
+     * @param other
+     */
+    void merge(PathArena &&other);
+
+    size_t bytesUsed() const { return totalUsed; } // Get the number of bytes stored
+
+private:
+    static constexpr size_t BLOCK_SIZE = 1 << 20;
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t blockUsed = 0;
+    size_t blockCapacity = 0;
+    size_t totalUsed = 0;
+
+    char *allocate(size_t size);
+};
+
+#endif // PATHARENA_H
@@ -0,0 +1,510 @@
+#include "RestoreEngine.h"
+#include "ChunkStore.h"
+#include "CopyEngine.h"
+#include "FileDescriptor.h"
+#include "Generations.h"
+#include "Manifest.h"
+#include "PathArena.h"
+#include "SparseFile.h"
+#include "Trace.h"
+#include "WorkerPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+namespace
+{
+    int64_t mtimeOf(const struct stat &status)
+    {
+#if defined(__APPLE__)
+        return static_cast<int64_t>(status.st_mtimespec.tv_sec) * 1000000000 + status.st_mtimespec.tv_nsec;
+#else
+        return static_cast<int64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+#endif
+    }
+
+    /**
+     * @brief Give a restored file the modification time recorded in the metafile
+     */
+    bool setModified(const std::filesystem::path &file, int64_t mtimeNs)
+    {
+        struct timespec times[2];
+        times[0].tv_sec = 0;
+        times[0].tv_nsec = UTIME_OMIT;
+        times[1].tv_sec = static_cast<time_t>(mtimeNs / 1000000000);
+        times[1].tv_nsec = static_cast<long>(mtimeNs % 1000000000);
+        return ::utimensat(AT_FDCWD, file.c_str(), times, 0) == 0;
+    }
+
+    /**
+     * @brief Write a whole buffer
+     */
+    bool writeAll(int fd, const unsigned char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+}
+
+/**
+ * @brief Read the metafile and compare its files with the target
+ *
+ * @param metadataFile
+ * @param backupDir
+ * @param target
+ * @param subPath
+ * @return true
+ * @return false
+ */
+bool RestoreEngine::plan(const std::filesystem::path &metadataFile, const std::filesystem::path &backupDir,
+                         const std::filesystem::path &target, const std::string &subPath)
+{
+    this->backupDir = backupDir;
+    this->target = target;
+    repository = ChunkStore::isRepository(backupDir);
+    filesDir = Generations::isGenerational(backupDir) ? backupDir / Generations::LATEST_NAME : backupDir;
+    {
+        auto timer = stats.time(RunPhase::Diff);
+        if (!loadManifest(metadataFile))
+        {
+            std::cerr << "Failed to read the metafile: " << metadataFile << std::endl;
+            return false;
+        }
+    }
+
+    std::string prefix = subPath;
+    while (prefix.starts_with("./"))
+    {
+        prefix.erase(0, 2);
+    }
+    while (!prefix.empty() && prefix.back() == '/')
+    {
+        prefix.pop_back();
+    }
+    planned.clear();
+    index.forEach([this, &prefix](std::string_view relativePath, const ManifestRecord &record)
+    {
+        if (prefix.empty() || relativePath == prefix ||
+            (relativePath.starts_with(prefix) && relativePath[prefix.size()] == '/'))
+        {
+            planned.push_back({relativePath, &record});
+        }
+    });
+    if (planned.empty() && !prefix.empty())
+    {
+        std::cerr << "Not in the backup: " << prefix << std::endl;
+        return false;
+    }
+    std::sort(planned.begin(), planned.end(), [](const Planned &a, const Planned &b)
+              { return a.relativePath < b.relativePath; });
+
+    // The target decides what is left to do; the copies give the permission bits
+    {
+        auto timer = stats.time(RunPhase::Scan);
+        WorkerPool(jobs).forEach(planned.size(), [this, &target](size_t i, unsigned)
+        {
+            Planned &file = planned[i];
+            const ManifestRecord &record = *file.record;
+            file.mode = S_IFREG | 0644;
+            struct stat status;
+            if (!repository)
+            {
+                if (::stat((filesDir / file.relativePath).c_str(), &status) != 0 || !S_ISREG(status.st_mode))
+                {
+                    file.action = Action::Missing;
+                    return;
+                }
+                file.mode = status.st_mode;
+            }
+            if (::stat((target / file.relativePath).c_str(), &status) != 0 || !S_ISREG(status.st_mode) ||
+                !(record.flags & ManifestRecord::HAS_SIZE) || static_cast<uint64_t>(status.st_size) != record.size)
+            {
+                file.action = Action::Restore;
+                return;
+            }
+            bool sameTime = (record.flags & ManifestRecord::HAS_STAT) && mtimeOf(status) == record.mtimeNs;
+            file.action = sameTime ? Action::Identical : Action::Compare;
+        });
+    }
+    compareContent();
+
+    identicalCount = std::count_if(planned.begin(), planned.end(), [](const Planned &file)
+                                   { return file.action == Action::Identical; });
+    restoreCount = std::count_if(planned.begin(), planned.end(), [](const Planned &file)
+                                 { return file.action == Action::Restore; });
+    missingCount = planned.size() - identicalCount - restoreCount;
+    touchCount = std::count_if(planned.begin(), planned.end(), [](const Planned &file) { return file.touch; });
+    stats.set("restore.files", planned.size());
+    stats.set("restore.identical", identicalCount);
+    stats.set("restore.touched", touchCount);
+    stats.set("restore.toRestore", restoreCount);
+    stats.set("restore.missing", missingCount);
+    return true;
+}
+
+/**
+ * @brief Restore the planned files and print a summary
+ *
+ * @return true
+ * @return false
+ */
+bool RestoreEngine::run()
+{
+    auto startTime = std::chrono::steady_clock::now();
+    std::vector<std::string> problems;
+    bool complete;
+    {
+        auto timer = stats.time(RunPhase::Copy);
+        complete = repository ? restoreChunks(problems) : restoreCopies(problems);
+        for (const Planned &file : planned)
+        {
+            std::filesystem::path path = target / file.relativePath;
+            if (file.touch && !setModified(path, file.record->mtimeNs))
+            {
+                problems.push_back(path.string() + ": cannot set the modification time: " + std::strerror(errno));
+            }
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    stats.set("restore.restored", restoredCount);
+    stats.set("restore.bytes", restoredBytes);
+    stats.set("restore.failed", problems.size());
+
+    for (const Planned &file : planned)
+    {
+        if (file.action == Action::Missing)
+        {
+            std::cerr << "[Missing from the backup]: " << file.relativePath << "\n";
+        }
+    }
+    for (const auto &problem : problems)
+    {
+        std::cerr << "[Restore failed]: " << problem << "\n";
+    }
+
+    std::cout << "\nRestored " << restoredCount << " files (" << restoredBytes / 1024 << " KB) into " << target
+              << " in " << seconds << " Seconds";
+    if (seconds > 0)
+    {
+        std::cout << ": " << restoredBytes / seconds / (1024 * 1024) << " MB/s, " << restoredCount / seconds << " files/s";
+    }
+    std::cout << std::endl
+              << identicalCount << " already identical, " << missingCount << " missing from the backup, "
+              << problems.size() << " failed" << std::endl;
+    return complete && problems.empty() && missingCount == 0;
+}
+
+/**
+ * @brief Load the entries of the restored location (and the chunk lists of a repository)
+ * @details The location of the target directory is used when the metafile has one, so a restore
+ *          in place picks the right entries; otherwise the first location.
+ *
+ * @param metadataFile
+ * @return true
+ * @return false
+ */
+bool RestoreEngine::loadManifest(const std::filesystem::path &metadataFile)
+{
+    if (!repository)
+    {
+        return index.load(metadataFile, target.string());
+    }
+
+    // Chunk lists are only in the json document
+    json data;
+    if (!Manifest::load(metadataFile, data) || !data.contains("location") || !data["location"].is_array())
+    {
+        return false;
+    }
+    const json *location = nullptr;
+    for (const auto &candidate : data["location"])
+    {
+        if (location == nullptr || candidate.value("directory", "") == target.string())
+        {
+            location = &candidate;
+        }
+        if (candidate.value("directory", "") == target.string())
+        {
+            break;
+        }
+    }
+    if (location == nullptr)
+    {
+        return true;
+    }
+    index.loadLocation(*location);
+    if (!location->contains("listFiles"))
+    {
+        return true;
+    }
+    for (const auto &[path, entry] : (*location)["listFiles"].items())
+    {
+        if (!entry.contains("chunks") || !entry["chunks"].is_array())
+        {
+            continue;
+        }
+        std::vector<Sha256Digest> &chunks = chunkLists[path];
+        for (const auto &chunk : entry["chunks"])
+        {
+            Sha256Digest digest;
+            if (chunk.is_string() && Hasher::fromHex(chunk.get<std::string>(), digest))
+            {
+                chunks.push_back(digest);
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Hash the target files whose size matches but whose modification time does not
+ * @details A file whose content matches is identical; run() only gives it its modification time
+ *          back, so planning leaves the target untouched.
+ */
+void RestoreEngine::compareContent()
+{
+    std::vector<size_t> fastFiles, fullFiles;
+    std::vector<std::filesystem::path> fastPaths, fullPaths;
+    for (size_t i = 0; i < planned.size(); ++i)
+    {
+        if (planned[i].action != Action::Compare)
+        {
+            continue;
+        }
+        const ManifestRecord &record = *planned[i].record;
+        if (record.flags & ManifestRecord::HAS_BLAKE3)
+        {
+            fastFiles.push_back(i);
+            fastPaths.push_back(target / planned[i].relativePath);
+        }
+        else if (record.flags & ManifestRecord::HAS_SHA256)
+        {
+            fullFiles.push_back(i);
+            fullPaths.push_back(target / planned[i].relativePath);
+        }
+        else
+        {
+            planned[i].action = Action::Restore;
+        }
+    }
+    if (fastFiles.empty() && fullFiles.empty())
+    {
+        return;
+    }
+
+    auto timer = stats.time(RunPhase::Hash);
+    HashPool hashPool(jobs, useIoUring);
+    std::vector<FileDigest> fastDigests = hashPool.digestFiles(fastPaths, Hasher::BLAKE3);
+    stats.addLatency("hash", hashPool.getLatency());
+    std::vector<FileDigest> fullDigests = hashPool.digestFiles(fullPaths, Hasher::SHA256);
+    stats.addLatency("hash", hashPool.getLatency());
+    stats.set("files.hashed", fastFiles.size() + fullFiles.size());
+
+    auto settle = [this](size_t i, bool same)
+    {
+        Planned &file = planned[i];
+        file.action = same ? Action::Identical : Action::Restore;
+        file.touch = same;
+    };
+    for (size_t i = 0; i < fastFiles.size(); ++i)
+    {
+        settle(fastFiles[i], fastDigests[i].hashes != 0 && fastDigests[i].blake3 == planned[fastFiles[i]].record->blake3);
+    }
+    for (size_t i = 0; i < fullFiles.size(); ++i)
+    {
+        settle(fullFiles[i], fullDigests[i].hashes != 0 && fullDigests[i].sha256 == planned[fullFiles[i]].record->sha256);
+    }
+}
+
+/**
+ * @brief Copy the planned files out of the backup directory with the CopyEngine
+ *
+ * @param problems Receives one line per file that failed
+ * @return true
+ * @return false
+ */
+bool RestoreEngine::restoreCopies(std::vector<std::string> &problems)
+{
+    PathArena arena;
+    std::vector<FileRecord> files;
+    std::vector<const Planned *> sources;
+    uintmax_t totalSize = 0;
+    for (const Planned &file : planned)
+    {
+        if (file.action != Action::Restore)
+        {
+            continue;
+        }
+        FileRecord record;
+        record.relativePath = arena.store(file.relativePath);
+        record.size = file.record->size;
+        record.allocatedSize = record.size;
+        record.mode = file.mode;
+        // A sparse backed up copy only has its data extents copied back
+        struct stat status;
+        if (::stat((filesDir / record.relativePath).c_str(), &status) == 0)
+        {
+            record.allocatedSize = static_cast<uintmax_t>(status.st_blocks) * SparseFile::STAT_BLOCK_SIZE;
+        }
+        totalSize += SparseFile::isSparse(record.size, record.allocatedSize) ? record.allocatedSize : record.size;
+        files.push_back(std::move(record));
+        sources.push_back(&file);
+    }
+    if (files.empty())
+    {
+        return true;
+    }
+
+    CopyEngine engine(jobs, useIoUring, false, Hasher::SHA256);
+    restoredBytes = engine.copyFiles(files, filesDir, target, totalSize);
+    stats.addLatency("copy", engine.getLatency());
+    const auto &strategyCounts = engine.getStrategyCounts();
+    for (size_t i = 0; i < strategyCounts.size(); ++i)
+    {
+        if (strategyCounts[i] != 0)
+        {
+            stats.set(std::string("copy.strategy.") + copyStrategyName(static_cast<CopyStrategy>(i)), strategyCounts[i]);
+        }
+    }
+    for (const auto &error : engine.getErrors())
+    {
+        problems.push_back(error.destination.string() + ": " + error.message);
+    }
+
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        if (!files[i].copied)
+        {
+            continue;
+        }
+        const ManifestRecord &record = *sources[i]->record;
+        restoredCount++;
+        // A copy that does not match keeps its new modification time, so the next restore retries it
+        if ((record.flags & ManifestRecord::HAS_SHA256) && files[i].sha256 != Hasher::toHex(record.sha256))
+        {
+            problems.push_back(std::string(files[i].relativePath) + ": the backed up copy does not match its SHA-256");
+        }
+        else if (record.flags & ManifestRecord::HAS_STAT)
+        {
+            setModified(target / files[i].relativePath, record.mtimeNs);
+        }
+    }
+    return engine.getErrors().empty();
+}
+
+/**
+ * @brief Rebuild the planned files from the chunk repository
+ *
+ * @param problems Receives one line per file that failed
+ * @return true
+ * @return false
+ */
+bool RestoreEngine::restoreChunks(std::vector<std::string> &problems)
+{
+    std::vector<size_t> restored;
+    for (size_t i = 0; i < planned.size(); ++i)
+    {
+        if (planned[i].action == Action::Restore)
+        {
+            restored.push_back(i);
+        }
+    }
+    if (restored.empty())
+    {
+        return true;
+    }
+    ChunkStore store;
+    if (!store.open(backupDir))
+    {
+        return false;
+    }
+
+    std::vector<std::string> failures(restored.size());
+    std::vector<char> written(restored.size(), 0);
+    std::atomic<uint64_t> bytes{0};
+    WorkerPool(jobs).forEach(restored.size(), [&](size_t i, unsigned)
+    {
+        const Planned &file = planned[restored[i]];
+        const ManifestRecord &record = *file.record;
+        std::string relativePath(file.relativePath);
+        TraceSpan span("restore", "restore file", relativePath);
+        auto chunks = chunkLists.find(relativePath);
+        if ((chunks == chunkLists.end() || chunks->second.empty()) && record.size != 0)
+        {
+            failures[i] = relativePath + ": the metafile has no chunk list for it";
+            return;
+        }
+
+        std::filesystem::path destination = target / file.relativePath;
+        std::error_code error;
+        std::filesystem::create_directories(destination.parent_path(), error);
+        FileDescriptor out(::open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, file.mode & 07777));
+        if (!out.valid())
+        {
+            failures[i] = destination.string() + ": " + std::strerror(errno);
+            return;
+        }
+        Sha256 hasher;
+        std::vector<unsigned char> data;
+        if (chunks != chunkLists.end())
+        {
+            for (const Sha256Digest &chunk : chunks->second)
+            {
+                if (!store.read(chunk, data))
+                {
+                    failures[i] = relativePath + ": chunk " + Hasher::toHex(chunk) + " cannot be read";
+                    return;
+                }
+                if (!writeAll(out.get(), data.data(), data.size()))
+                {
+                    failures[i] = destination.string() + ": " + std::strerror(errno);
+                    return;
+                }
+                hasher.update(data.data(), data.size());
+                bytes += data.size();
+            }
+        }
+        out.reset();
+        written[i] = 1;
+        if ((record.flags & ManifestRecord::HAS_SHA256) && hasher.finish() != record.sha256)
+        {
+            failures[i] = relativePath + ": the rebuilt content does not match its SHA-256";
+        }
+        else if (record.flags & ManifestRecord::HAS_STAT)
+        {
+            setModified(destination, record.mtimeNs);
+        }
+    });
+
+    restoredCount = std::count(written.begin(), written.end(), 1);
+    restoredBytes = bytes;
+    for (auto &failure : failures)
+    {
+        if (!failure.empty())
+        {
+            problems.push_back(std::move(failure));
+        }
+    }
+    return problems.empty();
+}
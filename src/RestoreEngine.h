@@ -0,0 +1,107 @@
+#ifndef RESTOREENGINE_H
+#define RESTOREENGINE_H
+
+#include "ManifestIndex.h"
+#include "RunStats.h"
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Restores a backup, or one directory of it, planned from the metafile (`backup restore`)
+ * @details The metafile lists every backed up file with its size, modification time and digests.
+ *          Files already at the target with the same size and modification time are left alone,
+ *          and so are files of the same size whose content hashes to the recorded digest. The
+ *          rest are copied in parallel by the CopyEngine (the same zero-copy backends and
+ *          io_uring batches as a backup) or rebuilt from the chunk repository, checked against
+ *          their recorded SHA-256 and given back their recorded modification time.
+ */
+class RestoreEngine
+{
+public:
+    /**
+     * @brief Construct a new Restore Engine object
+     *
+     * @param jobs Number of concurrent workers (0 means hardware concurrency)
+     * @param useIoUring Copy small files in batches through io_uring
+     * @param stats Receives the timings and counters of the restore
+     */
+    RestoreEngine(unsigned jobs, bool useIoUring, RunStats &stats) : jobs(jobs), useIoUring(useIoUring), stats(stats) {}
+
+    /**
+     * @brief Read the metafile and compare its files with the target (nothing is written)
+     *
+     * @param metadataFile Metafile the backup was written with
+     * @param backupDir Backup directory (a generation, a generations root or a chunk repository)
+     * @param target Directory to restore into (created if needed)
+     * @param subPath Relative path of the file or directory to restore; empty for everything
+     * @return true on success, false when the metafile cannot be read or subPath is not in it
+     */
+    bool plan(const std::filesystem::path &metadataFile, const std::filesystem::path &backupDir,
+              const std::filesystem::path &target, const std::string &subPath);
+
+    /**
+     * @brief Restore the planned files and print a summary
+     *
+     * @return true when every file was restored and matched its digest
+     */
+    bool run();
+
+    size_t getPlannedCount() const { return planned.size(); }       // Get the number of files in the restored path
+    size_t getIdenticalCount() const { return identicalCount; }     // Get the number of files already identical at the target
+    size_t getRestoreCount() const { return restoreCount; }         // Get the number of files that will be restored
+    size_t getMissingCount() const { return missingCount; }         // Get the number of files the backup does not hold
+    size_t getTouchCount() const { return touchCount; }             // Get the number of identical files that get their modification time back
+
+private:
+    /**
+     * @brief What the target needs for one file of the metafile
+     */
+    enum class Action : uint8_t
+    {
+        Restore,   // Absent or different at the target
+        Identical, // Same size and modification time, or same content, at the target
+        Compare,   // Same size at the target, the content decides
+        Missing    // Not in the backup directory
+    };
+
+    /**
+     * @brief One file to restore
+     */
+    struct Planned
+    {
+        std::string_view relativePath;
+        const ManifestRecord *record;
+        uint32_t mode = 0;          // Permission bits of the backed up copy
+        Action action = Action::Restore;
+        bool touch = false;         // Identical content whose modification time run() gives back
+    };
+
+    unsigned jobs;
+    bool useIoUring;
+    RunStats &stats;
+
+    ManifestIndex index;
+    std::unordered_map<std::string, std::vector<Sha256Digest>> chunkLists; // Repository mode only
+    std::vector<Planned> planned;  // Sorted by relative path
+    std::filesystem::path filesDir;
+    std::filesystem::path backupDir;
+    std::filesystem::path target;
+    bool repository = false;
+    size_t identicalCount = 0;
+    size_t restoreCount = 0;
+    size_t missingCount = 0;
+    size_t touchCount = 0;
+    size_t restoredCount = 0;
+    uint64_t restoredBytes = 0;
+
+    bool loadManifest(const std::filesystem::path &metadataFile);
+    void compareContent();
+    bool restoreCopies(std::vector<std::string> &problems);
+    bool restoreChunks(std::vector<std::string> &problems);
+};
+
+#endif // RESTOREENGINE_H
@@ -0,0 +1,184 @@
+#include "RunStats.h"
+#include "Trace.h"
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <sys/resource.h>
+
+using json = nlohmann::json;
+
+#if defined(__linux__)
+namespace
+{
+    constexpr const char *IO_FIELDS[] = {"rchar", "wchar", "syscr", "syscw", "read_bytes", "write_bytes"};
+}
+#endif
+
+RunStats::Timer::Timer(RunStats &stats, RunPhase phase)
+    : stats(stats), phase(phase), wallStart(std::chrono::steady_clock::now()),
+      cpuStartNs(cpuTimeNs()), ioStart(readProcessIo()), traceStartNs(Trace::enabled() ? Trace::now() : -1)
+{
+}
+
+RunStats::Timer::~Timer()
+{
+    PhaseTotals &totals = stats.phases[static_cast<size_t>(phase)];
+    std::array<uint64_t, 6> ioEnd = readProcessIo();
+    for (size_t i = 0; i < ioEnd.size(); ++i)
+    {
+        totals.io[i] += ioEnd[i] - std::min(ioEnd[i], ioStart[i]);
+    }
+    totals.cpuNs += cpuTimeNs() - cpuStartNs;
+    totals.wallNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - wallStart).count();
+    if (traceStartNs >= 0)
+    {
+        Trace::record("phase", phaseName(phase), traceStartNs, Trace::now(), {});
+    }
+}
+
+RunStats::RunStats() : created(std::chrono::steady_clock::now())
+{
+}
+
+/**
+ * @brief Get the name of a phase in the report
+ *
+ * @param phase
+ * @return const char*
+ */
+const char *RunStats::phaseName(RunPhase phase)
+{
+    switch (phase)
+    {
+    case RunPhase::Scan:
+        return "scan";
+    case RunPhase::Diff:
+        return "diff";
+    case RunPhase::Hash:
+        return "hash";
+    case RunPhase::Copy:
+        return "copy";
+    case RunPhase::Metadata:
+        return "metadata";
+    default:
+        return "unknown";
+    }
+}
+
+/**
+ * @brief Build the report
+ *
+ * @param info
+ * @return json
+ */
+json RunStats::toJson(const json &info) const
+{
+    json report = info;
+    report["wallSeconds"] = std::chrono::duration<double>(std::chrono::steady_clock::now() - created).count();
+
+    struct rusage usage;
+    if (::getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+#if defined(__APPLE__)
+        report["peakRssKB"] = usage.ru_maxrss / 1024;
+#else
+        report["peakRssKB"] = usage.ru_maxrss;
+#endif
+    }
+
+    json &phaseReport = report["phases"] = json::object();
+    for (size_t index = 0; index < phases.size(); ++index)
+    {
+        const PhaseTotals &totals = phases[index];
+        json &entry = phaseReport[phaseName(static_cast<RunPhase>(index))];
+        entry["wallSeconds"] = totals.wallNs / 1e9;
+        entry["cpuSeconds"] = totals.cpuNs / 1e9;
+        entry["bytesRead"] = totals.io[0];
+        entry["bytesWritten"] = totals.io[1];
+        entry["readSyscalls"] = totals.io[2];
+        entry["writeSyscalls"] = totals.io[3];
+        entry["storageBytesRead"] = totals.io[4];
+        entry["storageBytesWritten"] = totals.io[5];
+    }
+
+    report["counters"] = counters;
+
+    json &latencyReport = report["latencyUs"] = json::object();
+    for (const auto &[name, histogram] : latencies)
+    {
+        json &entry = latencyReport[name];
+        entry["count"] = histogram.count;
+        entry["mean"] = histogram.count ? histogram.totalUs / histogram.count : 0;
+        entry["p50"] = histogram.percentile(0.5);
+        entry["p90"] = histogram.percentile(0.9);
+        entry["p99"] = histogram.percentile(0.99);
+        entry["max"] = histogram.maxUs;
+        // Only the used buckets, keyed by their upper bound ("le" as in Prometheus)
+        json &buckets = entry["buckets"] = json::array();
+        for (size_t bucket = 0; bucket < LatencyHistogram::BUCKETS; ++bucket)
+        {
+            if (histogram.counts[bucket] != 0)
+            {
+                buckets.push_back({{"le", uint64_t{1} << bucket}, {"count", histogram.counts[bucket]}});
+            }
+        }
+    }
+    return report;
+}
+
+/**
+ * @brief Write the report to a file
+ *
+ * @param file
+ * @param info
+ * @return true
+ * @return false
+ */
+bool RunStats::write(const std::filesystem::path &file, const json &info) const
+{
+    std::ofstream output(file, std::ios::trunc);
+    output << toJson(info).dump(4) << std::endl;
+    return static_cast<bool>(output);
+}
+
+/**
+ * @brief CPU time of all threads of the process
+ *
+ * @return int64_t
+ */
+int64_t RunStats::cpuTimeNs()
+{
+    struct timespec time;
+    if (::clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time) != 0)
+    {
+        return 0;
+    }
+    return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+/**
+ * @brief Read the I/O counters of the process from /proc/self/io
+ *
+ * @return std::array<uint64_t, 6> All zero where /proc/self/io does not exist
+ */
+std::array<uint64_t, 6> RunStats::readProcessIo()
+{
+    std::array<uint64_t, 6> values{};
+#if defined(__linux__)
+    std::ifstream input("/proc/self/io");
+    std::string name;
+    uint64_t value;
+    while (input >> name >> value)
+    {
+        name.pop_back(); // "rchar:" -> "rchar"
+        for (size_t i = 0; i < values.size(); ++i)
+        {
+            if (name == IO_FIELDS[i])
+            {
+                values[i] = value;
+            }
+        }
+    }
+#endif
+    return values;
+}
@@ -0,0 +1,114 @@
+#ifndef RUNSTATS_H
+#define RUNSTATS_H
+
+#include "LatencyHistogram.h"
+#include "../include/nlohmann/json.hpp"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+
+/**
+ * @brief Phases of a backup run
+ */
+enum class RunPhase
+{
+    Scan,     // Walking the source directory (or reading the change journal)
+    Diff,     // Loading the metafile and comparing the files with it
+    Hash,     // Hashing the files whose stat data changed
+    Copy,     // Copying or storing the files
+    Metadata, // Writing the metafile
+    Count
+};
+
+/**
+ * @brief Per-phase timings and the counters of one backup run, written with --stats-json
+ * @details Each phase accumulates wall time, CPU time of the whole process and, on Linux, the
+ *          deltas of /proc/self/io (bytes and read/write system calls of all threads). Timing a
+ *          phase costs two clock reads and two small file reads, so it is always on. With --trace
+ *          every timed phase also becomes a span of the trace.
+ */
+class RunStats
+{
+public:
+    /**
+     * @brief Adds the time until its destruction to a phase
+     */
+    class Timer
+    {
+    public:
+        Timer(RunStats &stats, RunPhase phase);
+        ~Timer();
+        Timer(const Timer &) = delete;
+        Timer &operator=(const Timer &) = delete;
+
+    private:
+        RunStats &stats;
+        RunPhase phase;
+        std::chrono::steady_clock::time_point wallStart;
+        int64_t cpuStartNs;
+        std::array<uint64_t, 6> ioStart;
+        int64_t traceStartNs; // -1 when not tracing
+    };
+
+    RunStats();
+
+    /**
+     * @brief Time a phase until the returned timer goes out of scope
+     *
+     * @param phase
+     * @return Timer
+     */
+    Timer time(RunPhase phase) { return Timer(*this, phase); }
+
+    void add(const std::string &name, uint64_t value) { counters[name] += value; } // Add to a counter
+    void set(const std::string &name, uint64_t value) { counters[name] = value; }  // Set a counter
+
+    /**
+     * @brief Add per-file latencies under a name (merged with earlier ones of the same name)
+     *
+     * @param name
+     * @param histogram
+     */
+    void addLatency(const std::string &name, const LatencyHistogram &histogram) { latencies[name].merge(histogram); }
+
+    /**
+     * @brief Build the report
+     *
+     * @param info Run description (mode, directories, ...) copied to the top level
+     * @return nlohmann::json
+     */
+    nlohmann::json toJson(const nlohmann::json &info) const;
+
+    /**
+     * @brief Write the report to a file
+     *
+     * @param file
+     * @param info
+     * @return true
+     * @return false
+     */
+    bool write(const std::filesystem::path &file, const nlohmann::json &info) const;
+
+    static const char *phaseName(RunPhase phase); // Get the name of a phase in the report
+
+private:
+    struct PhaseTotals
+    {
+        int64_t wallNs = 0;
+        int64_t cpuNs = 0;
+        std::array<uint64_t, 6> io{}; // rchar, wchar, syscr, syscw, read_bytes, write_bytes
+    };
+
+    std::chrono::steady_clock::time_point created;
+    std::array<PhaseTotals, static_cast<size_t>(RunPhase::Count)> phases{};
+    std::map<std::string, uint64_t> counters;
+    std::map<std::string, LatencyHistogram> latencies;
+
+    static int64_t cpuTimeNs();
+    static std::array<uint64_t, 6> readProcessIo();
+};
+
+#endif // RUNSTATS_H
@@ -0,0 +1,519 @@
+#include "Sha256Batch.h"
+#include "Hasher.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA256_BATCH_X86 1
+#endif
+
+namespace
+{
+    constexpr size_t BLOCK_SIZE = 64;
+
+    constexpr uint32_t INITIAL_STATE[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                           0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+    alignas(64) constexpr uint32_t K[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+    /**
+     * @brief A message as the blocks the compression function sees: its whole blocks in place and
+     *        the padded tail (one or two blocks) in a copy
+     */
+    struct PaddedMessage
+    {
+        const unsigned char *data = nullptr;
+        size_t size = 0;
+        size_t wholeBlocks = 0;
+        size_t blocks = 0;
+        alignas(32) unsigned char tail[2 * BLOCK_SIZE];
+
+        void set(const unsigned char *message, size_t messageSize)
+        {
+            data = message;
+            size = messageSize;
+            wholeBlocks = size / BLOCK_SIZE;
+            size_t rest = size % BLOCK_SIZE;
+            size_t tailBlocks = rest + 9 > BLOCK_SIZE ? 2 : 1;
+            std::memset(tail, 0, sizeof(tail));
+            if (rest > 0)
+            {
+                std::memcpy(tail, data + wholeBlocks * BLOCK_SIZE, rest);
+            }
+            tail[rest] = 0x80;
+            uint64_t bits = static_cast<uint64_t>(size) * 8;
+            for (size_t i = 0; i < 8; ++i)
+            {
+                tail[tailBlocks * BLOCK_SIZE - 1 - i] = static_cast<unsigned char>(bits >> (8 * i));
+            }
+            blocks = wholeBlocks + tailBlocks;
+        }
+
+        const unsigned char *block(size_t index) const
+        {
+            return index < wholeBlocks ? data + index * BLOCK_SIZE : tail + (index - wholeBlocks) * BLOCK_SIZE;
+        }
+    };
+
+    /**
+     * @brief Hash count (at most the kernel's lanes) padded messages
+     */
+    using Kernel = void (*)(const PaddedMessage *const *messages, size_t count, Sha256Digest *const *digests);
+
+    /**
+     * @brief One message at a time through a streaming OpenSSL context
+     */
+    void hashOpenssl(const PaddedMessage *const *messages, size_t count, Sha256Digest *const *digests)
+    {
+        thread_local Sha256 sha256;
+        for (size_t i = 0; i < count; ++i)
+        {
+            sha256.update(messages[i]->data, messages[i]->size);
+            *digests[i] = sha256.finish();
+        }
+    }
+
+#if defined(SHA256_BATCH_X86)
+    /**
+     * @brief The 64 rounds of one block for each of N streams with the SHA extensions
+     * @details The state is kept as the ABEF/CDGH register pair the instructions expect. The
+     *          streams are independent, so interleaving them hides the latency of sha256rnds2.
+     */
+    template <size_t N>
+    __attribute__((target("sha,sse4.1"), always_inline)) inline void compressShaNi(__m128i *abef, __m128i *cdgh,
+                                                                                  const unsigned char *const *blocks)
+    {
+        const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+        __m128i savedAbef[N];
+        __m128i savedCdgh[N];
+        __m128i message[N][4];
+        for (size_t s = 0; s < N; ++s)
+        {
+            savedAbef[s] = abef[s];
+            savedCdgh[s] = cdgh[s];
+            for (size_t q = 0; q < 4; ++q)
+            {
+                message[s][q] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(blocks[s] + 16 * q)), byteSwap);
+            }
+        }
+
+#pragma GCC unroll 16
+        for (size_t q = 0; q < 16; ++q)
+        {
+            const __m128i k = _mm_load_si128(reinterpret_cast<const __m128i *>(K + 4 * q));
+            for (size_t s = 0; s < N; ++s)
+            {
+                __m128i *w = message[s];
+                if (q >= 4)
+                {
+                    // W[t..t+3] from the four previous quads
+                    __m128i sum = _mm_add_epi32(_mm_sha256msg1_epu32(w[q % 4], w[(q + 1) % 4]),
+                                                _mm_alignr_epi8(w[(q + 3) % 4], w[(q + 2) % 4], 4));
+                    w[q % 4] = _mm_sha256msg2_epu32(sum, w[(q + 3) % 4]);
+                }
+                __m128i input = _mm_add_epi32(w[q % 4], k);
+                cdgh[s] = _mm_sha256rnds2_epu32(cdgh[s], abef[s], input);
+                abef[s] = _mm_sha256rnds2_epu32(abef[s], cdgh[s], _mm_shuffle_epi32(input, 0x0e));
+            }
+        }
+
+        for (size_t s = 0; s < N; ++s)
+        {
+            abef[s] = _mm_add_epi32(abef[s], savedAbef[s]);
+            cdgh[s] = _mm_add_epi32(cdgh[s], savedCdgh[s]);
+        }
+    }
+
+    constexpr size_t SHA_NI_STREAMS = 2; // Interleaved streams; more only add register pressure, sha256rnds2 throughput is the limit
+
+    /**
+     * @brief SHA_NI_STREAMS messages at a time with the SHA extensions
+     * @details The blocks all streams share are compressed together; the rest of each longer
+     *          message is compressed alone.
+     */
+    __attribute__((target("sha,sse4.1"))) void hashShaNi(const PaddedMessage *const *messages, size_t count,
+                                                        Sha256Digest *const *digests)
+    {
+        const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+        const __m128i dcba = _mm_loadu_si128(reinterpret_cast<const __m128i *>(INITIAL_STATE));
+        const __m128i hgfe = _mm_loadu_si128(reinterpret_cast<const __m128i *>(INITIAL_STATE + 4));
+        const __m128i cdab = _mm_shuffle_epi32(dcba, 0xb1);
+        const __m128i efgh = _mm_shuffle_epi32(hgfe, 0x1b);
+
+        for (size_t first = 0; first < count; first += SHA_NI_STREAMS)
+        {
+            size_t streams = std::min(SHA_NI_STREAMS, count - first);
+            const PaddedMessage *const *group = messages + first;
+
+            __m128i abef[SHA_NI_STREAMS];
+            __m128i cdgh[SHA_NI_STREAMS];
+            size_t shared = group[0]->blocks;
+            for (size_t s = 0; s < SHA_NI_STREAMS; ++s)
+            {
+                abef[s] = _mm_alignr_epi8(cdab, efgh, 8);
+                cdgh[s] = _mm_blend_epi16(efgh, cdab, 0xf0);
+                shared = s < streams ? std::min(shared, group[s]->blocks) : 0;
+            }
+
+            for (size_t block = 0; block < shared; ++block)
+            {
+                const unsigned char *blocks[SHA_NI_STREAMS];
+                for (size_t s = 0; s < SHA_NI_STREAMS; ++s)
+                {
+                    blocks[s] = group[s]->block(block);
+                }
+                compressShaNi<SHA_NI_STREAMS>(abef, cdgh, blocks);
+            }
+            for (size_t s = 0; s < streams; ++s)
+            {
+                for (size_t block = shared; block < group[s]->blocks; ++block)
+                {
+                    const unsigned char *blocks[1] = {group[s]->block(block)};
+                    compressShaNi<1>(abef + s, cdgh + s, blocks);
+                }
+
+                // ABEF/CDGH back to the big-endian byte order of the digest
+                const __m128i feba = _mm_shuffle_epi32(abef[s], 0x1b);
+                const __m128i dchg = _mm_shuffle_epi32(cdgh[s], 0xb1);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(digests[first + s]->data()),
+                                 _mm_shuffle_epi8(_mm_blend_epi16(feba, dchg, 0xf0), byteSwap));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(digests[first + s]->data() + 16),
+                                 _mm_shuffle_epi8(_mm_alignr_epi8(dchg, feba, 8), byteSwap));
+            }
+        }
+    }
+
+    template <int Count>
+    __attribute__((target("avx2"), always_inline)) inline __m256i rotr(__m256i x)
+    {
+        return _mm256_or_si256(_mm256_srli_epi32(x, Count), _mm256_slli_epi32(x, 32 - Count));
+    }
+
+    /**
+     * @brief Transpose an 8x8 matrix of 32-bit words held in eight registers
+     */
+    __attribute__((target("avx2"), always_inline)) inline void transpose8(__m256i *rows)
+    {
+        __m256i ab0145 = _mm256_unpacklo_epi32(rows[0], rows[1]);
+        __m256i ab2367 = _mm256_unpackhi_epi32(rows[0], rows[1]);
+        __m256i cd0145 = _mm256_unpacklo_epi32(rows[2], rows[3]);
+        __m256i cd2367 = _mm256_unpackhi_epi32(rows[2], rows[3]);
+        __m256i ef0145 = _mm256_unpacklo_epi32(rows[4], rows[5]);
+        __m256i ef2367 = _mm256_unpackhi_epi32(rows[4], rows[5]);
+        __m256i gh0145 = _mm256_unpacklo_epi32(rows[6], rows[7]);
+        __m256i gh2367 = _mm256_unpackhi_epi32(rows[6], rows[7]);
+
+        __m256i abcd04 = _mm256_unpacklo_epi64(ab0145, cd0145);
+        __m256i abcd15 = _mm256_unpackhi_epi64(ab0145, cd0145);
+        __m256i abcd26 = _mm256_unpacklo_epi64(ab2367, cd2367);
+        __m256i abcd37 = _mm256_unpackhi_epi64(ab2367, cd2367);
+        __m256i efgh04 = _mm256_unpacklo_epi64(ef0145, gh0145);
+        __m256i efgh15 = _mm256_unpackhi_epi64(ef0145, gh0145);
+        __m256i efgh26 = _mm256_unpacklo_epi64(ef2367, gh2367);
+        __m256i efgh37 = _mm256_unpackhi_epi64(ef2367, gh2367);
+
+        rows[0] = _mm256_permute2x128_si256(abcd04, efgh04, 0x20);
+        rows[1] = _mm256_permute2x128_si256(abcd15, efgh15, 0x20);
+        rows[2] = _mm256_permute2x128_si256(abcd26, efgh26, 0x20);
+        rows[3] = _mm256_permute2x128_si256(abcd37, efgh37, 0x20);
+        rows[4] = _mm256_permute2x128_si256(abcd04, efgh04, 0x31);
+        rows[5] = _mm256_permute2x128_si256(abcd15, efgh15, 0x31);
+        rows[6] = _mm256_permute2x128_si256(abcd26, efgh26, 0x31);
+        rows[7] = _mm256_permute2x128_si256(abcd37, efgh37, 0x31);
+    }
+
+    /**
+     * @brief Up to eight messages in the 32-bit lanes of the AVX2 registers
+     * @details Word i of every state lives in state[i] and each block of the eight messages is
+     *          loaded and transposed so that w[i] holds message word i of every lane. A lane whose
+     *          message has no more blocks compresses a block of zeros and keeps its state.
+     */
+    __attribute__((target("avx2"))) void hashAvx2(const PaddedMessage *const *messages, size_t count,
+                                                 Sha256Digest *const *digests)
+    {
+        alignas(32) static const unsigned char ZERO_BLOCK[BLOCK_SIZE] = {};
+        const __m256i byteSwap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                                  3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+        alignas(32) int32_t blockCounts[Sha256Batch::LANES] = {};
+        size_t maxBlocks = 0;
+        for (size_t lane = 0; lane < count; ++lane)
+        {
+            blockCounts[lane] = static_cast<int32_t>(messages[lane]->blocks);
+            maxBlocks = std::max(maxBlocks, messages[lane]->blocks);
+        }
+        const __m256i laneBlocks = _mm256_load_si256(reinterpret_cast<const __m256i *>(blockCounts));
+
+        __m256i state[8];
+        for (size_t i = 0; i < 8; ++i)
+        {
+            state[i] = _mm256_set1_epi32(static_cast<int>(INITIAL_STATE[i]));
+        }
+
+        for (size_t block = 0; block < maxBlocks; ++block)
+        {
+            __m256i w[16];
+            for (size_t lane = 0; lane < Sha256Batch::LANES; ++lane)
+            {
+                const unsigned char *data = lane < count && block < messages[lane]->blocks ? messages[lane]->block(block) : ZERO_BLOCK;
+                w[lane] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+                w[lane + 8] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + 32));
+            }
+            transpose8(w);
+            transpose8(w + 8);
+            for (size_t i = 0; i < 16; ++i)
+            {
+                w[i] = _mm256_shuffle_epi8(w[i], byteSwap);
+            }
+
+            // v[(i - t) & 7] is working variable i (a..h) in round t, so no variable is ever moved
+            __m256i v[8];
+            std::copy_n(state, 8, v);
+#pragma GCC unroll 64
+            for (size_t t = 0; t < 64; ++t)
+            {
+                if (t >= 16)
+                {
+                    __m256i w2 = w[(t - 2) % 16];
+                    __m256i w15 = w[(t - 15) % 16];
+                    __m256i sigma1 = _mm256_xor_si256(_mm256_xor_si256(rotr<17>(w2), rotr<19>(w2)), _mm256_srli_epi32(w2, 10));
+                    __m256i sigma0 = _mm256_xor_si256(_mm256_xor_si256(rotr<7>(w15), rotr<18>(w15)), _mm256_srli_epi32(w15, 3));
+                    w[t % 16] = _mm256_add_epi32(_mm256_add_epi32(w[t % 16], sigma0), _mm256_add_epi32(w[(t - 7) % 16], sigma1));
+                }
+                __m256i &a = v[(0 - t) & 7];
+                __m256i &b = v[(1 - t) & 7];
+                __m256i &c = v[(2 - t) & 7];
+                __m256i &d = v[(3 - t) & 7];
+                __m256i &e = v[(4 - t) & 7];
+                __m256i &f = v[(5 - t) & 7];
+                __m256i &g = v[(6 - t) & 7];
+                __m256i &h = v[(7 - t) & 7];
+                __m256i bigSigma1 = _mm256_xor_si256(_mm256_xor_si256(rotr<6>(e), rotr<11>(e)), rotr<25>(e));
+                __m256i choose = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+                __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, bigSigma1),
+                                              _mm256_add_epi32(_mm256_add_epi32(choose, w[t % 16]),
+                                                               _mm256_set1_epi32(static_cast<int>(K[t]))));
+                __m256i bigSigma0 = _mm256_xor_si256(_mm256_xor_si256(rotr<2>(a), rotr<13>(a)), rotr<22>(a));
+                __m256i majority = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+                d = _mm256_add_epi32(d, t1);
+                h = _mm256_add_epi32(t1, _mm256_add_epi32(bigSigma0, majority));
+            }
+
+            const __m256i active = _mm256_cmpgt_epi32(laneBlocks, _mm256_set1_epi32(static_cast<int>(block)));
+            for (size_t i = 0; i < 8; ++i)
+            {
+                state[i] = _mm256_blendv_epi8(state[i], _mm256_add_epi32(state[i], v[i]), active);
+            }
+        }
+
+        // Transposed back, register i holds the state of lane i
+        transpose8(state);
+        for (size_t lane = 0; lane < count; ++lane)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(digests[lane]->data()), _mm256_shuffle_epi8(state[lane], byteSwap));
+        }
+    }
+
+    /**
+     * @brief Check for the SHA extensions (CPUID leaf 7, EBX bit 29)
+     */
+    bool hasShaExtensions()
+    {
+        unsigned eax = 0;
+        unsigned ebx = 0;
+        unsigned ecx = 0;
+        unsigned edx = 0;
+        return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & (1u << 29)) != 0;
+    }
+#endif
+
+    struct KernelChoice
+    {
+        Kernel hash;
+        size_t lanes;
+        const char *name;
+        bool (*supported)();
+    };
+
+    bool alwaysSupported()
+    {
+        return true;
+    }
+
+#if defined(SHA256_BATCH_X86)
+    bool shaNiSupported()
+    {
+        __builtin_cpu_init(); // May run before the library's own initialisation
+        return hasShaExtensions() && __builtin_cpu_supports("sse4.1");
+    }
+
+    bool avx2Supported()
+    {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+
+    // Every compiled kernel, preferred first; the last one runs anywhere
+    const KernelChoice KERNELS[] = {
+#if defined(SHA256_BATCH_X86)
+        {hashShaNi, SHA_NI_STREAMS, "sha-ni", shaNiSupported},
+        {hashAvx2, Sha256Batch::LANES, "avx2", avx2Supported},
+#endif
+        {hashOpenssl, 1, "openssl", alwaysSupported}};
+
+    KernelChoice selectKernel()
+    {
+        for (const KernelChoice &candidate : KERNELS)
+        {
+            if (candidate.supported())
+            {
+                return candidate;
+            }
+        }
+        return KERNELS[std::size(KERNELS) - 1];
+    }
+
+    const KernelChoice kernel = selectKernel();
+
+    /**
+     * @brief Hash count messages with one kernel, in groups of its lanes
+     * @details The messages are ordered by size so that each group handed to the kernel holds
+     *          messages of similar length and no lane idles long while the others finish.
+     */
+    void hashWith(const KernelChoice &choice, const unsigned char *const *messages, const size_t *sizes,
+                  size_t count, Sha256Digest *digests)
+    {
+        std::vector<size_t> order(count);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](size_t left, size_t right)
+                         { return sizes[left] > sizes[right]; });
+
+        PaddedMessage padded[Sha256Batch::LANES];
+        const PaddedMessage *group[Sha256Batch::LANES];
+        Sha256Digest *out[Sha256Batch::LANES];
+        for (size_t first = 0; first < count; first += choice.lanes)
+        {
+            size_t size = std::min(choice.lanes, count - first);
+            for (size_t i = 0; i < size; ++i)
+            {
+                size_t index = order[first + i];
+                padded[i].set(messages[index], sizes[index]);
+                group[i] = &padded[i];
+                out[i] = &digests[index];
+            }
+            choice.hash(group, size, out);
+        }
+    }
+
+    /**
+     * @brief SHA-256 of the first size bytes of the pattern i % 251, across the padding
+     *        boundaries (55/56/64 bytes) and over several blocks
+     */
+    struct KnownAnswer
+    {
+        size_t size;
+        const char *digest;
+    };
+
+    constexpr KnownAnswer KNOWN_ANSWERS[] = {
+        {0, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        {55, "463eb28e72f82e0a96c0a4cc53690c571281131f672aa229e0d45ae59b598b59"},
+        {56, "da2ae4d6b36748f2a318f23e7ab1dfdf45acdc9d049bd80e59de82a60895f562"},
+        {64, "fdeab9acf3710362bd2658cdc9a29e8f9c757fcf9811603a8c447cd1d9151108"},
+        {1024, "2bce1ba628720664be4b9fdd77aae0678e5f0f3f02fc6ff641ec879094f6a404"},
+        {1025, "bc0b6b10b89b9487a12fda2a8cc13194e7091c217aabf8b92846274026f4bcd0"},
+        {2048, "b2a8170614e23194ae2951423d601987f518ce2f11205d7b0b708080103b9f76"}};
+}
+
+/**
+ * @brief Get the name of the kernel in use
+ *
+ * @return const char*
+ */
+const char *Sha256Batch::implementation()
+{
+    return kernel.name;
+}
+
+/**
+ * @brief Calculate the SHA-256 of count whole messages
+ *
+ * @param messages
+ * @param sizes
+ * @param count
+ * @param digests
+ */
+void Sha256Batch::hash(const unsigned char *const *messages, const size_t *sizes, size_t count, Sha256Digest *digests)
+{
+    hashWith(kernel, messages, sizes, count, digests);
+}
+
+/**
+ * @brief Check every compiled kernel against known digests
+ * @details Every size is hashed twice in one batch, so full groups, a partial group and lanes
+ *          of different lengths are all exercised.
+ *
+ * @param report
+ * @return true
+ * @return false
+ */
+bool Sha256Batch::selfTest(std::vector<std::string> &report)
+{
+    std::vector<unsigned char> pattern(KNOWN_ANSWERS[std::size(KNOWN_ANSWERS) - 1].size);
+    for (size_t i = 0; i < pattern.size(); ++i)
+    {
+        pattern[i] = static_cast<unsigned char>(i % 251);
+    }
+    std::vector<const unsigned char *> messages;
+    std::vector<size_t> sizes;
+    for (int copy = 0; copy < 2; ++copy)
+    {
+        for (const KnownAnswer &answer : KNOWN_ANSWERS)
+        {
+            messages.push_back(pattern.data());
+            sizes.push_back(answer.size);
+        }
+    }
+
+    bool passed = true;
+    for (const KernelChoice &candidate : KERNELS)
+    {
+        std::string line = std::string("sha256 ") + candidate.name + ":";
+        if (!candidate.supported())
+        {
+            report.push_back(line + " not supported by this CPU, skipped");
+            continue;
+        }
+        std::vector<Sha256Digest> digests(messages.size());
+        hashWith(candidate, messages.data(), sizes.data(), messages.size(), digests.data());
+        std::string failed;
+        for (size_t i = 0; i < std::size(KNOWN_ANSWERS); ++i)
+        {
+            const KnownAnswer &answer = KNOWN_ANSWERS[i];
+            if (Hasher::toHex(digests[i]) != answer.digest ||
+                Hasher::toHex(digests[i + std::size(KNOWN_ANSWERS)]) != answer.digest)
+            {
+                failed += " " + std::to_string(answer.size);
+            }
+        }
+        report.push_back(line + (failed.empty() ? " ok" : " FAILED at sizes" + failed));
+        passed = passed && failed.empty();
+    }
+    return passed;
+}
@@ -0,0 +1,52 @@
+#ifndef SHA256BATCH_H
+#define SHA256BATCH_H
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+using Sha256Digest = std::array<unsigned char, 32>;
+
+/**
+ * @brief SHA-256 of many independent messages at once
+ * @details A single SHA-256 is a serial chain of rounds, so a small file leaves most of the core
+ *          idle and pays the per-message setup of a streaming context. Hashing several whole
+ *          messages together fills the pipeline instead: two interleaved streams with the SHA
+ *          extensions, or eight messages in the 32-bit lanes of the AVX2 registers on CPUs
+ *          without them (checked at run time). Messages are grouped by length so the lanes of a
+ *          group finish together.
+ */
+class Sha256Batch
+{
+public:
+    static constexpr size_t LANES = 8; // Messages hashed together by the widest kernel
+
+    /**
+     * @brief Calculate the SHA-256 of count whole messages
+     *
+     * @param messages Start of every message
+     * @param sizes Size of every message in bytes
+     * @param count Number of messages (any number; they are processed in groups)
+     * @param digests Receives the digest of every message, in the same order
+     */
+    static void hash(const unsigned char *const *messages, const size_t *sizes, size_t count, Sha256Digest *digests);
+
+    /**
+     * @brief Get the name of the kernel in use
+     *
+     * @return const char* "sha-ni", "avx2" or "openssl"
+     */
+    static const char *implementation();
+
+    /**
+     * @brief Check every compiled kernel the CPU supports against known digests, across the
+     *        padding boundaries and for groups of mixed lengths
+     *
+     * @param report Receives one line per kernel
+     * @return true if no kernel gave a wrong digest
+     */
+    static bool selfTest(std::vector<std::string> &report);
+};
+
+#endif // SHA256BATCH_H
@@ -0,0 +1,49 @@
+#include "SparseFile.h"
+#include <cerrno>
+#include <unistd.h>
+
+/**
+ * @brief Find the first data extent at or after offset
+ *
+ * @param fd
+ * @param offset
+ * @param size
+ * @param extent
+ * @return true
+ * @return false
+ */
+bool SparseFile::nextData(int fd, uint64_t offset, uint64_t size, Extent &extent)
+{
+    if (offset >= size)
+    {
+        return false;
+    }
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    off_t data = ::lseek(fd, static_cast<off_t>(offset), SEEK_DATA);
+    if (data < 0)
+    {
+        if (errno == ENXIO)
+        {
+            return false; // Nothing but a hole up to the end of the file
+        }
+        extent = {offset, size - offset};
+        return true;
+    }
+    if (static_cast<uint64_t>(data) >= size)
+    {
+        return false;
+    }
+    off_t hole = ::lseek(fd, data, SEEK_HOLE);
+    uint64_t end = size;
+    if (hole > data && static_cast<uint64_t>(hole) < size)
+    {
+        end = static_cast<uint64_t>(hole);
+    }
+    extent = {static_cast<uint64_t>(data), end - static_cast<uint64_t>(data)};
+    return true;
+#else
+    (void)fd;
+    extent = {offset, size - offset};
+    return true;
+#endif
+}
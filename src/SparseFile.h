@@ -0,0 +1,50 @@
+#ifndef SPARSEFILE_H
+#define SPARSEFILE_H
+
+#include <cstdint>
+
+/**
+ * @brief Finds the data extents of sparse files with lseek(SEEK_DATA/SEEK_HOLE)
+ * @details A hole reads back as zeros but takes no space on disk. Copying only the data
+ *          extents leaves the same holes at the destination, and hashing a hole as a run of
+ *          zeros gives the same digest as reading it, without the reads.
+ */
+class SparseFile
+{
+public:
+    static constexpr uint64_t STAT_BLOCK_SIZE = 512;    // Unit of st_blocks
+    static constexpr uint64_t MIN_HOLE_SIZE = 64 * 1024; // Smaller gaps are not worth walking the extents for
+
+    /**
+     * @brief A run of data, [offset, offset + length)
+     */
+    struct Extent
+    {
+        uint64_t offset = 0;
+        uint64_t length = 0;
+    };
+
+    /**
+     * @brief Whether a file has enough unallocated bytes to be copied and hashed extent by extent
+     *
+     * @param size Logical size (st_size)
+     * @param allocatedSize Bytes allocated on disk (st_blocks * STAT_BLOCK_SIZE)
+     * @return true
+     * @return false
+     */
+    static bool isSparse(uint64_t size, uint64_t allocatedSize) { return allocatedSize + MIN_HOLE_SIZE <= size; }
+
+    /**
+     * @brief Find the first data extent at or after offset
+     *
+     * @param fd Moves the file offset of fd
+     * @param offset
+     * @param size Logical size of the file; extents end there at the latest
+     * @param extent Receives the extent
+     * @return true when an extent was found, false when only a hole is left
+     * @note Without SEEK_DATA support the rest of the file is one data extent
+     */
+    static bool nextData(int fd, uint64_t offset, uint64_t size, Extent &extent);
+};
+
+#endif // SPARSEFILE_H
@@ -0,0 +1,260 @@
+#include "Trace.h"
+#include "../include/nlohmann/json.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> Trace::active{false};
+
+namespace
+{
+    struct Event
+    {
+        const char *category;
+        const char *name;
+        int64_t startNs;
+        int64_t durationNs;
+        uint32_t detailSize;
+        char detail[Trace::DETAIL_SIZE];
+    };
+
+    /**
+     * @brief The ring of one track; written only by the thread that holds it
+     */
+    struct ThreadBuffer
+    {
+        std::string name;
+        uint32_t tid = 0;
+        bool inUse = false;
+        uint64_t written = 0; // Events ever recorded; the ring holds the last EVENTS_PER_THREAD of them
+        std::unique_ptr<Event[]> events;
+    };
+
+    /**
+     * @brief Owns every buffer, so that the events of finished threads survive until the trace is written
+     * @note Never destroyed: the trace is written by an atexit handler
+     */
+    struct Registry
+    {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+        std::filesystem::path file;
+        std::chrono::steady_clock::time_point epoch;
+    };
+
+    Registry &registry()
+    {
+        static Registry *instance = new Registry();
+        return *instance;
+    }
+
+    /**
+     * @brief Take a free buffer of that name, or create one (the caller holds the registry mutex)
+     */
+    ThreadBuffer *acquire(Registry &reg, const std::string &name)
+    {
+        for (auto &buffer : reg.buffers)
+        {
+            if (!buffer->inUse && buffer->name == name)
+            {
+                buffer->inUse = true;
+                return buffer.get();
+            }
+        }
+        auto buffer = std::make_unique<ThreadBuffer>();
+        buffer->name = name;
+        buffer->tid = static_cast<uint32_t>(reg.buffers.size() + 1);
+        buffer->inUse = true;
+        buffer->events = std::make_unique<Event[]>(Trace::EVENTS_PER_THREAD);
+        reg.buffers.push_back(std::move(buffer));
+        return reg.buffers.back().get();
+    }
+
+    /**
+     * @brief The calling thread's buffer; handed back to the registry when the thread ends
+     */
+    struct ThreadBinding
+    {
+        ThreadBuffer *buffer = nullptr;
+
+        ~ThreadBinding() { release(); }
+
+        void release()
+        {
+            if (buffer != nullptr)
+            {
+                std::lock_guard<std::mutex> lock(registry().mutex);
+                buffer->inUse = false;
+                buffer = nullptr;
+            }
+        }
+    };
+
+    thread_local ThreadBinding binding;
+
+    ThreadBuffer &currentBuffer()
+    {
+        if (binding.buffer == nullptr)
+        {
+            Registry &reg = registry();
+            std::lock_guard<std::mutex> lock(reg.mutex);
+            binding.buffer = acquire(reg, "thread " + std::to_string(reg.buffers.size() + 1));
+        }
+        return *binding.buffer;
+    }
+
+    std::string quote(std::string_view text)
+    {
+        return nlohmann::json(std::string(text)).dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+    }
+
+    void writeAtExit()
+    {
+        Trace::write();
+    }
+}
+
+/**
+ * @brief Enable tracing; the trace is written to file when the process exits
+ *
+ * @param file
+ */
+void Trace::start(const std::filesystem::path &file)
+{
+    Registry &reg = registry();
+    {
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        if (!reg.file.empty())
+        {
+            return; // Already started
+        }
+        reg.file = file;
+        reg.epoch = std::chrono::steady_clock::now();
+    }
+    std::atexit(writeAtExit);
+    active.store(true, std::memory_order_relaxed);
+    setThreadName("main");
+}
+
+/**
+ * @brief Name the calling thread's track
+ *
+ * @param name
+ */
+void Trace::setThreadName(std::string_view name)
+{
+    if (!enabled() || (binding.buffer != nullptr && binding.buffer->name == name))
+    {
+        return;
+    }
+    binding.release();
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    binding.buffer = acquire(reg, std::string(name));
+}
+
+/**
+ * @brief Time since tracing started
+ *
+ * @return int64_t
+ */
+int64_t Trace::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - registry().epoch).count();
+}
+
+/**
+ * @brief Record a complete event on the calling thread's track
+ *
+ * @param category
+ * @param name
+ * @param startNs
+ * @param endNs
+ * @param detail
+ */
+void Trace::record(const char *category, const char *name, int64_t startNs, int64_t endNs, std::string_view detail)
+{
+    if (!enabled())
+    {
+        return;
+    }
+    ThreadBuffer &buffer = currentBuffer();
+    Event &event = buffer.events[buffer.written % EVENTS_PER_THREAD];
+    event.category = category;
+    event.name = name;
+    event.startNs = startNs;
+    event.durationNs = endNs - startNs;
+    // Keep the end of long paths: the file name says more than the top directories
+    if (detail.size() > DETAIL_SIZE)
+    {
+        detail.remove_prefix(detail.size() - DETAIL_SIZE);
+    }
+    event.detailSize = static_cast<uint32_t>(detail.size());
+    std::memcpy(event.detail, detail.data(), detail.size());
+    buffer.written++;
+}
+
+/**
+ * @brief Write every recorded event as trace-event JSON (chrome://tracing, ui.perfetto.dev)
+ * @details Called at exit, after the worker threads have been joined.
+ *
+ * @return true
+ * @return false
+ */
+bool Trace::write()
+{
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    if (reg.file.empty())
+    {
+        return false;
+    }
+    active.store(false, std::memory_order_relaxed);
+
+    std::ofstream output(reg.file, std::ios::trunc);
+    output << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+           << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"backup\"}}";
+    char number[64];
+    for (const auto &buffer : reg.buffers)
+    {
+        output << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+               << ",\"args\":{\"name\":" << quote(buffer->name) << "}}";
+        output << ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+               << ",\"args\":{\"sort_index\":" << buffer->tid << "}}";
+
+        uint64_t count = std::min<uint64_t>(buffer->written, EVENTS_PER_THREAD);
+        if (count < buffer->written)
+        {
+            std::cerr << "Trace: the oldest " << buffer->written - count << " events of " << buffer->name
+                      << " were overwritten\n";
+        }
+        for (uint64_t i = buffer->written - count; i < buffer->written; ++i)
+        {
+            const Event &event = buffer->events[i % EVENTS_PER_THREAD];
+            std::snprintf(number, sizeof(number), "%.3f,\"dur\":%.3f",
+                          static_cast<double>(event.startNs) / 1000.0, static_cast<double>(event.durationNs) / 1000.0);
+            output << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category
+                   << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid << ",\"ts\":" << number;
+            if (event.detailSize != 0)
+            {
+                output << ",\"args\":{\"detail\":" << quote(std::string_view(event.detail, event.detailSize)) << "}";
+            }
+            output << "}";
+        }
+    }
+    output << "\n]}\n";
+    output.close();
+    if (!output)
+    {
+        std::cerr << "Cannot write the trace " << reg.file << "\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,97 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Chrome / Perfetto trace-event recorder (--trace)
+ * @details Every thread records complete ("X") events into its own fixed-size ring buffer, so
+ *          recording takes no lock and allocates nothing; when a ring is full the oldest events
+ *          are overwritten. The buffers are written as trace-event JSON when the process exits.
+ *          While tracing is off, a span costs one relaxed atomic load.
+ */
+class Trace
+{
+public:
+    static constexpr size_t EVENTS_PER_THREAD = 1 << 16;
+    static constexpr size_t DETAIL_SIZE = 80; // Longer details (paths) keep their end
+
+    /**
+     * @brief Enable tracing; the trace is written to file when the process exits
+     *
+     * @param file
+     */
+    static void start(const std::filesystem::path &file);
+
+    static bool enabled() { return active.load(std::memory_order_relaxed); } // Whether spans are recorded
+
+    /**
+     * @brief Name the calling thread's track
+     * @details Threads with the same name that do not run at the same time share one track, so
+     *          the workers of consecutive pools appear as "worker 0", "worker 1", ...
+     *
+     * @param name
+     */
+    static void setThreadName(std::string_view name);
+
+    /**
+     * @brief Time since tracing started
+     *
+     * @return int64_t Nanoseconds
+     */
+    static int64_t now();
+
+    /**
+     * @brief Record a complete event on the calling thread's track
+     *
+     * @param category
+     * @param name
+     * @param startNs From now()
+     * @param endNs From now()
+     * @param detail Shown as args.detail (e.g. the file), may be empty
+     */
+    static void record(const char *category, const char *name, int64_t startNs, int64_t endNs, std::string_view detail);
+
+    /**
+     * @brief Write every recorded event (called at exit)
+     *
+     * @return true
+     * @return false
+     */
+    static bool write();
+
+private:
+    static std::atomic<bool> active;
+};
+
+/**
+ * @brief Records the time from its construction to its destruction as one trace event
+ * @note category and name must be string literals; detail must stay valid until the span ends
+ */
+class TraceSpan
+{
+public:
+    TraceSpan(const char *category, const char *name, std::string_view detail = {})
+        : category(category), name(name), detail(detail), startNs(Trace::enabled() ? Trace::now() : -1) {}
+    ~TraceSpan()
+    {
+        if (startNs >= 0)
+        {
+            Trace::record(category, name, startNs, Trace::now(), detail);
+        }
+    }
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+    const char *category;
+    const char *name;
+    std::string_view detail;
+    int64_t startNs;
+};
+
+#endif // TRACE_H
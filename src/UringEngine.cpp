@@ -0,0 +1,412 @@
+#include "UringEngine.h"
+#include "Sha256Batch.h"
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/**
+ * @brief State of the file currently owned by one slot
+ */
+struct UringEngine::Slot
+{
+    enum class Stage
+    {
+        OpenSource,
+        OpenDestination,
+        Read,
+        Write,
+        CloseSource,
+        CloseDestination
+    };
+
+    unsigned index = 0;
+    unsigned char *buffer = nullptr;
+
+    size_t file = 0;
+    UringFile paths;
+    UringResult result;
+    ContentHasher hasher;
+
+    bool busy = false;        // An operation of the file is in the ring
+    Stage stage = Stage::OpenSource;
+    int in = -1;
+    int out = -1;
+    uintmax_t offset = 0;     // Offset of the data currently in the buffer
+    uint32_t base = 0;        // Position of the data of the last read in the buffer
+    uint32_t buffered = 0;    // Bytes of the last read
+    uint32_t written = 0;     // Bytes of the last read already written
+    uint32_t deferred = 0;    // Bytes at the start of the buffer whose SHA-256 is still to be computed
+};
+
+/**
+ * @brief Construct a new Uring Engine object
+ * @details Registered buffers save the kernel from pinning the pages on every read and write;
+ *          when registration is refused the same buffers are used with the plain operations.
+ *
+ * @param depth
+ * @param hashes
+ */
+UringEngine::UringEngine(unsigned depth, unsigned hashes)
+    : ring(IoUring::available() ? depth : 0), depth(depth), hashes(hashes)
+{
+    if (!ring.valid() || depth == 0)
+    {
+        return;
+    }
+
+    buffers = static_cast<unsigned char *>(std::aligned_alloc(Hasher::BUFFER_ALIGNMENT, depth * SLOT_SIZE));
+    if (buffers == nullptr)
+    {
+        return;
+    }
+
+    std::vector<iovec> vectors(depth);
+    for (unsigned i = 0; i < depth; ++i)
+    {
+        auto slot = std::make_unique<Slot>();
+        slot->index = i;
+        slot->buffer = buffers + i * SLOT_SIZE;
+        vectors[i] = {slot->buffer, SLOT_SIZE};
+        slots.push_back(std::move(slot));
+    }
+    fixedBuffers = ring.registerBuffers(vectors.data(), depth);
+}
+
+UringEngine::~UringEngine()
+{
+    std::free(buffers);
+}
+
+/**
+ * @brief Copy and/or hash count files
+ * @details Runs on the calling thread. A slot whose file is finished immediately picks the next
+ *          file, so the ring stays full until the list runs out.
+ *
+ *          A file that fits in a single read is not hashed as it arrives: its slot keeps the data
+ *          and, once the end of the file is confirmed, waits until Sha256Batch::LANES such files
+ *          can be hashed together. The read that confirms the end goes behind the data, so the
+ *          data survives it when the file turns out to be longer after all.
+ *
+ * @param count
+ * @param prepare
+ * @param complete
+ */
+void UringEngine::run(size_t count,
+                      const std::function<bool(size_t, UringFile &)> &prepare,
+                      const std::function<void(size_t, const UringResult &)> &complete)
+{
+#ifdef BACKUP_HAVE_IO_URING
+    size_t next = 0;
+    unsigned inFlight = 0;
+    int ringError = 0; // Set once io_uring_enter fails for good
+    std::vector<Slot *> waiting; // Finished reading, waiting for the batched SHA-256
+    size_t batchSize = std::min(Sha256Batch::LANES, slots.size());
+
+    // Give a free slot the next file that prepare() accepts
+    auto start = [&](Slot &slot)
+    {
+        while (next < count)
+        {
+            slot.file = next++;
+            slot.paths = UringFile();
+            if (!prepare(slot.file, slot.paths))
+            {
+                continue;
+            }
+            slot.result = UringResult();
+            slot.hasher.reset(hashes);
+            slot.stage = Slot::Stage::OpenSource;
+            slot.in = slot.out = -1;
+            slot.offset = 0;
+            slot.base = slot.buffered = slot.written = slot.deferred = 0;
+            if (ringError == 0 && submitNext(slot))
+            {
+                slot.busy = true;
+                inFlight++;
+                return;
+            }
+            slot.result.error = std::string("io_uring: ") + std::strerror(ringError != 0 ? ringError : EAGAIN);
+            finish(slot, complete);
+        }
+    };
+
+    auto fail = [&](Slot &slot, const char *what, int error)
+    {
+        if (slot.in >= 0)
+        {
+            ::close(slot.in);
+        }
+        if (slot.out >= 0)
+        {
+            ::close(slot.out);
+        }
+        slot.in = slot.out = -1;
+        slot.result.ok = false;
+        slot.result.error = std::string(what) + ": " + std::strerror(error);
+        finish(slot, complete);
+        inFlight--;
+        start(slot);
+    };
+
+    // Hash the files of the waiting slots together, report them and give the slots their next file
+    auto hashWaiting = [&]
+    {
+        std::vector<Slot *> batch;
+        batch.swap(waiting);
+        std::vector<const unsigned char *> messages;
+        std::vector<size_t> sizes;
+        for (Slot *slot : batch)
+        {
+            messages.push_back(slot->buffer);
+            sizes.push_back(slot->deferred);
+        }
+        std::vector<Sha256Digest> digests(batch.size());
+        Sha256Batch::hash(messages.data(), sizes.data(), batch.size(), digests.data());
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            Slot &slot = *batch[i];
+            slot.hasher.reset(hashes & ~Hasher::SHA256);
+            slot.hasher.update(slot.buffer, slot.deferred);
+            slot.result.digest = slot.hasher.finish();
+            slot.result.digest.sha256 = digests[i];
+            slot.result.digest.hashes = hashes;
+            slot.deferred = 0;
+            finish(slot, complete);
+            start(slot);
+        }
+    };
+
+    // Report a file that was read (and written) completely
+    auto succeed = [&](Slot &slot)
+    {
+        slot.result.ok = true;
+        inFlight--;
+        if (slot.deferred > 0)
+        {
+            slot.busy = false;
+            waiting.push_back(&slot);
+            if (waiting.size() >= batchSize)
+            {
+                hashWaiting();
+            }
+            return;
+        }
+        slot.result.digest = slot.hasher.finish();
+        finish(slot, complete);
+        start(slot);
+    };
+
+    // Move a slot to its next stage after the completion of its current operation
+    auto advance = [&](Slot &slot, int result)
+    {
+        switch (slot.stage)
+        {
+        case Slot::Stage::OpenSource:
+            if (result < 0)
+            {
+                return fail(slot, "cannot open source file", -result);
+            }
+            slot.in = result;
+            slot.stage = slot.paths.destination.empty() ? Slot::Stage::Read : Slot::Stage::OpenDestination;
+            break;
+        case Slot::Stage::OpenDestination:
+            if (result < 0)
+            {
+                return fail(slot, "cannot open destination file", -result);
+            }
+            slot.out = result;
+            // O_CREAT does not change the mode of an existing file
+            ::fchmod(slot.out, slot.paths.mode & 07777);
+            slot.stage = Slot::Stage::Read;
+            break;
+        case Slot::Stage::Read:
+            if (result < 0)
+            {
+                return fail(slot, "read", -result);
+            }
+            if (result == 0)
+            {
+                slot.stage = Slot::Stage::CloseSource;
+                break;
+            }
+            slot.base = slot.deferred;
+            if (slot.result.size == 0 && static_cast<size_t>(result) < SLOT_SIZE && (hashes & Hasher::SHA256))
+            {
+                // Probably the whole file
+                slot.deferred = static_cast<uint32_t>(result);
+            }
+            else
+            {
+                if (slot.deferred > 0)
+                {
+                    slot.hasher.update(slot.buffer, slot.deferred);
+                    slot.deferred = 0;
+                }
+                slot.hasher.update(slot.buffer + slot.base, static_cast<size_t>(result));
+            }
+            slot.result.size += static_cast<uintmax_t>(result);
+            if (slot.out >= 0)
+            {
+                slot.buffered = static_cast<uint32_t>(result);
+                slot.written = 0;
+                slot.stage = Slot::Stage::Write;
+            }
+            else
+            {
+                slot.offset += static_cast<uintmax_t>(result);
+            }
+            break;
+        case Slot::Stage::Write:
+            if (result <= 0)
+            {
+                return fail(slot, "write", result < 0 ? -result : EIO);
+            }
+            slot.written += static_cast<uint32_t>(result);
+            if (slot.written == slot.buffered)
+            {
+                slot.offset += slot.buffered;
+                slot.stage = Slot::Stage::Read;
+            }
+            break;
+        case Slot::Stage::CloseSource:
+            slot.in = -1;
+            if (slot.out < 0)
+            {
+                return succeed(slot);
+            }
+            slot.stage = Slot::Stage::CloseDestination;
+            break;
+        case Slot::Stage::CloseDestination:
+            slot.out = -1;
+            if (result < 0)
+            {
+                return fail(slot, "cannot close destination file", -result);
+            }
+            return succeed(slot);
+        }
+        if (!submitNext(slot))
+        {
+            fail(slot, "io_uring submission", EAGAIN);
+        }
+    };
+
+    for (auto &slot : slots)
+    {
+        start(*slot);
+    }
+
+    while (inFlight > 0 || !waiting.empty())
+    {
+        if (inFlight == 0)
+        {
+            // The last files of the list: no more slots will join the batch
+            hashWaiting();
+            continue;
+        }
+        int submitted = ring.submitAndWait(1);
+        if (submitted < 0 && submitted != -EBUSY && submitted != -EAGAIN)
+        {
+            // The ring is unusable; nothing more will complete, so fail what is left
+            ringError = -submitted;
+            for (auto &slot : slots)
+            {
+                if (slot->busy)
+                {
+                    fail(*slot, "io_uring", -submitted);
+                }
+            }
+            continue;
+        }
+        ring.reap([&](const io_uring_cqe &cqe)
+                  { advance(*slots[cqe.user_data], cqe.res); });
+    }
+#else
+    (void)count;
+    (void)prepare;
+    (void)complete;
+#endif
+}
+
+/**
+ * @brief Queue the operation of the current stage of a slot
+ *
+ * @param slot
+ * @return true
+ * @return false when the submission queue is full even after flushing it
+ */
+bool UringEngine::submitNext(Slot &slot)
+{
+#ifdef BACKUP_HAVE_IO_URING
+    io_uring_sqe *sqe = ring.getSqe();
+    if (sqe == nullptr)
+    {
+        ring.submitAndWait(0);
+        sqe = ring.getSqe();
+        if (sqe == nullptr)
+        {
+            return false;
+        }
+    }
+    sqe->user_data = slot.index;
+
+    switch (slot.stage)
+    {
+    case Slot::Stage::OpenSource:
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<uint64_t>(slot.paths.source.c_str());
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        break;
+    case Slot::Stage::OpenDestination:
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<uint64_t>(slot.paths.destination.c_str());
+        sqe->len = slot.paths.mode & 07777;
+        sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+        break;
+    case Slot::Stage::Read:
+        sqe->opcode = fixedBuffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd = slot.in;
+        sqe->addr = reinterpret_cast<uint64_t>(slot.buffer + slot.deferred);
+        sqe->len = static_cast<uint32_t>(SLOT_SIZE) - slot.deferred;
+        sqe->off = slot.offset;
+        sqe->buf_index = static_cast<uint16_t>(slot.index);
+        break;
+    case Slot::Stage::Write:
+        sqe->opcode = fixedBuffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = slot.out;
+        sqe->addr = reinterpret_cast<uint64_t>(slot.buffer + slot.base + slot.written);
+        sqe->len = slot.buffered - slot.written;
+        sqe->off = slot.offset + slot.written;
+        sqe->buf_index = static_cast<uint16_t>(slot.index);
+        break;
+    case Slot::Stage::CloseSource:
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = slot.in;
+        break;
+    case Slot::Stage::CloseDestination:
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = slot.out;
+        break;
+    }
+    return true;
+#else
+    (void)slot;
+    return false;
+#endif
+}
+
+/**
+ * @brief Report the result of the file owned by a slot
+ *
+ * @param slot
+ * @param complete
+ */
+void UringEngine::finish(Slot &slot, const std::function<void(size_t, const UringResult &)> &complete)
+{
+    slot.busy = false;
+    complete(slot.file, slot.result);
+}
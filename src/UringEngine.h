@@ -0,0 +1,94 @@
+#ifndef URINGENGINE_H
+#define URINGENGINE_H
+
+#include "Hasher.h"
+#include "IoUring.h"
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief One file handled by UringEngine
+ */
+struct UringFile
+{
+    std::filesystem::path source;
+    std::filesystem::path destination; // Empty: only hash the source
+    uint32_t mode = 0644;              // Permission bits of the destination
+};
+
+/**
+ * @brief Outcome of one file handled by UringEngine
+ */
+struct UringResult
+{
+    bool ok = false;
+    uintmax_t size = 0;   // Bytes read from the source
+    FileDigest digest;
+    std::string error;    // Set when ok is false
+};
+
+/**
+ * @brief Copies and/or hashes many small files from one thread through io_uring
+ * @details Every file in flight owns one slot: a registered buffer and a small state machine
+ *          (open source -> open destination -> read/write until end of file -> close). Each
+ *          completion immediately queues the next step of its file, so hundreds of opens, reads,
+ *          writes and closes are in the kernel at once without a thread per file.
+ */
+class UringEngine
+{
+public:
+    static constexpr unsigned DEFAULT_DEPTH = 256;        // Files in flight
+    static constexpr size_t SLOT_SIZE = 128 * 1024;       // Bytes per read
+    static constexpr uintmax_t MAX_FILE_SIZE = 1 << 20;   // Larger files are better served by copy_file_range/reflink
+
+    /**
+     * @brief Construct a new Uring Engine object
+     *
+     * @param depth Number of files in flight
+     * @param hashes Digests to compute: Hasher::SHA256 and/or Hasher::BLAKE3
+     * @note Check valid() afterwards and fall back to the thread pool when it is false
+     */
+    explicit UringEngine(unsigned depth = DEFAULT_DEPTH, unsigned hashes = Hasher::SHA256);
+    ~UringEngine();
+
+    bool valid() const { return ring.valid() && buffers != nullptr; } // Whether io_uring can be used
+
+    /**
+     * @brief Copy and/or hash count files
+     *
+     * @param count Number of files
+     * @param prepare Called as prepare(index, file) right before a file is started; returning false skips it
+     * @param complete Called as complete(index, result) once a file is finished
+     */
+    void run(size_t count,
+             const std::function<bool(size_t, UringFile &)> &prepare,
+             const std::function<void(size_t, const UringResult &)> &complete);
+
+    /**
+     * @brief Get the number of files each of jobs workers keeps in flight
+     *
+     * @param jobs
+     * @return unsigned DEFAULT_DEPTH shared between the workers, at least 16 each
+     */
+    static unsigned depthPerWorker(unsigned jobs) { return std::max(16u, DEFAULT_DEPTH / std::max(1u, jobs)); }
+
+private:
+    struct Slot;
+
+    IoUring ring;
+    unsigned depth;
+    unsigned hashes;
+    unsigned char *buffers = nullptr;
+    bool fixedBuffers = false;
+    std::vector<std::unique_ptr<Slot>> slots;
+
+    bool submitNext(Slot &slot);
+    void finish(Slot &slot, const std::function<void(size_t, const UringResult &)> &complete);
+};
+
+#endif // URINGENGINE_H
@@ -0,0 +1,104 @@
+#include "WorkerPool.h"
+#include "Trace.h"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+WorkerPool::WorkerPool(unsigned jobs) : jobs(jobs == 0 ? defaultJobs() : jobs)
+{
+}
+
+/**
+ * @brief Get the default number of jobs
+ *
+ * @return unsigned
+ */
+unsigned WorkerPool::defaultJobs()
+{
+    unsigned count = std::thread::hardware_concurrency();
+    return count == 0 ? 1 : count;
+}
+
+/**
+ * @brief Parse the value of --jobs
+ *
+ * @param text
+ * @param jobs
+ * @return true
+ * @return false
+ */
+bool WorkerPool::parseJobs(const std::string &text, unsigned &jobs)
+{
+    unsigned value = 0;
+    const char *end = text.data() + text.size();
+    auto [last, error] = std::from_chars(text.data(), end, value);
+    if (error != std::errc() || last != end || value == 0 || value > MAX_JOBS)
+    {
+        return false;
+    }
+    jobs = value;
+    return true;
+}
+
+/**
+ * @brief Run a task for every index in [0, count)
+ * @details Indices are claimed from a shared atomic cursor, so a slow item (e.g. a huge file) never
+ *          holds up the items queued behind it. The calling thread only waits and drives onTick.
+ *
+ * @param count
+ * @param task
+ * @param onTick
+ */
+void WorkerPool::forEach(size_t count,
+                         const std::function<void(size_t, unsigned)> &task,
+                         const std::function<void()> &onTick) const
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    std::atomic<size_t> next{0};
+    std::mutex doneMutex;
+    std::condition_variable doneCondition;
+    unsigned running = static_cast<unsigned>(std::min<size_t>(jobs, count));
+    unsigned finished = 0;
+
+    std::vector<std::jthread> workers;
+    workers.reserve(running);
+    for (unsigned worker = 0; worker < running; ++worker)
+    {
+        workers.emplace_back([&, worker]
+                             {
+            if (Trace::enabled())
+            {
+                Trace::setThreadName("worker " + std::to_string(worker));
+            }
+            for (size_t index = next.fetch_add(1, std::memory_order_relaxed); index < count;
+                 index = next.fetch_add(1, std::memory_order_relaxed))
+            {
+                task(index, worker);
+            }
+            std::lock_guard<std::mutex> lock(doneMutex);
+            finished++;
+            doneCondition.notify_one(); });
+    }
+
+    std::unique_lock<std::mutex> lock(doneMutex);
+    while (finished != running)
+    {
+        doneCondition.wait_for(lock, std::chrono::milliseconds(100));
+        if (onTick)
+        {
+            lock.unlock();
+            onTick();
+            lock.lock();
+        }
+    }
+}
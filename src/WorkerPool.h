@@ -0,0 +1,54 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+class WorkerPool
+{
+public:
+    /**
+     * @brief Construct a new Worker Pool object
+     *
+     * @param jobs Number of worker threads (0 means hardware concurrency)
+     */
+    explicit WorkerPool(unsigned jobs = 0);
+
+    unsigned size() const { return jobs; }  // Get the number of worker threads
+
+    /**
+     * @brief Run a task for every index in [0, count), handing indices out dynamically to the workers
+     *
+     * @param count Number of work items
+     * @param task Called as task(index, worker) where worker is in [0, size())
+     * @param onTick Optional callback invoked periodically on the calling thread while the workers are busy
+     */
+    void forEach(size_t count,
+                 const std::function<void(size_t, unsigned)> &task,
+                 const std::function<void()> &onTick = nullptr) const;
+
+    /**
+     * @brief Get the default number of jobs
+     *
+     * @return unsigned Hardware concurrency, or 1 when it cannot be determined
+     */
+    static unsigned defaultJobs();
+
+    /**
+     * @brief Parse the value of --jobs
+     *
+     * @param text
+     * @param jobs Receives the number of workers
+     * @return true
+     * @return false when text is not a whole number in [1, MAX_JOBS]
+     */
+    static bool parseJobs(const std::string &text, unsigned &jobs);
+
+    static constexpr unsigned MAX_JOBS = 1024; // Largest --jobs accepted; per-worker state is sized from it
+
+private:
+    unsigned jobs;
+};
+
+#endif // WORKERPOOL_H